@@ -0,0 +1,227 @@
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logman/logman.h"
+
+#define BENCH_ITERATIONS_DEFAULT  200000
+#define BENCH_THREADS_DEFAULT     4
+#define BENCH_LONG_MESSAGE_LEN    440
+#define BENCH_FILE                "logman_bench.log"
+#define BENCH_SINK_FILE           "logman_bench_sink.log"
+
+typedef enum {
+    BENCH_MSG_SHORT = 0,
+    BENCH_MSG_LONG,
+    BENCH_MSG_FILTERED,
+    BENCH_MSG_KV,
+} bench_message;
+
+typedef struct {
+    const char* name;
+    logman_type type;
+    logman_output out_type;
+    logman_mode mode;
+    logman_format format;
+    bool sink;
+} bench_case;
+
+typedef struct {
+    bench_message message;
+    size_t iterations;
+    uint64_t* latency;
+} bench_thread;
+
+static const bench_case bench_cases[] = {
+    { "debug/stream",        LOGTYPE_DEBUG,   LOGOUT_STREAM, LOGMODE_SYNC,  LOGFORMAT_DEFAULT, false },
+    { "product/stream",      LOGTYPE_PRODUCT, LOGOUT_STREAM, LOGMODE_SYNC,  LOGFORMAT_DEFAULT, false },
+    { "debug/file",          LOGTYPE_DEBUG,   LOGOUT_FILE,   LOGMODE_SYNC,  LOGFORMAT_DEFAULT, false },
+    { "product/file",        LOGTYPE_PRODUCT, LOGOUT_FILE,   LOGMODE_SYNC,  LOGFORMAT_DEFAULT, false },
+    { "product/file/async",  LOGTYPE_PRODUCT, LOGOUT_FILE,   LOGMODE_ASYNC, LOGFORMAT_DEFAULT, false },
+    { "product/file+sink",   LOGTYPE_PRODUCT, LOGOUT_FILE,   LOGMODE_SYNC,  LOGFORMAT_DEFAULT, true  },
+    { "product/file/json",   LOGTYPE_PRODUCT, LOGOUT_FILE,   LOGMODE_SYNC,  LOGFORMAT_JSON,    false },
+    { "product/file/logfmt", LOGTYPE_PRODUCT, LOGOUT_FILE,   LOGMODE_SYNC,  LOGFORMAT_LOGFMT,  false },
+    { "product/mmap",        LOGTYPE_PRODUCT, LOGOUT_MMAP,   LOGMODE_SYNC,  LOGFORMAT_DEFAULT, false },
+    { "product/binary",      LOGTYPE_PRODUCT, LOGOUT_BINARY, LOGMODE_SYNC,  LOGFORMAT_DEFAULT, false },
+};
+
+static const char* bench_message_names[] = { "short", "long", "filtered", "kv" };
+
+static char bench_long_message[BENCH_LONG_MESSAGE_LEN + 1];
+
+static inline uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void* bench_producer(void* arg)
+{
+    bench_thread* thread = (bench_thread*)arg;
+    for (size_t i = 0; i < thread->iterations; i++) {
+        uint64_t start = bench_now_ns();
+        switch (thread->message) {
+            case BENCH_MSG_SHORT:
+                log_info("request %zu done in %d us", i, 42);
+                break;
+            case BENCH_MSG_LONG:
+                log_info("%s %zu", bench_long_message, i);
+                break;
+            case BENCH_MSG_FILTERED:
+                log_debug("request %zu done in %d us", i, 42);
+                break;
+            case BENCH_MSG_KV:
+                log_info_kv("request done", LOGKV_UINT("request", i), LOGKV_INT("us", 42));
+                break;
+        }
+        thread->latency[i] = bench_now_ns() - start;
+    }
+    return NULL;
+}
+
+static int bench_compare(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t bench_percentile(const uint64_t* sorted, size_t count, double pct)
+{
+    size_t index = (size_t)(pct / 100.0 * (double)(count - 1));
+    return sorted[index];
+}
+
+static bool bench_run(const bench_case* bc, bench_message message, size_t threads, size_t iterations)
+{
+    logman_sink_settings sink;
+    memset(&sink, 0, sizeof(sink));
+    sink.out_type = LOGOUT_FILE;
+    sink.output.file_name = BENCH_SINK_FILE;
+    sink.min_level = LOGLEVEL_WARNING;
+    sink.format = LOGFORMAT_DEBUG;
+
+    logman_settings settings;
+    memset(&settings, 0, sizeof(settings));
+    settings.type = bc->type;
+    settings.out_type = bc->out_type;
+    settings.mode = bc->mode;
+    settings.format = bc->format;
+    settings.async_queue_size = 64 * 1024;
+    if (bc->out_type == LOGOUT_STREAM) {
+        settings.output.out_stream = stderr;
+    } else {
+        settings.output.file_name = BENCH_FILE;
+    }
+    if (bc->sink) {
+        settings.sinks = &sink;
+        settings.sinks_count = 1;
+    }
+    if (log_init(&settings) != LOGERR_NOERR) {
+        // stderr is redirected while a case runs
+        printf("logman_bench: unable to init %s: %s", bc->name, log_get_internal_error());
+        log_destruct();
+        return false;
+    }
+    if (message == BENCH_MSG_FILTERED) {
+        // debug records are enabled by the debug type, measure the threshold check in both
+        log_set_level(LOGLEVEL_INFO);
+    }
+
+    bench_thread* workers = (bench_thread*)calloc(threads, sizeof(bench_thread));
+    pthread_t* ids = (pthread_t*)calloc(threads, sizeof(pthread_t));
+    uint64_t* latency = (uint64_t*)malloc(threads * iterations * sizeof(uint64_t));
+    if (workers == NULL || ids == NULL || latency == NULL) {
+        free(workers);
+        free(ids);
+        free(latency);
+        log_destruct();
+        return false;
+    }
+
+    uint64_t start = bench_now_ns();
+    for (size_t i = 0; i < threads; i++) {
+        workers[i].message = message;
+        workers[i].iterations = iterations;
+        workers[i].latency = &latency[i * iterations];
+        pthread_create(&ids[i], NULL, bench_producer, &workers[i]);
+    }
+    for (size_t i = 0; i < threads; i++) {
+        pthread_join(ids[i], NULL);
+    }
+    // records still queued for the backend thread are part of the cost
+    log_flush();
+    uint64_t wall = bench_now_ns() - start;
+    log_destruct();
+
+    size_t count = threads * iterations;
+    uint64_t sum = 0;
+    for (size_t i = 0; i < count; i++) {
+        sum += latency[i];
+    }
+    qsort(latency, count, sizeof(uint64_t), bench_compare);
+
+    printf("%-22s %-9s %7zu %10.1f %13.0f %8llu %8llu %8llu\n", bc->name, bench_message_names[message], threads,
+        (double)sum / (double)count, (double)count * 1e9 / (double)wall,
+        (unsigned long long)bench_percentile(latency, count, 50.0),
+        (unsigned long long)bench_percentile(latency, count, 99.0),
+        (unsigned long long)bench_percentile(latency, count, 99.9));
+    fflush(stdout);
+
+    free(workers);
+    free(ids);
+    free(latency);
+    remove(BENCH_FILE);
+    remove(BENCH_SINK_FILE);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    size_t iterations = (argc > 1) ? strtoul(argv[1], NULL, 10) : BENCH_ITERATIONS_DEFAULT;
+    size_t max_threads = (argc > 2) ? strtoul(argv[2], NULL, 10) : BENCH_THREADS_DEFAULT;
+    const char* filter = (argc > 3) ? argv[3] : NULL;
+    if (argc > 4 || iterations == 0 || max_threads == 0) {
+        fprintf(stderr, "usage: %s [iterations per thread] [max threads] [case filter]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    memset(bench_long_message, 'x', BENCH_LONG_MESSAGE_LEN);
+    bench_long_message[BENCH_LONG_MESSAGE_LEN] = '\0';
+
+    // stream cases write to stderr, keep the terminal for the report
+    int saved_stderr = dup(STDERR_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (saved_stderr < 0 || null_fd < 0) {
+        fprintf(stderr, "logman_bench: unable to redirect stderr\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("%-22s %-9s %7s %10s %13s %8s %8s %8s\n", "case", "message", "threads", "ns/call", "records/s",
+        "p50 ns", "p99 ns", "p99.9 ns");
+    bool ok = true;
+    for (size_t c = 0; c < sizeof(bench_cases) / sizeof(bench_cases[0]); c++) {
+        if (filter != NULL && strstr(bench_cases[c].name, filter) == NULL) {
+            continue;
+        }
+        for (int message = BENCH_MSG_SHORT; message <= BENCH_MSG_KV; message++) {
+            for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+                fflush(stderr);
+                dup2(null_fd, STDERR_FILENO);
+                ok = bench_run(&bench_cases[c], (bench_message)message, threads, iterations) && ok;
+                fflush(stderr);
+                dup2(saved_stderr, STDERR_FILENO);
+            }
+        }
+    }
+
+    close(null_fd);
+    close(saved_stderr);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -21,6 +21,12 @@ void mylog_error_callback(void)
 
 int main(void)
 {
+    const logman_site* sites[64];
+    size_t count = log_sites(sites, 64);
+    for (size_t i = 0; i < count && i < 64; i++) {
+        printf("log statement %s:%d in %s()\n", sites[i]->file, sites[i]->line, sites[i]->func);
+    }
+
     if (log_init_default() != LOGERR_NOERR) {
         printf("logman initialization error\n");
         return EXIT_FAILURE;
@@ -1,4 +1,4 @@
-#pragma "once"
+#pragma once
 
 #include <stdarg.h>
 #include <stdio.h>
@@ -21,12 +21,141 @@
  #define LOGMANAPI
 #endif
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define __FILENAME__ (__builtin_strrchr(__FILE__, '/') ? __builtin_strrchr(__FILE__, '/') + 1 : __FILE__)
 
-#define log_debug(...)      __log_log(LOGLEVEL_DEBUG,   __FILENAME__, __func__, __LINE__, __VA_ARGS__)
-#define log_info(...)       __log_log(LOGLEVEL_INFO,    __FILENAME__, __func__, __LINE__, __VA_ARGS__)
-#define log_warning(...)    __log_log(LOGLEVEL_WARNING, __FILENAME__, __func__, __LINE__, __VA_ARGS__)
-#define log_error(...)      __log_log(LOGLEVEL_ERROR,   __FILENAME__, __func__, __LINE__, __VA_ARGS__)
+/* Records below LOGMAN_MIN_LEVEL (0 - DEBUG, 1 - INFO, 2 - WARNING, 3 - ERROR) are compiled out:
+ * their arguments are never evaluated. Enabled levels are checked against the runtime
+ * threshold inline, so a filtered record does not call into the library.
+ */
+#ifndef LOGMAN_MIN_LEVEL
+ #define LOGMAN_MIN_LEVEL 0
+#endif
+
+#define __log_enabled(level) \
+    ((int)(level) >= LOGMAN_MIN_LEVEL && (int)(level) >= __atomic_load_n(&__log_min_level, __ATOMIC_RELAXED))
+
+/* Every log_* statement owns a static call-site descriptor, the library renders its
+ * "file::func::line::" part once. In C translation units they are collected in the
+ * logman_sites section, see log_sites(). C++ inline functions keep their statics in
+ * COMDAT groups, which cannot share a section with the others, so C++ sites add
+ * themselves to a list in the library the first time they log instead.
+ */
+#if defined(__ELF__) && !defined(__cplusplus)
+ #define __LOG_SITE_SECTION __attribute__((used, section("logman_sites"), aligned(sizeof(void*))))
+#else
+ #define __LOG_SITE_SECTION
+#endif
+
+#if defined(__cplusplus)
+ #define __log_site_register(name) ; static const __log_site_registrar __log_cat(name, _registrar)(&name)
+#else
+ #define __log_site_register(name)
+#endif
+
+// literal tells whether the format is a string literal, it may then stand for the call site
+#define __log_site_define(name, level, literal) \
+    static logman_site name __LOG_SITE_SECTION = { __FILENAME__, __func__, __LINE__, level, true, 0, NULL, literal } \
+    __log_site_register(name)
+
+#define __log_first_(first, ...) first
+#define __log_literal(...) __builtin_constant_p(__log_first_(__VA_ARGS__, 0))
+
+#define __log_filtered(level, ...) \
+    do { \
+        if (__log_enabled(level)) { \
+            __log_site_define(__log_site, level, __log_literal(__VA_ARGS__)); \
+            __log_log_site(&__log_site, __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define log_debug(...)      __log_filtered(LOGLEVEL_DEBUG,   __VA_ARGS__)
+#define log_info(...)       __log_filtered(LOGLEVEL_INFO,    __VA_ARGS__)
+#define log_warning(...)    __log_filtered(LOGLEVEL_WARNING, __VA_ARGS__)
+#define log_error(...)      __log_filtered(LOGLEVEL_ERROR,   __VA_ARGS__)
+
+/* Structured records: a plain message followed by LOGKV_* fields, e.g.
+ * log_info_kv("request done", LOGKV_INT("user", id), LOGKV_STR("path", path));
+ * The leading placeholder lets the field list be empty.
+ */
+#define __log_kv_filtered(level, message, ...) \
+    do { \
+        if (__log_enabled(level)) { \
+            __log_site_define(__log_site, level, false); \
+            const logman_kv __log_kv[] = { LOGKV_BOOL(NULL, false), ##__VA_ARGS__ }; \
+            __log_log_site_kv(&__log_site, message, &__log_kv[1], sizeof(__log_kv) / sizeof(__log_kv[0]) - 1); \
+        } \
+    } while (0)
+
+#define log_debug_kv(...)   __log_kv_filtered(LOGLEVEL_DEBUG,   __VA_ARGS__)
+#define log_info_kv(...)    __log_kv_filtered(LOGLEVEL_INFO,    __VA_ARGS__)
+#define log_warning_kv(...) __log_kv_filtered(LOGLEVEL_WARNING, __VA_ARGS__)
+#define log_error_kv(...)   __log_kv_filtered(LOGLEVEL_ERROR,   __VA_ARGS__)
+
+/* Rate limited records, the counters are kept per call site:
+ * log_every_n(LOGLEVEL_ERROR, 100, "connect failed: %s", err);
+ * log_first_n   - the first n records only
+ * log_every_n   - every n-th record, starting with the first
+ * log_every_ms  - at most one record per interval
+ * log_rate      - token bucket of burst records refilled at per_sec records per second
+ * Suppressed calls neither format nor reach the library, the next record that passes
+ * ends with " [suppressed N]".
+ */
+#define __log_limited(level, pass, ...) \
+    do { \
+        static logman_limit __log_limit; \
+        if (__log_enabled(level) && (pass)) { \
+            __log_site_define(__log_site, level, __log_literal(__VA_ARGS__)); \
+            __log_log_limited(&__log_site, __atomic_exchange_n(&__log_limit.suppressed, 0, __ATOMIC_RELAXED), \
+                __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define log_first_n(level, n, ...) \
+    __log_limited(level, __log_limit_first_n(&__log_limit, n), __VA_ARGS__)
+#define log_every_n(level, n, ...) \
+    __log_limited(level, __log_limit_every_n(&__log_limit, n), __VA_ARGS__)
+#define log_every_ms(level, ms, ...) \
+    __log_limited(level, __log_limit_interval(&__log_limit, (unsigned long long)(ms) * 1000000ull), __VA_ARGS__)
+#define log_rate(level, per_sec, burst, ...) \
+    __log_limited(level, __log_limit_bucket(&__log_limit, per_sec, burst), __VA_ARGS__)
+
+/* Records of a logman_create() instance, checked against its own level threshold:
+ * logman_log(net_log, LOGLEVEL_INFO, "connected to %s", host);
+ * logman_log_kv(net_log, LOGLEVEL_INFO, "request done", LOGKV_INT("status", 200));
+ */
+#define __logman_enabled(handle, level) \
+    ((int)(level) >= LOGMAN_MIN_LEVEL && \
+     (int)(level) >= __atomic_load_n((const int*)(handle), __ATOMIC_RELAXED))
+
+#define logman_log(handle, level, ...) \
+    do { \
+        logman_t* __logman_handle = (handle); \
+        if (__logman_enabled(__logman_handle, level)) { \
+            __log_site_define(__log_site, level, __log_literal(__VA_ARGS__)); \
+            __logman_log_site(__logman_handle, &__log_site, __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define logman_log_kv(handle, level, message, ...) \
+    do { \
+        logman_t* __logman_handle = (handle); \
+        if (__logman_enabled(__logman_handle, level)) { \
+            __log_site_define(__log_site, level, false); \
+            const logman_kv __log_kv[] = { LOGKV_BOOL(NULL, false), ##__VA_ARGS__ }; \
+            __logman_log_site_kv(__logman_handle, &__log_site, message, &__log_kv[1], \
+                sizeof(__log_kv) / sizeof(__log_kv[0]) - 1); \
+        } \
+    } while (0)
+
+#define LOGKV_INT(key, value)       __logkv_int(key, (long long)(value))
+#define LOGKV_UINT(key, value)      __logkv_uint(key, (unsigned long long)(value))
+#define LOGKV_DOUBLE(key, value)    __logkv_double(key, (double)(value))
+#define LOGKV_BOOL(key, value)      __logkv_bool(key, (bool)(value))
+#define LOGKV_STR(key, value)       __logkv_str(key, value)
 
 typedef enum {
     LOGTYPE_UNKNOWN = 0,
@@ -47,8 +176,49 @@ typedef enum {
     LOGOUT_UNKNOWN = 0,
     LOGOUT_STREAM,
     LOGOUT_FILE,
+    LOGOUT_BINARY,      /* compact records, decoded to text with logman-decode */
+    LOGOUT_MMAP,        /* records are copied into a shared mapping of the file */
+    LOGOUT_SOCKET,      /* a datagram per record to a local collector */
 } logman_output;
 
+typedef enum {
+    LOGPREC_SEC = 0,
+    LOGPREC_MSEC,
+    LOGPREC_USEC,
+    LOGPREC_NSEC,
+} logman_time_precision;
+
+typedef enum {
+    LOGTIME_LOCAL = 0,      /* dd.mm.yyyy hh:mm:ss */
+    LOGTIME_ISO8601_UTC,    /* yyyy-mm-ddThh:mm:ssZ */
+} logman_time_format;
+
+typedef enum {
+    LOGFORMAT_DEFAULT = 0,  /* format of the logman type */
+    LOGFORMAT_DEBUG,        /* date::LEVEL::file::func::line::message */
+    LOGFORMAT_PRODUCT,      /* date::LEVEL::message */
+    LOGFORMAT_JSON,         /* one JSON object per line */
+    LOGFORMAT_LOGFMT,       /* key=value pairs per line */
+
+    LOGFORMAT_COUNT,
+} logman_format;
+
+typedef enum {
+    LOGCOMPRESS_NONE = 0,
+    LOGCOMPRESS_LZ4,        /* LZ4 frames, read with lz4 -dc or logman-decode */
+    LOGCOMPRESS_ZSTD,       /* zstd frames, builds with libzstd only */
+} logman_compress;
+
+typedef enum {
+    LOGSOCKET_DROP = 0,     /* records that find the socket buffer full are dropped */
+    LOGSOCKET_BLOCK,        /* the writer waits for the collector to catch up */
+} logman_socket_policy;
+
+typedef enum {
+    LOGMODE_SYNC = 0,
+    LOGMODE_ASYNC,
+} logman_mode;
+
 typedef enum {
     LOGERR_NOERR = 0,
     LOGERR_LOGFILECREATE,
@@ -56,21 +226,388 @@ typedef enum {
     LOGERR_LOGUNKNOWNTYPE,
     LOGERR_LOGUNKNOWNOUTTYPE,
     LOGERR_LOGBUFOVERFLOW,
+    LOGERR_LOGUNKNOWNMODE,
+    LOGERR_LOGASYNCINIT,
+    LOGERR_LOGBADFORMAT,
+    LOGERR_LOGWRITE,
+    LOGERR_LOGSINKLIMIT,
+    LOGERR_LOGRECORDERINIT,
+    LOGERR_LOGRECONFIGURE,
+    LOGERR_LOGCOMPRESS,
+    LOGERR_LOGINDEX,
+    LOGERR_LOGCLOCKINIT,
+    LOGERR_LOGSOCKET,
 } logman_error;
 
+typedef enum {
+    LOGKV_TYPE_INT = 0,
+    LOGKV_TYPE_UINT,
+    LOGKV_TYPE_DOUBLE,
+    LOGKV_TYPE_BOOL,
+    LOGKV_TYPE_STR,
+} logman_kv_type;
+
+/* Field of a structured record, built with the LOGKV_* macros */
+typedef struct {
+    const char* key;
+    logman_kv_type type;
+    union {
+        long long i;
+        unsigned long long u;
+        double d;
+        bool b;
+        const char* s;
+    } value;
+} logman_kv;
+
+static inline logman_kv __logkv_int(const char* key, long long value)
+{
+    logman_kv kv;
+    kv.key = key;
+    kv.type = LOGKV_TYPE_INT;
+    kv.value.i = value;
+    return kv;
+}
+
+static inline logman_kv __logkv_uint(const char* key, unsigned long long value)
+{
+    logman_kv kv;
+    kv.key = key;
+    kv.type = LOGKV_TYPE_UINT;
+    kv.value.u = value;
+    return kv;
+}
+
+static inline logman_kv __logkv_double(const char* key, double value)
+{
+    logman_kv kv;
+    kv.key = key;
+    kv.type = LOGKV_TYPE_DOUBLE;
+    kv.value.d = value;
+    return kv;
+}
+
+static inline logman_kv __logkv_bool(const char* key, bool value)
+{
+    logman_kv kv;
+    kv.key = key;
+    kv.type = LOGKV_TYPE_BOOL;
+    kv.value.b = value;
+    return kv;
+}
+
+static inline logman_kv __logkv_str(const char* key, const char* value)
+{
+    logman_kv kv;
+    kv.key = key;
+    kv.type = LOGKV_TYPE_STR;
+    kv.value.s = value;
+    return kv;
+}
+
+/* Call site of a log statement. tail holds "file::func::line::" once a debug
+ * format record was written from a persistent site, tail_len is its length.
+ * literal is set when the statement's format is a string literal.
+ */
+typedef struct logman_site {
+    const char* file;
+    const char* func;
+    int line;
+    logman_level level;
+    bool persistent;
+    size_t tail_len;
+    char* tail;
+    bool literal;
+} logman_site;
+
+/* Counters of a rate limited call site. next is the time of the next record in ns,
+ * for the token bucket the time the bucket is full again.
+ */
+typedef struct logman_limit {
+    size_t count;
+    size_t suppressed;
+    unsigned long long next;
+} logman_limit;
+
+static inline bool __log_limit_first_n(logman_limit* limit, size_t n)
+{
+    // the load keeps the counter from moving once the limit is reached
+    return __atomic_load_n(&limit->count, __ATOMIC_RELAXED) < n &&
+        __atomic_fetch_add(&limit->count, 1, __ATOMIC_RELAXED) < n;
+}
+
+static inline bool __log_limit_every_n(logman_limit* limit, size_t n)
+{
+    if (n > 1 && __atomic_fetch_add(&limit->count, 1, __ATOMIC_RELAXED) % n != 0) {
+        __atomic_fetch_add(&limit->suppressed, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    return true;
+}
+
+/* Most additional sinks of one logger, and latency buckets of log_get_stats() */
+#define LOGMAN_SINKS_MAX        8
+#define LOGMAN_LATENCY_BUCKETS  32
+
+/* Counters of log_get_stats(), every field is an unsigned long long */
+typedef struct {
+    unsigned long long records[LOGLEVEL_COUNT];     /* records past the level threshold */
+    unsigned long long bytes;                       /* written to the main output */
+    unsigned long long sink_bytes[LOGMAN_SINKS_MAX];
+    unsigned long long truncated;                   /* records cut to fit the buffers */
+    unsigned long long dropped;                     /* records lost to a full async queue or socket */
+    unsigned long long write_errors;
+    unsigned long long write_calls;                 /* write(2)/writev(2)/sendmmsg(2) calls */
+    /* Time spent in the library per record, bucket i counts [2^i, 2^(i+1)) ns.
+     * Collected with logman_settings.stats_latency only.
+     */
+    unsigned long long latency[LOGMAN_LATENCY_BUCKETS];
+    /* Cycles spent formatting and writing records, LOGMAN_STATS_TSC builds only */
+    unsigned long long former_cycles;
+    unsigned long long former_calls;
+    unsigned long long writer_cycles;
+    unsigned long long writer_calls;
+} logman_stats;
+
+/* Additional output fed with the records of the main one. The runtime threshold
+ * applies first, min_level can only narrow it down.
+ */
+typedef struct {
+    logman_output out_type;     /* LOGOUT_STREAM or LOGOUT_FILE */
+    union {
+        FILE* out_stream;
+        const char* file_name;
+    } output;
+    logman_level min_level;
+    logman_format format;
+} logman_sink_settings;
+
 typedef struct {
     logman_type type;
     logman_output out_type;
     union {
         FILE* out_stream;
         const char* file_name;
+        /* LOGOUT_SOCKET: unix:<path> of a datagram socket or udp:<host>:<port> */
+        const char* address;
     } output;
     void (*error_callback)(void);
+    /* LOGMODE_ASYNC hands records to a background writer thread */
+    logman_mode mode;
+    /* Async queue capacity in records, rounded up to a power of two (0 - default) */
+    size_t async_queue_size;
+    /* Fraction of a second appended to the timestamp */
+    logman_time_precision time_precision;
+    logman_time_format time_format;
+    /* Timestamps from the cycle counter (CLOCK_MONOTONIC_RAW where it is not invariant),
+     * calibrated against the wall clock at init and resynced every second in the background */
+    bool time_tsc;
+    /* File output buffer, written out once this many bytes accumulate (0 - default) */
+    size_t file_buffer_size;
+    /* Period of the background flush of the file buffer (0 - no periodic flush) */
+    unsigned int flush_interval_ms;
+    /* Flush the file buffer right after LOGLEVEL_ERROR records */
+    bool flush_on_error;
+    /* LOGOUT_MMAP: size of the preallocated and mapped file window (0 - default) */
+    size_t mmap_chunk_size;
+    /* LOGOUT_FILE: keep the records of an existing log file instead of truncating it */
+    bool file_append;
+    /* LOGOUT_FILE: write with O_DIRECT from aligned buffers, past the page cache */
+    bool file_direct;
+    /* LOGOUT_FILE: every file buffer becomes an independent frame, compressed and written
+     * by a worker thread. The buffer defaults to 1 MiB, a crash loses the open one at most */
+    logman_compress file_compress;
+    /* LOGOUT_FILE: sparse index <file_name>.idx for logman-query, an entry per second of
+     * records or per index_block_size bytes (0 - 64 KiB). Not with rotation or compression */
+    bool file_index;
+    size_t index_block_size;
+    /* LOGOUT_SOCKET: datagrams sent per sendmmsg() call (0 - default). A partial batch goes
+     * out every flush_interval_ms (0 - 100 ms), on log_flush() and with flush_on_error.
+     * A collector that went away is reconnected, records are dropped meanwhile */
+    size_t socket_batch;
+    logman_socket_policy socket_policy;
+    /* LOGOUT_SOCKET: RFC 5424 syslog header (facility user) before every record */
+    bool socket_syslog;
+    /* LOGOUT_FILE: move to a new file once the current one reaches this size (0 - never) */
+    size_t rotate_size;
+    /* LOGOUT_FILE: move to a new file once the current one is this old (0 - never) */
+    unsigned int rotate_interval_s;
+    /* Rotated files kept as <file_name>.1 (newest) ... <file_name>.N (0 - default) */
+    unsigned int rotate_keep;
+    /* Record format of the main output, LOGFORMAT_DEFAULT follows the type */
+    logman_format format;
+    /* Longer records are cut, at least 512 bytes (0 - default) */
+    size_t max_message_size;
+    /* Additional outputs, each record is formatted once for all of them */
+    const logman_sink_settings* sinks;
+    size_t sinks_count;
+    /* Fill the latency histogram of log_get_stats(), two clock reads per record */
+    bool stats_latency;
+    /* Flight recorder: last records of every thread kept unformatted, debug ones included,
+     * written out before a LOGLEVEL_ERROR record and by log_dump_recent() (0 - off) */
+    size_t recorder_size;
+    /* Flight recorder: also dump from SIGSEGV and SIGABRT handlers */
+    bool recorder_signals;
+    /* SIGUSR1 switches the default instance between LOGTYPE_DEBUG and LOGTYPE_PRODUCT */
+    bool reconfigure_signal;
+    /* Scope timers and spans shorter than this leave no record (0 - all) */
+    unsigned int timer_threshold_us;
+    /* Chrome trace event file (JSON array format, for chrome://tracing or Perfetto) with
+     * every timer and span of the default instance, the threshold does not apply to it.
+     * Created anew by log_init() and log_reconfigure() (NULL - none) */
+    const char* trace_file;
 } logman_settings;
 
+/* Logger instance with its own outputs, buffers and level, see logman_create().
+ * The log_* functions and macros use the default instance set up by log_init().
+ */
+typedef struct logman_src logman_t;
+
+/* Runtime threshold read by the log_* macros, set with log_set_level() */
+LOGMANAPI extern int __log_min_level;
+
 LOGMANAPI logman_error log_init_default(void);
 LOGMANAPI logman_error log_init(logman_settings* settings);
 LOGMANAPI void log_destruct(void);
+LOGMANAPI logman_error log_flush(void);
 LOGMANAPI char* log_get_internal_error(void);
+LOGMANAPI void log_set_level(logman_level level);
+/* Counters since the last log_init(), summed over the per-thread counters */
+LOGMANAPI void log_get_stats(logman_stats* stats);
+/* Write the flight recorder records not dumped yet to the main output */
+LOGMANAPI void log_dump_recent(void);
+/* Replace the settings of the default instance while other threads keep logging.
+ * Files are reopened in append mode, LOGOUT_BINARY and LOGOUT_MMAP cannot be switched
+ * to or from. The flight recorder keeps its size and signal handlers.
+ */
+LOGMANAPI logman_error log_reconfigure(logman_settings* settings);
+
+/* Instances independent of the default one and of each other. The flight recorder
+ * stays with the default instance, the log_get_stats() counters cover all of them.
+ * Returns NULL if the instance could not be set up.
+ */
+LOGMANAPI logman_t* logman_create(logman_settings* settings);
+LOGMANAPI void logman_destroy(logman_t* handle);
+LOGMANAPI logman_error logman_flush(logman_t* handle);
+LOGMANAPI char* logman_get_internal_error(logman_t* handle);
+LOGMANAPI void logman_set_level(logman_t* handle, logman_level level);
 
 LOGMANAPI void __log_log(logman_level level, const char* file, const char* func, const int line, const char* mes, ...);
+LOGMANAPI void __log_log_kv(logman_level level, const char* file, const char* func, const int line, const char* mes,
+    const logman_kv* kv, size_t kv_count);
+LOGMANAPI void __log_log_site(logman_site* site, const char* mes, ...);
+LOGMANAPI void __log_log_site_kv(logman_site* site, const char* mes, const logman_kv* kv, size_t kv_count);
+LOGMANAPI void __log_log_limited(logman_site* site, size_t suppressed, const char* mes, ...);
+LOGMANAPI void __logman_log_site(logman_t* handle, logman_site* site, const char* mes, ...);
+LOGMANAPI void __logman_log_site_kv(logman_t* handle, logman_site* site, const char* mes, const logman_kv* kv,
+    size_t kv_count);
+LOGMANAPI bool __log_limit_interval(logman_limit* limit, unsigned long long interval_ns);
+LOGMANAPI bool __log_limit_bucket(logman_limit* limit, double per_sec, size_t burst);
+
+/* Timed scopes and spans. The cycle counter is read inline at both ends, the end goes
+ * into the library: a LOGLEVEL_INFO record "<name> duration_ns=N" with the site of the
+ * timer once the duration reaches timer_threshold_us, and a Chrome trace event with
+ * trace_file set.
+ *     log_scope_timer("parse");                ends with the enclosing block
+ *     log_span_begin(load, "load"); ... log_span_end(load);
+ * The scope timer relies on the cleanup attribute of GCC and Clang, C++ code can use
+ * logman::scope_timer instead. Timers started below the level threshold do nothing.
+ */
+typedef struct {
+    logman_site* site;
+    const char* name;
+    unsigned long long start;
+} logman_timer;
+
+/* Set at load: the TSC (the generic timer on aarch64) is invariant and read directly */
+LOGMANAPI extern bool __log_clock_tsc;
+LOGMANAPI unsigned long long __log_clock_fallback(void);
+LOGMANAPI void __log_timer_end(logman_timer* timer, unsigned long long end);
+LOGMANAPI void __log_site_add(const logman_site* site);
+LOGMANAPI size_t __log_sites_added(const logman_site** sites, size_t max);
+
+static inline unsigned long long __log_clock_read(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_expect(__log_clock_tsc, 1)) {
+        return __builtin_ia32_rdtsc();
+    }
+#elif defined(__aarch64__)
+    if (__builtin_expect(__log_clock_tsc, 1)) {
+        unsigned long long cnt;
+        __asm__ volatile("isb; mrs %0, cntvct_el0" : "=r"(cnt));
+        return cnt;
+    }
+#endif
+    return __log_clock_fallback();
+}
+
+static inline logman_timer __log_timer_start(logman_site* site, const char* name)
+{
+    logman_timer timer = { NULL, name, 0 };
+    if (__log_enabled(LOGLEVEL_INFO)) {
+        timer.site = site;
+        timer.start = __log_clock_read();
+    }
+    return timer;
+}
+
+static inline void __log_timer_stop(logman_timer* timer)
+{
+    if (timer->site != NULL) {
+        __log_timer_end(timer, __log_clock_read());
+        timer->site = NULL;
+    }
+}
+
+#define __log_cat_(a, b) a##b
+#define __log_cat(a, b) __log_cat_(a, b)
+#define __log_timer_define(var, name) \
+    __log_site_define(__log_cat(var, _site), LOGLEVEL_INFO, false); \
+    logman_timer var = __log_timer_start(&__log_cat(var, _site), name)
+
+#define __log_scope_timer(var, name) \
+    __log_site_define(__log_cat(var, _site), LOGLEVEL_INFO, false); \
+    logman_timer var __attribute__((cleanup(__log_timer_stop))) = __log_timer_start(&__log_cat(var, _site), name)
+
+#define log_scope_timer(name)       __log_scope_timer(__log_cat(__log_timer_, __LINE__), name)
+#define log_span_begin(span, name)  __log_timer_define(span, name)
+#define log_span_end(span)          __log_timer_stop(&(span))
+
+#if defined(__ELF__)
+/* Bounds of the logman_sites section, provided by the linker of the module that uses them */
+extern logman_site __start_logman_sites[] __attribute__((weak, visibility("hidden")));
+extern logman_site __stop_logman_sites[] __attribute__((weak, visibility("hidden")));
+#endif
+
+/* Log statements of the C translation units linked into the calling executable or
+ * shared object, e.g. to list them at startup, followed by the C++ ones of every
+ * module that have logged so far. Fills up to max entries and returns the number of sites.
+ */
+static inline size_t log_sites(const logman_site** sites, size_t max)
+{
+    size_t count = 0;
+#if defined(__ELF__)
+    if (__start_logman_sites != NULL) {
+        for (const logman_site* site = __start_logman_sites; site < __stop_logman_sites; site++, count++) {
+            if (count < max) {
+                sites[count] = site;
+            }
+        }
+    }
+#endif
+    return count + __log_sites_added((count < max) ? &sites[count] : NULL, (count < max) ? max - count : 0);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef __cplusplus
+extern "C++" {
+// a function-local static, an inline function shares it across the translation units
+struct __log_site_registrar {
+    explicit __log_site_registrar(const logman_site* site) { __log_site_add(site); }
+};
+}
+#endif
@@ -0,0 +1,505 @@
+#pragma once
+
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+#include "logman.h"
+
+/* Header-only C++17 front end over the C core:
+ *
+ *     logman::info("{} took {}us", name, us);
+ *     LOGMAN_INFO("{} took {}us", name, us);
+ *
+ * "{}" takes the next argument, "{{" and "}}" are literal braces. A format that does not
+ * match its arguments does not compile with C++20, or with the LOGMAN_* macros and
+ * LOGMAN_FMT in C++17, which also split it into literal parts and argument slots at
+ * compile time. Arguments are rendered with std::to_chars into a per-thread buffer, other
+ * types are made printable by specializing logman::formatter<T>. The macros also skip
+ * evaluating the arguments of a filtered record.
+ */
+
+#ifndef LOGMAN_CPP_BUFFER_SIZE
+ #define LOGMAN_CPP_BUFFER_SIZE 4096
+#endif
+
+#ifndef LOGMAN_CPP_MAX_PIECES
+ #define LOGMAN_CPP_MAX_PIECES 32
+#endif
+
+namespace logman {
+
+/* Per-thread output of the front end, appends past the end are cut */
+class buffer {
+public:
+    constexpr buffer() = default;
+    buffer(const buffer&) = delete;
+    buffer& operator=(const buffer&) = delete;
+
+    void append(const char* s, size_t len)
+    {
+        size_t room = capacity() - len_;
+        if (len > room) {
+            len = room;
+        }
+        std::memcpy(&data_[len_], s, len);
+        len_ += len;
+    }
+
+    void append(std::string_view s) { append(s.data(), s.size()); }
+
+    void push_back(char c)
+    {
+        if (len_ < capacity()) {
+            data_[len_++] = c;
+        }
+    }
+
+    // free space for direct writes, finished with commit()
+    char* begin_write() { return &data_[len_]; }
+    char* end_write() { return &data_[capacity()]; }
+    void commit(char* end) { len_ = static_cast<size_t>(end - data_); }
+
+    void clear() { len_ = 0; }
+    size_t size() const { return len_; }
+
+    const char* c_str()
+    {
+        data_[len_] = '\0';
+        return data_;
+    }
+
+private:
+    static constexpr size_t capacity() { return LOGMAN_CPP_BUFFER_SIZE - 1; }
+
+    char data_[LOGMAN_CPP_BUFFER_SIZE] = {};
+    size_t len_ = 0;
+};
+
+/* Customization point: specialize with a static void format(buffer&, const T&) */
+template <typename T, typename Enable = void>
+struct formatter;
+
+template <typename T>
+struct formatter<T, std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool> && !std::is_same_v<T, char>>> {
+    static void format(buffer& out, T value)
+    {
+        auto res = std::to_chars(out.begin_write(), out.end_write(), value);
+        if (res.ec == std::errc()) {
+            out.commit(res.ptr);
+        }
+    }
+};
+
+template <typename T>
+struct formatter<T, std::enable_if_t<std::is_floating_point_v<T>>> {
+    static void format(buffer& out, T value)
+    {
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+        auto res = std::to_chars(out.begin_write(), out.end_write(), value);
+        if (res.ec == std::errc()) {
+            out.commit(res.ptr);
+        }
+#else
+        char tmp[32];
+        int len = std::snprintf(tmp, sizeof(tmp), "%g", static_cast<double>(value));
+        out.append(tmp, static_cast<size_t>(len));
+#endif
+    }
+};
+
+template <>
+struct formatter<bool> {
+    static void format(buffer& out, bool value) { out.append(value ? std::string_view("true") : "false"); }
+};
+
+template <>
+struct formatter<char> {
+    static void format(buffer& out, char value) { out.push_back(value); }
+};
+
+template <>
+struct formatter<const char*> {
+    static void format(buffer& out, const char* value) { out.append(value != nullptr ? value : "(null)"); }
+};
+
+template <>
+struct formatter<char*> : formatter<const char*> {};
+
+template <>
+struct formatter<std::string_view> {
+    static void format(buffer& out, std::string_view value) { out.append(value); }
+};
+
+template <>
+struct formatter<std::string> {
+    static void format(buffer& out, const std::string& value) { out.append(value); }
+};
+
+template <>
+struct formatter<std::nullptr_t> {
+    static void format(buffer& out, std::nullptr_t) { out.append("nullptr"); }
+};
+
+template <typename T>
+struct formatter<T*, std::enable_if_t<!std::is_same_v<std::remove_cv_t<T>, char>>> {
+    static void format(buffer& out, const T* value)
+    {
+        out.append("0x");
+        auto res = std::to_chars(out.begin_write(), out.end_write(), reinterpret_cast<uintptr_t>(value), 16);
+        if (res.ec == std::errc()) {
+            out.commit(res.ptr);
+        }
+    }
+};
+
+template <typename T>
+struct formatter<T, std::enable_if_t<std::is_enum_v<T>>> {
+    static void format(buffer& out, T value)
+    {
+        formatter<std::underlying_type_t<T>>::format(out, static_cast<std::underlying_type_t<T>>(value));
+    }
+};
+
+namespace detail {
+
+template <typename T>
+struct identity {
+    using type = T;
+};
+
+struct piece {
+    size_t offset;
+    size_t len;
+    bool arg;
+};
+
+/* Format string split into literal parts and argument slots */
+struct parsed_format {
+    piece pieces[LOGMAN_CPP_MAX_PIECES] = {};
+    size_t count = 0;
+    size_t args = 0;
+    bool valid = true;
+
+    constexpr void add(size_t offset, size_t len, bool arg)
+    {
+        if (len == 0 && !arg) {
+            return;
+        }
+        if (count == LOGMAN_CPP_MAX_PIECES) {
+            valid = false;
+            return;
+        }
+        pieces[count++] = piece{ offset, len, arg };
+        args += arg ? 1 : 0;
+    }
+};
+
+constexpr parsed_format parse(std::string_view fmt)
+{
+    parsed_format parsed;
+    size_t start = 0;
+    for (size_t i = 0; i < fmt.size() && parsed.valid; i++) {
+        char next = (i + 1 < fmt.size()) ? fmt[i + 1] : '\0';
+        if (fmt[i] == '{' && next == '}') {
+            parsed.add(start, i - start, false);
+            parsed.add(0, 0, true);
+        } else if ((fmt[i] == '{' && next == '{') || (fmt[i] == '}' && next == '}')) {
+            // keep one of the two braces
+            parsed.add(start, i + 1 - start, false);
+        } else if (fmt[i] == '{' || fmt[i] == '}') {
+            parsed.valid = false;
+            break;
+        } else {
+            continue;
+        }
+        start = ++i + 1;
+    }
+    parsed.add(start, fmt.size() - start, false);
+    return parsed;
+}
+
+/* Number of "{}" in fmt, -1 for an unpaired brace. It bounds nothing, unlike parse() */
+constexpr long count_args(std::string_view fmt)
+{
+    long args = 0;
+    for (size_t i = 0; i < fmt.size(); i++) {
+        if (fmt[i] != '{' && fmt[i] != '}') {
+            continue;
+        }
+        char next = (i + 1 < fmt.size()) ? fmt[i + 1] : '\0';
+        if (fmt[i] == '{' && next == '}') {
+            args++;
+        } else if (fmt[i] != next) {
+            return -1;
+        }
+        i++;
+    }
+    return args;
+}
+
+/* Base of the types made by LOGMAN_FMT, their value() is the format literal */
+struct compile_string {};
+
+template <typename S>
+inline constexpr parsed_format parsed_v = parse(S::value());
+
+constexpr const char* basename(const char* path)
+{
+    const char* name = path;
+    for (const char* p = path; *p != '\0'; p++) {
+        if (*p == '/') {
+            name = p + 1;
+        }
+    }
+    return name;
+}
+
+// reached only in constant evaluation, where calling it fails the build
+inline void format_error(const char*) {}
+
+/* Argument reference with its formatter, no copy and no allocation */
+struct arg {
+    const void* value;
+    void (*format)(buffer& out, const void* value);
+
+    template <typename T>
+    static void format_as(buffer& out, const void* value)
+    {
+        formatter<T>::format(out, *static_cast<const T*>(value));
+    }
+
+    template <typename T>
+    static void format_array(buffer& out, const void* value)
+    {
+        formatter<const T*>::format(out, static_cast<const T*>(value));
+    }
+};
+
+template <typename T>
+arg make_arg(const T& value)
+{
+    return arg{ &value, &arg::format_as<T> };
+}
+
+// string literals and other arrays are formatted as a pointer to their first element
+template <typename T, size_t N>
+arg make_arg(const T (&value)[N])
+{
+    return arg{ value, &arg::format_array<T> };
+}
+
+} // namespace detail
+
+/* Format string not known at compile time, see runtime() */
+struct runtime_format {
+    std::string_view str;
+};
+
+/* Skips the compile time check, a format that does not match the arguments is logged as is */
+inline runtime_format runtime(std::string_view str)
+{
+    return runtime_format{ str };
+}
+
+/* Format string bound to the argument types, it carries the call site as well.
+ * Formats from LOGMAN_FMT come with their pieces parsed at compile time, the
+ * others are walked while the record is formatted.
+ */
+template <typename... Args>
+class basic_format_string {
+public:
+    template <typename S, std::enable_if_t<std::is_base_of_v<detail::compile_string, S>, int> = 0>
+    constexpr basic_format_string(S, const char* file = __builtin_FILE(), const char* func = __builtin_FUNCTION(),
+        int line = __builtin_LINE())
+        : str_(S::value()), parsed_(&detail::parsed_v<S>), checked_(true), file_(file), func_(func), line_(line)
+    {
+        static_assert(detail::parsed_v<S>.valid, "logman: malformed format string");
+        static_assert(detail::parsed_v<S>.args == sizeof...(Args), "logman: format string does not match the arguments");
+    }
+
+#if defined(__cpp_consteval)
+    template <size_t N>
+    consteval basic_format_string(const char (&str)[N], const char* file = __builtin_FILE(),
+        const char* func = __builtin_FUNCTION(), int line = __builtin_LINE())
+        : str_(str, N - 1), parsed_(nullptr), checked_(true), file_(file), func_(func), line_(line)
+    {
+        if (detail::count_args(str_) != static_cast<long>(sizeof...(Args))) {
+            detail::format_error("logman: format string does not match the arguments");
+        }
+    }
+#else
+    constexpr basic_format_string(const char* str, const char* file = __builtin_FILE(),
+        const char* func = __builtin_FUNCTION(), int line = __builtin_LINE())
+        : str_(str), parsed_(nullptr), checked_(false), file_(file), func_(func), line_(line)
+    {
+    }
+#endif
+
+    constexpr basic_format_string(runtime_format fmt, const char* file = __builtin_FILE(),
+        const char* func = __builtin_FUNCTION(), int line = __builtin_LINE())
+        : str_(fmt.str), parsed_(nullptr), checked_(false), file_(file), func_(func), line_(line)
+    {
+    }
+
+    constexpr std::string_view str() const { return str_; }
+    constexpr const detail::parsed_format* parsed() const { return parsed_; }
+    constexpr bool checked() const { return checked_; }
+    constexpr const char* file() const { return detail::basename(file_); }
+    constexpr const char* func() const { return func_; }
+    constexpr int line() const { return line_; }
+
+private:
+    std::string_view str_;
+    const detail::parsed_format* parsed_;
+    bool checked_;
+    const char* file_;
+    const char* func_;
+    int line_;
+};
+
+template <typename... Args>
+using format_string = basic_format_string<typename detail::identity<Args>::type...>;
+
+namespace detail {
+
+inline void format_parsed(buffer& out, std::string_view str, const parsed_format& parsed, const arg* args)
+{
+    for (size_t i = 0; i < parsed.count; i++) {
+        const piece& p = parsed.pieces[i];
+        if (p.arg) {
+            args->format(out, args->value);
+            args++;
+        } else {
+            out.append(&str[p.offset], p.len);
+        }
+    }
+}
+
+inline void format_walk(buffer& out, std::string_view str, const arg* args)
+{
+    size_t start = 0;
+    for (size_t i = 0; i < str.size(); i++) {
+        if (str[i] != '{' && str[i] != '}') {
+            continue;
+        }
+        // the format is checked, a brace is always followed by its pair
+        out.append(&str[start], (str[i + 1] == '}' && str[i] == '}') ? i + 1 - start : i - start);
+        if (str[i] == '{' && str[i + 1] == '}') {
+            args->format(out, args->value);
+            args++;
+        } else if (str[i] == '{') {
+            out.push_back('{');
+        }
+        start = ++i + 1;
+    }
+    out.append(&str[start], str.size() - start);
+}
+
+template <typename... Args>
+void log(logman_level level, const basic_format_string<Args...>& fmt, const Args&... args)
+{
+    static thread_local buffer out;
+    out.clear();
+
+    const arg args_list[sizeof...(Args) + 1] = { make_arg(args)..., arg{ nullptr, nullptr } };
+    std::string_view str = fmt.str();
+    if (fmt.parsed() != nullptr) {
+        format_parsed(out, str, *fmt.parsed(), args_list);
+    } else if (fmt.checked() || count_args(str) == static_cast<long>(sizeof...(Args))) {
+        format_walk(out, str, args_list);
+    } else {
+        // a runtime format that does not match, the text still reaches the log
+        out.append(str);
+    }
+    __log_log_kv(level, fmt.file(), fmt.func(), fmt.line(), out.c_str(), nullptr, 0);
+}
+
+} // namespace detail
+
+template <typename... Args>
+inline void debug(format_string<Args...> fmt, const Args&... args)
+{
+    if (__log_enabled(LOGLEVEL_DEBUG)) {
+        detail::log<Args...>(LOGLEVEL_DEBUG, fmt, args...);
+    }
+}
+
+template <typename... Args>
+inline void info(format_string<Args...> fmt, const Args&... args)
+{
+    if (__log_enabled(LOGLEVEL_INFO)) {
+        detail::log<Args...>(LOGLEVEL_INFO, fmt, args...);
+    }
+}
+
+template <typename... Args>
+inline void warning(format_string<Args...> fmt, const Args&... args)
+{
+    if (__log_enabled(LOGLEVEL_WARNING)) {
+        detail::log<Args...>(LOGLEVEL_WARNING, fmt, args...);
+    }
+}
+
+template <typename... Args>
+inline void error(format_string<Args...> fmt, const Args&... args)
+{
+    if (__log_enabled(LOGLEVEL_ERROR)) {
+        detail::log<Args...>(LOGLEVEL_ERROR, fmt, args...);
+    }
+}
+
+/* Times the enclosing scope like log_scope_timer(), the site is the line that declares it:
+ *     logman::scope_timer timer("parse");
+ */
+class scope_timer {
+public:
+    explicit scope_timer(const char* name, const char* file = __builtin_FILE(), const char* func = __builtin_FUNCTION(),
+        int line = __builtin_LINE())
+        : site_{ detail::basename(file), func, line, LOGLEVEL_INFO, false, 0, nullptr, false },
+          timer_(__log_timer_start(&site_, name))
+    {
+    }
+
+    scope_timer(const scope_timer&) = delete;
+    scope_timer& operator=(const scope_timer&) = delete;
+
+    ~scope_timer() { __log_timer_stop(&timer_); }
+
+    // ends the timer before the scope does, the destructor does nothing then
+    void stop() { __log_timer_stop(&timer_); }
+
+private:
+    logman_site site_;
+    logman_timer timer_;
+};
+
+} // namespace logman
+
+/* Format literal checked and split at compile time with C++17 as well */
+#define LOGMAN_FMT(s) \
+    [] { \
+        struct __logman_fmt : ::logman::detail::compile_string { \
+            static constexpr std::string_view value() { return s; } \
+        }; \
+        return __logman_fmt{}; \
+    }()
+
+#define __logman_filtered(level, func, fmt, ...) \
+    do { \
+        if (__log_enabled(level)) { \
+            ::logman::func(LOGMAN_FMT(fmt), ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+#define LOGMAN_DEBUG(fmt, ...)      __logman_filtered(LOGLEVEL_DEBUG,   debug,   fmt, ##__VA_ARGS__)
+#define LOGMAN_INFO(fmt, ...)       __logman_filtered(LOGLEVEL_INFO,    info,    fmt, ##__VA_ARGS__)
+#define LOGMAN_WARNING(fmt, ...)    __logman_filtered(LOGLEVEL_WARNING, warning, fmt, ##__VA_ARGS__)
+#define LOGMAN_ERROR(fmt, ...)      __logman_filtered(LOGLEVEL_ERROR,   error,   fmt, ##__VA_ARGS__)
+
+#define LOGMAN_SCOPE_TIMER(name)    ::logman::scope_timer __log_cat(__logman_timer_, __LINE__)(name)
@@ -1,9 +1,14 @@
+#include <fcntl.h>
+#include <semaphore.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <time.h>
+#include <unistd.h>
 
 #include "logman_int.h"
 
@@ -14,239 +19,1778 @@ const char* level_tag[LOGLEVEL_COUNT] = {
     "ERROR",
 };
 
+// level_tag with the separators of the text formats around it
+static const char* level_field[LOGLEVEL_COUNT] = {
+    "::DEBUG::",
+    "::INFO::",
+    "::WARNING::",
+    "::ERROR::",
+};
+static const size_t level_field_len[LOGLEVEL_COUNT] = { 9, 8, 11, 9 };
+
+// the default instance, the one behind the log_* functions and macros
 log_static logman_src log_obj;
+// the instance behind the log_* functions, log_obj until log_reconfigure() replaces it
+static logman_src* log_active = &log_obj;
+static pthread_mutex_t log_reconfigure_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// what the default instance was set up with, the SIGUSR1 switch starts from it
+static logman_settings log_settings;
+static logman_sink_settings log_settings_sinks[SINKS_MAX];
+// file names of the main output, the sinks and the trace file
+static char* log_settings_names[SINKS_MAX + 2];
+static bool log_settings_kept;
+
+static pthread_t log_control_thread;
+static sem_t log_control_sem;
+static bool log_control_running;
+static bool log_control_quit;
+static struct sigaction log_control_old;
+
+int __log_min_level = LOGLEVEL_DEBUG;
+
+// instances of logman_create(), flushed at exit along with the default one
+static logman_src* log_instances;
+static pthread_mutex_t log_instances_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// C++ call sites, each one is added when it first logs
+static const logman_site** log_sites_list;
+static size_t log_sites_count;
+static size_t log_sites_cap;
+static pthread_mutex_t log_sites_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_key_t log_tls_key;
+static pthread_once_t log_tls_once = PTHREAD_ONCE_INIT;
+static __thread logman_tls* log_tls;
+static pthread_once_t log_atexit_once = PTHREAD_ONCE_INIT;
 
 log_static void log_error_callback_default(void) {}
 
-log_static void log_write_int_err(const char* message, ...)
+log_static void log_write_int_err(logman_src* obj, const char* message, ...)
 {
-    if (log_obj.err_message == NULL) {
+    if (obj->err_message == NULL) {
         return;
     }
 
     va_list va;
     va_start(va, message);
-    vsnprintf(log_obj.err_message, INTERR_BUF_SIZE, message, va);
+    vsnprintf(obj->err_message, INTERR_BUF_SIZE, message, va);
     va_end(va);
     
-    if (log_obj.error_callback != NULL) {
-        log_obj.error_callback();
+    if (obj->error_callback != NULL) {
+        obj->error_callback();
     }
 }
 
+// a record was cut or dropped for its size
+static void log_write_overflow(logman_src* obj)
+{
+    log_stat_add(&log_stats()->truncated, 1);
+    log_write_int_err(obj, "LOGMAN_ERROR::Message buffer overflow\n");
+}
+
+// readers call it inside log_rcu_enter() and log_rcu_exit() only
+static inline logman_src* log_current(void)
+{
+    return __atomic_load_n(&log_active, __ATOMIC_ACQUIRE);
+}
+
 char* log_get_internal_error(void)
 {
-    return log_obj.err_message;
+    // the message buffer moves to the new instance on log_reconfigure()
+    return log_current()->err_message;
 }
 
-log_static logman_error log_buffers_init(void)
+char* logman_get_internal_error(logman_t* handle)
 {
-    log_obj.err_message = (char*)calloc(INTERR_BUF_SIZE, sizeof(char));
-    if (log_obj.err_message == NULL) {
-        return LOGERR_LOGBUFFINIT;
+    return handle->err_message;
+}
+
+static void log_level_apply(logman_src* obj, logman_level level)
+{
+    obj->out_level = level;
+    // the flight recorder keeps the records below the output level as well
+    int min_level = (obj->recorder_size != 0) ? LOGLEVEL_DEBUG : (int)level;
+    __atomic_store_n(&obj->min_level, min_level, __ATOMIC_RELAXED);
+    if (obj == __atomic_load_n(&log_active, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&__log_min_level, min_level, __ATOMIC_RELAXED);
     }
+}
 
-    log_obj.date_buf = (char*)calloc(DATE_BUF_SIZE, sizeof(char));
-    if (log_obj.date_buf == NULL) {
-        log_write_int_err("LOGMAN_ERROR::Unable to initialize the internal buffer: date_buf, %ldB\n",
-                DATE_BUF_SIZE);
-        return LOGERR_LOGBUFFINIT;
+void log_set_level(logman_level level)
+{
+    log_rcu_enter();
+    log_level_apply(log_current(), level);
+    log_rcu_exit();
+}
+
+void logman_set_level(logman_t* handle, logman_level level)
+{
+    log_level_apply(handle, level);
+}
+
+static void log_tls_free(void* tls)
+{
+    free(((logman_tls*)tls)->spill);
+    free(((logman_tls*)tls)->enc);
+    free(tls);
+    log_tls = NULL;
+}
+
+static void log_tls_key_create(void)
+{
+    pthread_key_create(&log_tls_key, log_tls_free);
+}
+
+log_static logman_tls* log_tls_get(void)
+{
+    if (__builtin_expect(log_tls != NULL, 1)) {
+        return log_tls;
+    }
+
+    pthread_once(&log_tls_once, log_tls_key_create);
+    logman_tls* tls = (logman_tls*)calloc(1, sizeof(logman_tls));
+    if (tls == NULL) {
+        return NULL;
+    }
+    // the key destructor frees the buffers on thread exit
+    pthread_setspecific(log_tls_key, tls);
+    log_tls = tls;
+    return tls;
+}
+
+log_static void log_tls_destruct(void)
+{
+    if (log_tls == NULL) {
+        return;
     }
- 
-    log_obj.message_buf = (char*)calloc(MESSAGE_BUF_SIZE, sizeof(char));
-    if (log_obj.message_buf == NULL) {
-        log_write_int_err("LOGMAN_ERROR::Unable to initialize the internal buffer: message_buf, %ldB\n",
-                MESSAGE_BUF_SIZE);
+    pthread_setspecific(log_tls_key, NULL);
+    log_tls_free(log_tls);
+}
+
+log_static logman_error log_buffers_init(logman_src* obj)
+{
+    obj->err_message = (char*)calloc(INTERR_BUF_SIZE, sizeof(char));
+    if (obj->err_message == NULL) {
         return LOGERR_LOGBUFFINIT;
     }
-    
+
     return LOGERR_NOERR;
 }
 
-log_static void log_date_update(void)
+log_static void log_date_update(logman_src* obj, logman_tls* tls)
 {
-    if (log_obj.date_buf == NULL) {
-        log_write_int_err("LOGMAN_ERROR::Date buffer uninitialized\n");
+    if (tls == NULL) {
+        log_write_int_err(obj, "LOGMAN_ERROR::Date buffer uninitialized\n");
         return;
     }
     
-    time_t t = time(NULL);
-    struct tm tm = *localtime(&t);
-    size_t len = snprintf(log_obj.date_buf, DATE_BUF_SIZE, "%.2i.%.2i.%i %.2i:%.2i:%.2i",
-                             tm.tm_mday, tm.tm_mon + 1, tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec);
-    if (len >= DATE_BUF_SIZE) {
-        log_write_int_err("LOGMAN_ERROR::Date buffer overflow\n");
+    struct timespec ts;
+    log_time_now(&ts, obj->time_precision, obj->time_tsc);
+    log_time_render(&tls->date_cache, tls->date_buf, &ts, obj->time_format, obj->time_precision);
+}
+
+// the written bytes of output 0 (main) or sink index + 1
+static void log_stats_written(size_t output, size_t len)
+{
+    logman_stats* stats = log_stats();
+    log_stat_add((output == 0) ? &stats->bytes : &stats->sink_bytes[output - 1], len);
+}
+
+log_static void log_write_std(logman_src* obj, const char *buf, size_t len, logman_level level) {
+    (void)level;
+    if (!log_fd_write(obj->out_fd, buf, len)) {
+        log_write_int_err(obj, "LOGMAN_ERROR::Unable to write to the stream\n");
         return;
     }
+    log_stats_written(0, len);
 }
 
-log_static void log_write_std(char *buf) {
-    size_t len = strlen(buf);
-    if (fprintf(log_obj.out_stream, "%s", buf) != len) {
-        log_write_int_err("LOGMAN_ERROR::Unable to write to the stream\n");
+log_static void log_write_file(logman_src* obj, const char *buf, size_t len, logman_level level) {
+    if (!log_filebuf_write(&obj->filebuf, buf, len, level)) {
+        log_write_int_err(obj, "LOGMAN_ERROR::Unable to write to log file\n");
         return;
     }
+    log_stats_written(0, len);
 }
 
-log_static void log_write_file(char *buf) {
-    // TODO: fflush?
-    size_t len = strlen(buf);
-    if (len != fwrite(buf, sizeof(char), len, log_obj.out_stream)) {
-        log_write_int_err("LOGMAN_ERROR::Unable to write to log file\n");
-        return;
+static void log_flush_at_exit(void)
+{
+    if (log_current()->writer != NULL) {
+        log_flush();
     }
+    pthread_mutex_lock(&log_instances_lock);
+    for (logman_src* obj = log_instances; obj != NULL; obj = obj->next) {
+        logman_flush(obj);
+    }
+    pthread_mutex_unlock(&log_instances_lock);
+}
+
+static void log_atexit_register(void)
+{
+    // stdio flushed the file at exit before the logger kept its own buffer
+    atexit(log_flush_at_exit);
 }
 
-log_static logman_error log_set_out_file(const char* file_name)
+// opens the file of the main output or of a sink, file_append keeps its records
+log_static logman_error log_open_filebuf(logman_src* obj, logman_filebuf* fb, const char* file_name)
 {
-    FILE* f = fopen(file_name, "w");
-    if (f == NULL) {
-        log_write_int_err("LOGMAN_ERROR::Unable to create/open log file\n");
+    // every write lands at the end of the file, other writers of it included
+    int flags = (obj->file_direct ? O_RDWR : O_WRONLY) | O_CREAT | O_APPEND | O_CLOEXEC |
+        (obj->file_append ? 0 : O_TRUNC);
+    int fd = open(file_name, flags, 0644);
+    if (fd < 0) {
+        log_write_int_err(obj, "LOGMAN_ERROR::Unable to create/open log file\n");
         return LOGERR_LOGFILECREATE;
     }
-    
-    log_obj.out_stream = f;
-    log_obj.writer = log_write_file;
+
+    logman_error err = log_filebuf_init(fb, fd, obj->file_buffer_size, obj->flush_interval_ms, obj->flush_on_error);
+    if (err != LOGERR_NOERR) {
+        log_write_int_err(obj, "LOGMAN_ERROR::Unable to initialize the file buffer\n");
+        close(fd);
+        return err;
+    }
+    if (obj->file_direct) {
+        err = log_filebuf_direct(fb, obj->file_append);
+        if (err != LOGERR_NOERR) {
+            log_write_int_err(obj, "LOGMAN_ERROR::Unable to open the log file for direct I/O\n");
+            log_filebuf_destruct(fb);
+            return err;
+        }
+    }
     return LOGERR_NOERR;
 }
 
-log_static logman_error log_form_message_core(size_t start, const char* message, va_list va)
+log_static logman_error log_set_out_file(logman_src* obj, const char* file_name)
 {
-    size_t max_len = MESSAGE_BUF_SIZE - start;
-    size_t mes_len = vsnprintf(&log_obj.message_buf[start], max_len, message, va);
-    log_obj.message_buf[start + mes_len] = '\n';
-    log_obj.message_buf[start + mes_len + 1] = '\0';
-    if (mes_len >= max_len) {
-        return LOGERR_LOGBUFOVERFLOW;
+    if (obj->file_compress != LOGCOMPRESS_NONE && (obj->file_direct || !log_compress_available(obj->file_compress))) {
+        log_write_int_err(obj, "LOGMAN_ERROR::Compression is not available or combined with direct I/O\n");
+        return LOGERR_LOGCOMPRESS;
     }
+    // index offsets are those of one plain file
+    if (obj->file_index && (obj->file_compress != LOGCOMPRESS_NONE || obj->rotate_size != 0 ||
+        obj->rotate_interval_s != 0)) {
+        log_write_int_err(obj, "LOGMAN_ERROR::The file index does not work with compression or rotation\n");
+        return LOGERR_LOGINDEX;
+    }
+    logman_error err = log_open_filebuf(obj, &obj->filebuf, file_name);
+    if (err != LOGERR_NOERR) {
+        return err;
+    }
+    if (obj->file_index) {
+        obj->filebuf.index = log_index_open(file_name, obj->filebuf.fd, obj->file_append, obj->index_block_size);
+        if (obj->filebuf.index == NULL) {
+            log_write_int_err(obj, "LOGMAN_ERROR::Unable to create/open the log file index\n");
+            log_filebuf_destruct(&obj->filebuf);
+            return LOGERR_LOGINDEX;
+        }
+    }
+    if (obj->file_compress != LOGCOMPRESS_NONE) {
+        size_t block = (obj->file_buffer_size == 0) ? COMPRESS_BLOCK_DEFAULT : obj->file_buffer_size;
+        err = log_filebuf_compress(&obj->filebuf, obj->file_compress, block);
+        if (err != LOGERR_NOERR) {
+            log_write_int_err(obj, "LOGMAN_ERROR::Unable to start the log compression\n");
+            log_filebuf_destruct(&obj->filebuf);
+            return err;
+        }
+    }
+
+    if (obj->rotate_size != 0 || obj->rotate_interval_s != 0) {
+        err = log_filebuf_rotate(&obj->filebuf, file_name, obj->rotate_size, obj->rotate_interval_s,
+            obj->rotate_keep);
+        if (err != LOGERR_NOERR) {
+            log_write_int_err(obj, "LOGMAN_ERROR::Unable to start the log rotation\n");
+            log_filebuf_destruct(&obj->filebuf);
+            return err;
+        }
+    }
+
+    pthread_once(&log_atexit_once, log_atexit_register);
+    obj->writer = log_write_file;
     return LOGERR_NOERR;
 }
 
-log_static void log_form_debug_message(logman_level level, const char* file, const char* func, const int line, 
-    const char* message, va_list va)
-{
-    log_date_update();
-    size_t len = snprintf(log_obj.message_buf, MESSAGE_BUF_SIZE, "%s::%s::%s::%s::%i::",
-                             log_obj.date_buf, level_tag[level], file, func, line);
-    if (len >= MESSAGE_BUF_SIZE) {
-        goto err;
-    }                             
-
-    if (log_form_message_core(len, message, va) == LOGERR_NOERR) {
+log_static void log_write_mmap(logman_src* obj, const char *buf, size_t len, logman_level level) {
+    (void)level;
+    if (!log_mmap_write(&obj->mmap, buf, len)) {
+        log_stat_add(&log_stats()->write_errors, 1);
+        log_write_int_err(obj, "LOGMAN_ERROR::Unable to write to log file\n");
         return;
     }
-
-    err:
-    log_write_int_err("LOGMAN_ERROR::Message buffer overflow\n");
+    log_stats_written(0, len);
 }
 
-log_static void log_form_product_message(logman_level level, const char* file, const char* func, const int line, 
-    const char* message, va_list va)
+log_static logman_error log_set_out_mmap(logman_src* obj, const char* file_name)
 {
-    if (level <= LOGLEVEL_DEBUG) {
-        return;
+    logman_error err = log_mmap_init(&obj->mmap, file_name, obj->mmap_chunk_size);
+    if (err != LOGERR_NOERR) {
+        log_write_int_err(obj, "LOGMAN_ERROR::Unable to create/map log file\n");
+        return err;
     }
 
-    log_date_update();
-    size_t len = snprintf(log_obj.message_buf, MESSAGE_BUF_SIZE, "%s::%s::", log_obj.date_buf, level_tag[level]);
-    if (len >= MESSAGE_BUF_SIZE) {
-        goto err;
-    }   
+    obj->writer = log_write_mmap;
+    return LOGERR_NOERR;
+}
 
-    if (log_form_message_core(len, message, va) == LOGERR_NOERR) {
+log_static void log_write_socket(logman_src* obj, const char *buf, size_t len, logman_level level) {
+    if (!log_socket_write(obj->socket, buf, len, level)) {
+        log_write_int_err(obj, "LOGMAN_ERROR::Unable to send to the log socket\n");
         return;
     }
-
-    err:
-    log_write_int_err("LOGMAN_ERROR::Message buffer overflow\n");
+    log_stats_written(0, len);
 }
 
-logman_error log_init_default(void)
+log_static logman_error log_set_out_socket(logman_src* obj, const char* address)
 {
-    log_obj.out_type = LOGOUT_STREAM;
-    log_obj.out_stream = stderr;
-    log_obj.writer = log_write_std;
-    log_obj.error_callback = log_error_callback_default;
-    log_obj.message_former = log_form_debug_message;
-    return log_buffers_init();
+    obj->socket = log_socket_open(address, obj->socket_batch, obj->socket_policy, obj->socket_syslog,
+        obj->flush_interval_ms, obj->flush_on_error);
+    if (obj->socket == NULL) {
+        log_write_int_err(obj, "LOGMAN_ERROR::Unable to set up the log socket\n");
+        return LOGERR_LOGSOCKET;
+    }
+
+    pthread_once(&log_atexit_once, log_atexit_register);
+    obj->writer = log_write_socket;
+    return LOGERR_NOERR;
 }
 
-logman_error log_init(logman_settings* settings)
+log_static logman_error log_set_trace(logman_src* obj, const char* file_name)
 {
-    if (settings == NULL) {
-        logman_error err = log_init_default();
-        if (err == LOGERR_NOERR) {
-            log_write_int_err("LOGMAN_WARNING::Empty settings, setting default\n");
-        }
-        return err;
+    int flags = O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC | (obj->trace_resume ? 0 : O_TRUNC);
+    int fd = open(file_name, flags, 0644);
+    if (fd < 0) {
+        log_write_int_err(obj, "LOGMAN_ERROR::Unable to create/open the trace file\n");
+        return LOGERR_LOGFILECREATE;
     }
-    
-    log_obj.error_callback = (settings->error_callback == NULL) ? log_error_callback_default : settings->error_callback;
-    logman_error err = log_buffers_init();
+    logman_error err = log_filebuf_init(&obj->trace, fd, 0, obj->flush_interval_ms, false);
     if (err != LOGERR_NOERR) {
+        log_write_int_err(obj, "LOGMAN_ERROR::Unable to initialize the file buffer\n");
+        close(fd);
         return err;
     }
+    if (!obj->trace_resume) {
+        obj->trace_base = log_clock_read();
+        log_filebuf_write(&obj->trace, "[\n", 2, LOGLEVEL_DEBUG);
+    }
+    pthread_once(&log_atexit_once, log_atexit_register);
+    return LOGERR_NOERR;
+}
 
-    switch (settings->type) {
-        case LOGTYPE_DEBUG:
-            log_obj.message_former = log_form_debug_message;
-            break;
-        case LOGTYPE_PRODUCT:
-            log_obj.message_former = log_form_product_message;
-            break;
-        default:
-            log_write_int_err("LOGMAN_ERROR::Unknown logman type\n");
-            return LOGERR_LOGUNKNOWNTYPE;
+// the events end with a comma, a metadata event closes the array
+static bool log_trace_close(logman_src* obj)
+{
+    if (obj->trace.data == NULL) {
+        return true;
     }
-    
+    if (obj->trace_handed_over) {
+        return log_filebuf_destruct(&obj->trace);
+    }
+    char buf[128];
+    int len = snprintf(buf, sizeof(buf), "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%ld,"
+        "\"args\":{\"name\":\"logman\"}}]\n", (long)getpid());
+    bool ok = log_filebuf_write(&obj->trace, buf, (size_t)len, LOGLEVEL_DEBUG);
+    return log_filebuf_destruct(&obj->trace) && ok;
+}
+
+log_static void log_sink_write(logman_src* obj, logman_sink* sink, const char *buf, size_t len, logman_level level)
+{
+    if (sink->out_type == LOGOUT_FILE) {
+        if (!log_filebuf_write(&sink->filebuf, buf, len, level)) {
+            log_write_int_err(obj, "LOGMAN_ERROR::Unable to write to log file\n");
+            return;
+        }
+    } else if (!log_fd_write(sink->out_fd, buf, len)) {
+        log_write_int_err(obj, "LOGMAN_ERROR::Unable to write to the stream\n");
+        return;
+    }
+    log_stats_written((size_t)(sink - obj->sinks) + 1, len);
+}
+
+// async route, target 0 is the main output
+static void log_write_sink_target(logman_src* obj, uint32_t target, const char *buf, size_t len, logman_level level)
+{
+    log_sink_write(obj, &obj->sinks[target - 1], buf, len, level);
+}
+
+static void log_sink_emit(logman_src* obj, size_t index, const char *buf, size_t len, logman_level level)
+{
+    if (!obj->async.running) {
+        log_sink_write(obj, &obj->sinks[index], buf, len, level);
+    } else if (!log_async_push_to(&obj->async, (uint32_t)index + 1, buf, len, level)) {
+        log_stat_add(&log_stats()->dropped, 1);
+        log_write_int_err(obj, "LOGMAN_ERROR::Async queue overflow, record dropped\n");
+    }
+}
+
+log_static logman_error log_sink_open(logman_src* obj, logman_sink* sink, const logman_sink_settings* settings)
+{
+    sink->min_level = settings->min_level;
+    sink->format = (settings->format == LOGFORMAT_DEFAULT || settings->format >= LOGFORMAT_COUNT) ?
+        obj->format : settings->format;
+
     switch (settings->out_type) {
         case LOGOUT_STREAM:
-            log_obj.out_stream = (settings->output.out_stream != stderr && settings->output.out_stream != stdout) ?
+            sink->out_stream = (settings->output.out_stream != stderr && settings->output.out_stream != stdout) ?
                 stderr : settings->output.out_stream;
-            log_obj.writer = log_write_std;
-            
+            sink->out_fd = log_stream_fd(sink->out_stream);
             break;
-        case LOGOUT_FILE:
-            err = log_set_out_file(settings->output.file_name);
+        case LOGOUT_FILE: {
+            logman_error err = log_open_filebuf(obj, &sink->filebuf, settings->output.file_name);
             if (err != LOGERR_NOERR) {
                 return err;
             }
-            log_obj.out_type = LOGOUT_FILE;
+            pthread_once(&log_atexit_once, log_atexit_register);
             break;
+        }
         default:
-            log_write_int_err("LOGMAN_ERROR::Unknown logman output type\n");
+            log_write_int_err(obj, "LOGMAN_ERROR::Unknown logman sink output type\n");
             return LOGERR_LOGUNKNOWNOUTTYPE;
     }
-    
+
+    sink->out_type = settings->out_type;
     return LOGERR_NOERR;
 }
 
-void log_destruct(void)
+log_static logman_error log_set_sinks(logman_src* obj, const logman_sink_settings* sinks, size_t count)
 {
-    if (log_obj.out_type == LOGOUT_FILE) {
-        if (fclose(log_obj.out_stream) != 0) {
-            log_write_int_err("LOGMAN_ERROR::Unable to close log file\n");
+    if (count > SINKS_MAX) {
+        log_write_int_err(obj, "LOGMAN_ERROR::Too many sinks\n");
+        return LOGERR_LOGSINKLIMIT;
+    }
+    for (size_t i = 0; i < count; i++) {
+        logman_error err = log_sink_open(obj, &obj->sinks[i], &sinks[i]);
+        if (err != LOGERR_NOERR) {
+            return err;
         }
+        obj->sinks_count++;
     }
-    
-    free(log_obj.date_buf);
-    free(log_obj.err_message);
-    free(log_obj.message_buf);
-    memset(&log_obj, 0, sizeof(log_obj));
+    return LOGERR_NOERR;
 }
 
-void __log_log(logman_level level, const char* file, const char* func, const int line, const char* message, ...)
+log_static void log_write_async(logman_src* obj, const char *buf, size_t len, logman_level level) {
+    if (!log_async_push(&obj->async, buf, len, level)) {
+        log_stat_add(&log_stats()->dropped, 1);
+        log_write_int_err(obj, "LOGMAN_ERROR::Async queue overflow, record dropped\n");
+    }
+}
+
+log_static logman_error log_set_async(logman_src* obj, size_t queue_size)
 {
-    if (log_obj.message_buf == NULL) {
-        log_write_int_err("LOGMAN_ERROR::Message buffer uninitialized\n");
-        return;
+    logman_error err = log_async_init(&obj->async, queue_size, obj->writer);
+    if (err == LOGERR_NOERR) {
+        obj->async.owner = obj;
+        obj->async.route = log_write_sink_target;
+        err = log_async_start(&obj->async);
+    }
+    if (err != LOGERR_NOERR) {
+        log_write_int_err(obj, "LOGMAN_ERROR::Unable to start the async writer\n");
+        return err;
+    }
+
+    obj->writer = log_write_async;
+    return LOGERR_NOERR;
+}
+
+// grows a per-thread buffer in power of two steps, its content is not kept
+static bool log_tls_reserve(char** buf, size_t* buf_size, size_t size)
+{
+    if (*buf_size >= size) {
+        return true;
+    }
+
+    size_t rounded = SPILL_BUF_SIZE_MIN;
+    while (rounded < size) {
+        rounded <<= 1;
+    }
+    char* grown = (char*)malloc(rounded);
+    if (grown == NULL) {
+        return false;
+    }
+    free(*buf);
+    *buf = grown;
+    *buf_size = rounded;
+    return true;
+}
+
+static size_t log_message_limit(logman_src* obj)
+{
+    size_t limit = (obj->max_message_size == 0) ? MESSAGE_SIZE_MAX_DEFAULT : obj->max_message_size;
+    return (limit < MESSAGE_BUF_SIZE) ? MESSAGE_BUF_SIZE : limit;
+}
+
+// the note of a rate limited record, log_form_message_core keeps room for it
+static void log_form_suppressed(logman_tls* tls, char* buf, size_t* len)
+{
+    static const char note[] = " [suppressed ";
+    memcpy(&buf[*len], note, sizeof(note) - 1);
+    *len += sizeof(note) - 1;
+    *len += log_utoa(&buf[*len], tls->suppressed);
+    buf[(*len)++] = ']';
+}
+
+/* The message goes to message_buf right after the first len bytes. If it does not fit,
+ * those bytes move to the spill buffer and the message is formatted there once more.
+ * tls->record points to the buffer in use afterwards.
+ */
+log_static logman_error log_form_message_core(logman_src* obj, logman_tls* tls, size_t* len, const char* message,
+    va_list va)
+{
+    va_list retry;
+    va_copy(retry, va);
+
+    char* buf = tls->message_buf;
+    // keep room for the trailing '\n' and the note of a rate limited record
+    size_t reserve = (tls->suppressed != 0 && *len + SUPPRESSED_BUF_SIZE + 2 < MESSAGE_BUF_SIZE) ?
+        SUPPRESSED_BUF_SIZE + 1 : 1;
+    size_t max_len = MESSAGE_BUF_SIZE - *len - reserve;
+    size_t mes_len = vsnprintf(&buf[*len], max_len, message, va);
+    logman_error err = LOGERR_NOERR;
+    if (mes_len >= max_len) {
+        size_t limit = log_message_limit(obj);
+        size_t size = *len + mes_len + reserve + 1;
+        if (size > limit) {
+            size = limit;
+            err = LOGERR_LOGBUFOVERFLOW;
+        }
+
+        if (size > MESSAGE_BUF_SIZE && log_tls_reserve(&tls->spill, &tls->spill_size, size)) {
+            memcpy(tls->spill, buf, *len);
+            buf = tls->spill;
+            max_len = size - *len - reserve;
+            vsnprintf(&buf[*len], max_len, message, retry);
+        } else {
+            err = LOGERR_LOGBUFOVERFLOW;
+        }
+        mes_len = (mes_len >= max_len) ? max_len - 1 : mes_len;
+    }
+    va_end(retry);
+
+    *len += mes_len;
+    if (reserve != 1) {
+        log_form_suppressed(tls, buf, len);
+    }
+    buf[(*len)++] = '\n';
+    buf[*len] = '\0';
+    tls->record = buf;
+    return err;
+}
+
+/* Same as log_form_message_core for structured records: the message is taken as is
+ * and the fields follow it as " key=value".
+ */
+log_static logman_error log_form_kv_core(logman_src* obj, logman_tls* tls, size_t* len, const logman_record* rec)
+{
+    size_t msg_len = strlen(rec->message);
+    size_t size = *len + msg_len + log_kv_bound(rec->kv, rec->kv_count) + KV_CLOSE_SIZE;
+    size_t limit = log_message_limit(obj);
+    size = (size > limit) ? limit : size;
+
+    logman_enc enc = { .buf = tls->message_buf, .len = *len, .cap = MESSAGE_BUF_SIZE - KV_CLOSE_SIZE };
+    if (size > MESSAGE_BUF_SIZE && log_tls_reserve(&tls->spill, &tls->spill_size, size)) {
+        memcpy(tls->spill, tls->message_buf, *len);
+        enc.buf = tls->spill;
+        enc.cap = size - KV_CLOSE_SIZE;
+    }
+
+    size_t part = (enc.cap - enc.len < msg_len) ? enc.cap - enc.len : msg_len;
+    memcpy(&enc.buf[enc.len], rec->message, part);
+    enc.len += part;
+    enc.full = part != msg_len;
+    log_enc_fields(&enc, rec->kv, rec->kv_count);
+
+    enc.buf[enc.len++] = '\n';
+    enc.buf[enc.len] = '\0';
+    *len = enc.len;
+    tls->record = enc.buf;
+    return enc.full ? LOGERR_LOGBUFOVERFLOW : LOGERR_NOERR;
+}
+
+/* JSON and logfmt records go to their own per-thread buffer, the text of a printf
+ * message stays where it was formatted.
+ */
+log_static size_t log_form_structured(logman_src* obj, logman_tls* tls, logman_format format, const logman_record* rec,
+    const char* msg, size_t msg_len)
+{
+    size_t size = 128 + 6 * (strlen(tls->date_buf) + strlen(rec->site->file) + strlen(rec->site->func) + msg_len) +
+        log_kv_bound(rec->kv, rec->kv_count) + KV_CLOSE_SIZE;
+    size_t limit = log_message_limit(obj);
+    size = (size > limit) ? limit : size;
+    if (!log_tls_reserve(&tls->enc, &tls->enc_size, size)) {
+        log_write_int_err(obj, "LOGMAN_ERROR::Unable to allocate the record buffer\n");
+        return 0;
+    }
+
+    logman_enc enc = { .buf = tls->enc, .len = 0, .cap = size - KV_CLOSE_SIZE };
+    if (format == LOGFORMAT_JSON) {
+        log_enc_json(&enc, tls->date_buf, rec, msg, msg_len);
+    } else {
+        log_enc_logfmt(&enc, tls->date_buf, rec, msg, msg_len);
+    }
+    if (enc.full) {
+        log_write_overflow(obj);
+    }
+    return enc.len;
+}
+
+// copies what fits, the returned length counts the rest as well like snprintf does
+static size_t log_append(char* buf, size_t size, size_t len, const char* src, size_t src_len)
+{
+    if (len + 1 < size) {
+        size_t room = size - len - 1;
+        memcpy(&buf[len], src, (src_len < room) ? src_len : room);
     }
+    return len + src_len;
+}
+
+/* Renders "file::func::line::" of the site to buf. A persistent site keeps a copy,
+ * threads racing on its first record publish only one of theirs.
+ */
+log_static size_t log_site_render(logman_site* site, char* buf, size_t size)
+{
+    size_t len = snprintf(buf, size, "%s::%s::%i::", site->file, site->func, site->line);
+    if (!site->persistent || len >= size) {
+        return len;
+    }
+
+    char* tail = (char*)malloc(len + 1);
+    if (tail == NULL) {
+        return len;
+    }
+    memcpy(tail, buf, len + 1);
+    __atomic_store_n(&site->tail_len, len, __ATOMIC_RELAXED);
+    char* expected = NULL;
+    if (!__atomic_compare_exchange_n(&site->tail, &expected, tail, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        free(tail);
+    }
+    return len;
+}
+
+// date_buf must be up to date
+log_static size_t log_form_prefix(logman_tls* tls, logman_format format, logman_level level, logman_site* site,
+    char* buf, size_t size)
+{
+    size_t len = log_append(buf, size, 0, tls->date_buf, strlen(tls->date_buf));
+    len = log_append(buf, size, len, level_field[level], level_field_len[level]);
+    if (format == LOGFORMAT_DEBUG) {
+        const char* tail = __atomic_load_n(&site->tail, __ATOMIC_ACQUIRE);
+        if (tail != NULL) {
+            len = log_append(buf, size, len, tail, __atomic_load_n(&site->tail_len, __ATOMIC_RELAXED));
+        } else if (len < size) {
+            len += log_site_render(site, &buf[len], size - len);
+        }
+    }
+    buf[(len < size) ? len : size - 1] = '\0';
+    return len;
+}
+
+log_static size_t log_form_debug_message(logman_src* obj, logman_tls* tls, logman_level level, logman_site* site,
+    const char* message, va_list va)
+{
+    log_date_update(obj, tls);
+    size_t len = log_form_prefix(tls, LOGFORMAT_DEBUG, level, site, tls->message_buf, MESSAGE_BUF_SIZE);
+    if (len >= MESSAGE_BUF_SIZE - 1) {
+        log_write_overflow(obj);
+        return 0;
+    }                             
+
+    if (log_form_message_core(obj, tls, &len, message, va) != LOGERR_NOERR) {
+        log_write_overflow(obj);
+    }
+    return len;
+}
+
+log_static size_t log_form_product_message(logman_src* obj, logman_tls* tls, logman_level level, logman_site* site,
+    const char* message, va_list va)
+{
+    log_date_update(obj, tls);
+    size_t len = log_form_prefix(tls, LOGFORMAT_PRODUCT, level, site, tls->message_buf, MESSAGE_BUF_SIZE);
+    if (len >= MESSAGE_BUF_SIZE - 1) {
+        log_write_overflow(obj);
+        return 0;
+    }   
+
+    if (log_form_message_core(obj, tls, &len, message, va) != LOGERR_NOERR) {
+        log_write_overflow(obj);
+    }
+    return len;
+}
+
+// straight to the file buffer, the async queue could drop the entry
+static bool log_write_binary_site(logman_src* obj, const char *buf, size_t len)
+{
+    if (!log_filebuf_write(&obj->filebuf, buf, len, LOGLEVEL_DEBUG)) {
+        log_write_int_err(obj, "LOGMAN_ERROR::Unable to write to log file\n");
+        return false;
+    }
+    log_stats_written(0, len);
+    return true;
+}
+
+/* Same as log_form_message_core for binary records: arguments that do not fit message_buf
+ * are encoded once more into the spill buffer, up to max_message_size.
+ */
+static size_t log_binary_encode_spill(logman_src* obj, logman_tls* tls, uint32_t id, logman_level level, uint64_t ts,
+    const char* fmt, va_list va)
+{
+    va_list retry;
+    va_copy(retry, va);
+
+    size_t need;
+    tls->record = tls->message_buf;
+    size_t len = log_binary_encode(tls->message_buf, MESSAGE_BUF_SIZE, id, level, ts, fmt, va, &need);
+    if (need > MESSAGE_BUF_SIZE) {
+        size_t limit = log_message_limit(obj);
+        size_t size = (need > limit) ? limit : need;
+        if (size > MESSAGE_BUF_SIZE && log_tls_reserve(&tls->spill, &tls->spill_size, size)) {
+            tls->record = tls->spill;
+            len = log_binary_encode(tls->spill, size, id, level, ts, fmt, retry, NULL);
+        }
+        if (size != need) {
+            log_write_overflow(obj);
+        }
+    }
+    va_end(retry);
+    if (len == 0) {
+        log_write_overflow(obj);
+    }
+    return len;
+}
 
+static size_t log_binary_encode_args(logman_src* obj, logman_tls* tls, uint32_t id, logman_level level, uint64_t ts,
+    const char* fmt, ...)
+{
     va_list va;
-    va_start(va, message);
-    log_obj.message_former(level, file, func, line, message, va);
-    log_obj.writer(log_obj.message_buf);
+    va_start(va, fmt);
+    size_t len = log_binary_encode_spill(obj, tls, id, level, ts, fmt, va);
     va_end(va);
+    return len;
+}
+
+/* Records that cannot refer to a fixed format keep their text as one string argument:
+ * tls->record holds it with its line end, len bytes long.
+ */
+static size_t log_binary_text(logman_src* obj, logman_tls* tls, logman_level level, logman_site* site, size_t len)
+{
+    static const char text_fmt[] = "%s";
+    uint32_t id;
+    if (!log_binary_site(&obj->binary, obj, log_write_binary_site, site, text_fmt, &id)) {
+        log_write_int_err(obj, "LOGMAN_ERROR::Unable to register the binary call site\n");
+        return 0;
+    }
+
+    // the binary decoder adds the line end
+    tls->record[len - 1] = '\0';
+    // the encoder below writes to message_buf or spill
+    if (!log_tls_reserve(&tls->enc, &tls->enc_size, len)) {
+        log_write_int_err(obj, "LOGMAN_ERROR::Unable to allocate the record buffer\n");
+        return 0;
+    }
+    memcpy(tls->enc, tls->record, len);
+
+    struct timespec ts;
+    log_time_now(&ts, obj->time_precision, obj->time_tsc);
+    uint64_t ts_ns = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    return log_binary_encode_args(obj, tls, id, level, ts_ns, text_fmt, tls->enc);
 }
 
+/* Formatting is deferred for string literal formats of the log_* macros only, a format
+ * buffer may change between calls and would no longer match its dictionary entry.
+ */
+log_static size_t log_form_binary_message(logman_src* obj, logman_tls* tls, logman_level level, logman_site* site,
+    const char* message, va_list va)
+{
+    if (!site->persistent || !site->literal) {
+        size_t len = 0;
+        if (log_form_message_core(obj, tls, &len, message, va) != LOGERR_NOERR) {
+            log_write_overflow(obj);
+        }
+        return log_binary_text(obj, tls, level, site, len);
+    }
+
+    uint32_t id;
+    if (!log_binary_site(&obj->binary, obj, log_write_binary_site, site, message, &id)) {
+        log_write_int_err(obj, "LOGMAN_ERROR::Unable to register the binary call site\n");
+        return 0;
+    }
+
+    struct timespec ts;
+    log_time_now(&ts, obj->time_precision, obj->time_tsc);
+    uint64_t ts_ns = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    return log_binary_encode_spill(obj, tls, id, level, ts_ns, message, va);
+}
 
+// the message and its fields are stored as one string argument
+log_static size_t log_form_binary_kv(logman_src* obj, logman_tls* tls, const logman_record* rec)
+{
+    size_t len = 0;
+    log_form_kv_core(obj, tls, &len, rec);
+    return log_binary_text(obj, tls, rec->level, rec->site, len);
+}
+
+log_static logman_error log_set_out_binary(logman_src* obj, const char* file_name, logman_type type)
+{
+    // the call site dictionary lives in the file itself, so it always starts from scratch
+    obj->file_append = false;
+    // the zero padding of a direct I/O block would not be a valid entry
+    obj->file_direct = false;
+    obj->file_compress = LOGCOMPRESS_NONE;
+    obj->file_index = false;
+    obj->rotate_size = 0;
+    obj->rotate_interval_s = 0;
+    logman_error err = log_set_out_file(obj, file_name);
+    if (err != LOGERR_NOERR) {
+        return err;
+    }
+    err = log_binary_init(&obj->binary);
+    if (err != LOGERR_NOERR) {
+        log_write_int_err(obj, "LOGMAN_ERROR::Unable to initialize the binary call site table\n");
+        return err;
+    }
+
+    char header[BINARY_HEADER_SIZE];
+    log_write_file(obj, header, log_binary_header(header, type, obj->time_format, obj->time_precision),
+        LOGLEVEL_DEBUG);
+    obj->message_former = log_form_binary_message;
+    return LOGERR_NOERR;
+}
+
+static void log_emit(logman_src* obj, logman_format format, bool main, const char* record, size_t len,
+    logman_level level)
+{
+    if (main) {
+        LOG_STAGE_BEGIN(writer);
+        obj->writer(obj, record, len, level);
+        LOG_STAGE_END(writer, writer);
+    }
+    for (size_t i = 0; i < obj->sinks_count; i++) {
+        if (obj->sinks[i].format == format && level >= obj->sinks[i].min_level) {
+            log_sink_emit(obj, i, record, len, level);
+        }
+    }
+}
+
+/* The message is formatted once after the longest text prefix in use. Each prefix is then
+ * put right in front of it and the record goes to every output of that format. JSON and
+ * logfmt records reuse the formatted message text.
+ */
+log_static void log_fan_out(logman_src* obj, logman_tls* tls, const logman_record* rec)
+{
+    bool binary = obj->out_type == LOGOUT_BINARY;
+    if (binary) {
+        size_t len;
+        if (rec->va != NULL) {
+            va_list copy;
+            va_copy(copy, *rec->va);
+            LOG_STAGE_BEGIN(former);
+            len = obj->message_former(obj, tls, rec->level, rec->site, rec->message, copy);
+            LOG_STAGE_END(former, former);
+            va_end(copy);
+        } else {
+            len = log_form_binary_kv(obj, tls, rec);
+        }
+        if (len != 0) {
+            LOG_STAGE_BEGIN(writer);
+            obj->writer(obj, tls->record, len, rec->level);
+            LOG_STAGE_END(writer, writer);
+        }
+    }
+
+    bool used[LOGFORMAT_COUNT] = { false };
+    used[obj->format] = !binary;
+    for (size_t i = 0; i < obj->sinks_count; i++) {
+        if (rec->level >= obj->sinks[i].min_level) {
+            used[obj->sinks[i].format] = true;
+        }
+    }
+    if (!used[LOGFORMAT_DEBUG] && !used[LOGFORMAT_PRODUCT] && !used[LOGFORMAT_JSON] && !used[LOGFORMAT_LOGFMT]) {
+        return;
+    }
+    log_date_update(obj, tls);
+
+    char prefix[LOGFORMAT_COUNT][PREFIX_BUF_SIZE];
+    size_t prefix_len[LOGFORMAT_COUNT] = { 0 };
+    size_t head = 0;
+    for (int format = LOGFORMAT_DEBUG; format <= LOGFORMAT_PRODUCT; format++) {
+        if (!used[format]) {
+            continue;
+        }
+        prefix_len[format] = log_form_prefix(tls, (logman_format)format, rec->level, rec->site, prefix[format],
+            PREFIX_BUF_SIZE);
+        if (prefix_len[format] >= PREFIX_BUF_SIZE - 1) {
+            log_write_overflow(obj);
+            used[format] = false;
+            continue;
+        }
+        head = (prefix_len[format] > head) ? prefix_len[format] : head;
+    }
+
+    // printf messages are needed as text by every format
+    size_t len = head;
+    bool text = used[LOGFORMAT_DEBUG] || used[LOGFORMAT_PRODUCT] || rec->va != NULL;
+    if (text) {
+        logman_error err;
+        if (rec->va != NULL) {
+            va_list copy;
+            va_copy(copy, *rec->va);
+            err = log_form_message_core(obj, tls, &len, rec->message, copy);
+            va_end(copy);
+        } else {
+            err = log_form_kv_core(obj, tls, &len, rec);
+        }
+        if (err != LOGERR_NOERR) {
+            log_write_overflow(obj);
+        }
+    }
+
+    for (int format = LOGFORMAT_DEBUG; format <= LOGFORMAT_PRODUCT; format++) {
+        if (!used[format]) {
+            continue;
+        }
+        // the outputs of the previous format are done with the buffer, writers do not keep it
+        size_t start = head - prefix_len[format];
+        char* record = &tls->record[start];
+        memcpy(record, prefix[format], prefix_len[format]);
+        log_emit(obj, (logman_format)format, !binary && format == (int)obj->format, record, len - start, rec->level);
+    }
+
+    const char* msg = (rec->va != NULL) ? &tls->record[head] : rec->message;
+    size_t msg_len = (rec->va != NULL) ? len - head - 1 : strlen(rec->message);
+    for (int format = LOGFORMAT_JSON; format <= LOGFORMAT_LOGFMT; format++) {
+        if (!used[format]) {
+            continue;
+        }
+        size_t enc_len = log_form_structured(obj, tls, (logman_format)format, rec, msg, msg_len);
+        if (enc_len != 0) {
+            log_emit(obj, (logman_format)format, !binary && format == (int)obj->format, tls->enc, enc_len,
+                rec->level);
+        }
+    }
+}
+
+// binary and mapped outputs take only their own records, recent ones go to stderr there
+static bool log_recorder_to_stderr(logman_src* obj)
+{
+    return obj->out_type == LOGOUT_BINARY || obj->out_type == LOGOUT_MMAP;
+}
+
+static void log_write_recent_err(logman_src* obj, const char *buf, size_t len, logman_level level)
+{
+    (void)obj;
+    (void)level;
+    log_fd_write(STDERR_FILENO, buf, len);
+}
+
+// where the signal handlers write the dump to
+static int log_recorder_target(logman_src* obj, logman_filebuf** pending)
+{
+    *pending = NULL;
+    // a plain dump would break the frames of a compressed file
+    if (!log_recorder_to_stderr(obj) && obj->filebuf.data != NULL && obj->filebuf.comp == NULL) {
+        *pending = &obj->filebuf;
+        return obj->filebuf.fd;
+    }
+    if (!log_recorder_to_stderr(obj) && obj->out_stream != NULL) {
+        return obj->out_fd;
+    }
+    return STDERR_FILENO;
+}
+
+log_static logman_error log_set_recorder(logman_src* obj, bool signals)
+{
+    logman_filebuf* pending = NULL;
+    int fd = log_recorder_target(obj, &pending);
+    logman_error err = log_recorder_init(obj->recorder_size, signals, obj->time_tsc, fd, pending);
+    if (err != LOGERR_NOERR) {
+        log_write_int_err(obj, "LOGMAN_ERROR::Unable to install the flight recorder signal handlers\n");
+    }
+    return err;
+}
+
+void log_dump_recent(void)
+{
+    log_rcu_enter();
+    logman_src* obj = log_current();
+    if (obj->writer != NULL) {
+        log_recorder_dump(obj, log_recorder_to_stderr(obj) ? log_write_recent_err : obj->writer);
+    }
+    log_rcu_exit();
+}
+
+static logman_error log_src_init_default(logman_src* obj)
+{
+    obj->out_type = LOGOUT_STREAM;
+    obj->out_stream = stderr;
+    obj->out_fd = log_stream_fd(stderr);
+    obj->writer = log_write_std;
+    obj->error_callback = log_error_callback_default;
+    obj->message_former = log_form_debug_message;
+    obj->format = LOGFORMAT_DEBUG;
+    log_level_apply(obj, LOGLEVEL_DEBUG);
+    return log_buffers_init(obj);
+}
+
+logman_error log_init_default(void)
+{
+    log_rcu_init();
+    log_clock_span_init();
+    log_stats_reset();
+    return log_src_init_default(&log_obj);
+}
+
+/* Sets up an instance, the default one included. On failure the instance keeps what
+ * was set up so far, the caller tears it down.
+ */
+static logman_error log_src_init(logman_src* obj, logman_settings* settings)
+{
+    // readers skip their full fence from here on, see log_rcu_enter()
+    log_rcu_init();
+    log_clock_span_init();
+    if (settings == NULL) {
+        logman_error err = log_src_init_default(obj);
+        if (err == LOGERR_NOERR) {
+            log_write_int_err(obj, "LOGMAN_WARNING::Empty settings, setting default\n");
+        }
+        return err;
+    }
+    
+    obj->error_callback = (settings->error_callback == NULL) ? log_error_callback_default : settings->error_callback;
+    obj->time_precision = settings->time_precision;
+    obj->time_format = settings->time_format;
+    obj->file_buffer_size = settings->file_buffer_size;
+    obj->flush_interval_ms = settings->flush_interval_ms;
+    obj->flush_on_error = settings->flush_on_error;
+    obj->mmap_chunk_size = settings->mmap_chunk_size;
+    obj->file_append = settings->file_append;
+    obj->file_direct = settings->file_direct;
+    obj->file_compress = settings->file_compress;
+    obj->file_index = settings->file_index;
+    obj->index_block_size = settings->index_block_size;
+    obj->timer_threshold_ns = (unsigned long long)settings->timer_threshold_us * 1000;
+    obj->socket_batch = settings->socket_batch;
+    obj->socket_policy = settings->socket_policy;
+    obj->socket_syslog = settings->socket_syslog;
+    obj->rotate_size = settings->rotate_size;
+    obj->rotate_interval_s = settings->rotate_interval_s;
+    obj->rotate_keep = settings->rotate_keep;
+    obj->max_message_size = settings->max_message_size;
+    obj->stats_latency = settings->stats_latency;
+    logman_error err = log_buffers_init(obj);
+    if (err != LOGERR_NOERR) {
+        return err;
+    }
+    if (settings->time_tsc) {
+        if (log_clock_start() != LOGERR_NOERR) {
+            log_write_int_err(obj, "LOGMAN_ERROR::Unable to start the timestamp clock\n");
+            return LOGERR_LOGCLOCKINIT;
+        }
+        obj->time_tsc = true;
+    }
+
+    switch (settings->type) {
+        case LOGTYPE_DEBUG:
+            obj->message_former = log_form_debug_message;
+            obj->format = LOGFORMAT_DEBUG;
+            log_level_apply(obj, LOGLEVEL_DEBUG);
+            break;
+        case LOGTYPE_PRODUCT:
+            obj->message_former = log_form_product_message;
+            obj->format = LOGFORMAT_PRODUCT;
+            log_level_apply(obj, LOGLEVEL_INFO);
+            break;
+        default:
+            log_write_int_err(obj, "LOGMAN_ERROR::Unknown logman type\n");
+            return LOGERR_LOGUNKNOWNTYPE;
+    }
+
+    switch (settings->format) {
+        case LOGFORMAT_DEFAULT:
+            break;
+        case LOGFORMAT_DEBUG:
+            obj->message_former = log_form_debug_message;
+            obj->format = LOGFORMAT_DEBUG;
+            break;
+        case LOGFORMAT_PRODUCT:
+            obj->message_former = log_form_product_message;
+            obj->format = LOGFORMAT_PRODUCT;
+            break;
+        case LOGFORMAT_JSON:
+        case LOGFORMAT_LOGFMT:
+            // records take the structured path, the former stays for a binary output
+            obj->format = settings->format;
+            break;
+        default:
+            log_write_int_err(obj, "LOGMAN_ERROR::Unknown logman format\n");
+            return LOGERR_LOGBADFORMAT;
+    }
+    
+    switch (settings->out_type) {
+        case LOGOUT_STREAM:
+            obj->out_stream = (settings->output.out_stream != stderr && settings->output.out_stream != stdout) ?
+                stderr : settings->output.out_stream;
+            obj->out_fd = log_stream_fd(obj->out_stream);
+            obj->writer = log_write_std;
+            
+            break;
+        case LOGOUT_FILE:
+            err = log_set_out_file(obj, settings->output.file_name);
+            if (err != LOGERR_NOERR) {
+                return err;
+            }
+            obj->out_type = LOGOUT_FILE;
+            break;
+        case LOGOUT_BINARY:
+            err = log_set_out_binary(obj, settings->output.file_name, settings->type);
+            if (err != LOGERR_NOERR) {
+                return err;
+            }
+            obj->out_type = LOGOUT_BINARY;
+            break;
+        case LOGOUT_MMAP:
+            err = log_set_out_mmap(obj, settings->output.file_name);
+            if (err != LOGERR_NOERR) {
+                return err;
+            }
+            obj->out_type = LOGOUT_MMAP;
+            break;
+        case LOGOUT_SOCKET:
+            err = log_set_out_socket(obj, settings->output.address);
+            if (err != LOGERR_NOERR) {
+                return err;
+            }
+            obj->out_type = LOGOUT_SOCKET;
+            break;
+        default:
+            log_write_int_err(obj, "LOGMAN_ERROR::Unknown logman output type\n");
+            return LOGERR_LOGUNKNOWNOUTTYPE;
+    }
+
+    err = log_set_sinks(obj, settings->sinks, settings->sinks_count);
+    if (err != LOGERR_NOERR) {
+        return err;
+    }
+    if (settings->trace_file != NULL) {
+        err = log_set_trace(obj, settings->trace_file);
+        if (err != LOGERR_NOERR) {
+            return err;
+        }
+    }
+
+    switch (settings->mode) {
+        case LOGMODE_SYNC:
+            break;
+        case LOGMODE_ASYNC:
+            return log_set_async(obj, settings->async_queue_size);
+        default:
+            log_write_int_err(obj, "LOGMAN_ERROR::Unknown logman mode\n");
+            return LOGERR_LOGUNKNOWNMODE;
+    }
+    
+    return LOGERR_NOERR;
+}
+
+static void log_src_destruct(logman_src* obj)
+{
+    // the backend thread may still hold records for the output, stop it first
+    log_async_destruct(&obj->async);
+
+    if (!log_filebuf_destruct(&obj->filebuf)) {
+        log_write_int_err(obj, "LOGMAN_ERROR::Unable to write to log file\n");
+    }
+    if (!log_mmap_destruct(&obj->mmap)) {
+        log_write_int_err(obj, "LOGMAN_ERROR::Unable to truncate log file\n");
+    }
+    if (!log_trace_close(obj)) {
+        log_write_int_err(obj, "LOGMAN_ERROR::Unable to write to the trace file\n");
+    }
+    if (!log_socket_destruct(obj->socket)) {
+        log_write_int_err(obj, "LOGMAN_ERROR::Unable to send to the log socket\n");
+    }
+    obj->socket = NULL;
+    for (size_t i = 0; i < obj->sinks_count; i++) {
+        if (!log_filebuf_destruct(&obj->sinks[i].filebuf)) {
+            log_write_int_err(obj, "LOGMAN_ERROR::Unable to write to log file\n");
+        }
+    }
+    
+    log_binary_destruct(&obj->binary);
+    if (obj->time_tsc) {
+        log_clock_stop();
+        obj->time_tsc = false;
+    }
+}
+
+static void log_settings_release(void)
+{
+    for (size_t i = 0; i < SINKS_MAX + 2; i++) {
+        free(log_settings_names[i]);
+        log_settings_names[i] = NULL;
+    }
+    log_settings_kept = false;
+}
+
+// the caller's file names may be gone by the time of the SIGUSR1 switch
+static void log_settings_keep(const logman_settings* settings)
+{
+    logman_settings kept = *settings;
+    logman_sink_settings sinks[SINKS_MAX];
+    char* names[SINKS_MAX + 2] = { NULL };
+    bool ok = true;
+
+    if (kept.out_type != LOGOUT_STREAM) {
+        names[0] = strdup(kept.output.file_name);
+        kept.output.file_name = names[0];
+        ok = ok && names[0] != NULL;
+    }
+    for (size_t i = 0; i < kept.sinks_count; i++) {
+        sinks[i] = settings->sinks[i];
+        if (sinks[i].out_type == LOGOUT_FILE) {
+            names[i + 1] = strdup(sinks[i].output.file_name);
+            sinks[i].output.file_name = names[i + 1];
+            ok = ok && names[i + 1] != NULL;
+        }
+    }
+    if (kept.trace_file != NULL) {
+        names[SINKS_MAX + 1] = strdup(kept.trace_file);
+        kept.trace_file = names[SINKS_MAX + 1];
+        ok = ok && names[SINKS_MAX + 1] != NULL;
+    }
+
+    // settings may be the kept ones, they are released only now
+    log_settings_release();
+    memcpy(log_settings_names, names, sizeof(names));
+    memcpy(log_settings_sinks, sinks, sizeof(sinks));
+    kept.sinks = log_settings_sinks;
+    log_settings = kept;
+    log_settings_kept = ok;
+}
+
+/* A trace file that stays the same is continued by the new instance: the old one
+ * flushes its events into it on destruct, the array is opened and closed only once.
+ */
+static bool log_trace_same(const logman_src* old, const char* file_name)
+{
+    struct stat old_st, st;
+    if (old->trace.data == NULL || file_name == NULL) {
+        return false;
+    }
+    return fstat(old->trace.fd, &old_st) == 0 && stat(file_name, &st) == 0 &&
+        old_st.st_dev == st.st_dev && old_st.st_ino == st.st_ino;
+}
+
+static logman_error log_reconfigure_locked(logman_settings* settings)
+{
+    logman_src* old = __atomic_load_n(&log_active, __ATOMIC_RELAXED);
+    if (settings == NULL || old->writer == NULL) {
+        log_write_int_err(old, "LOGMAN_ERROR::Reconfiguration needs settings and an initialized logger\n");
+        return LOGERR_LOGRECONFIGURE;
+    }
+    if (old->out_type == LOGOUT_BINARY || old->out_type == LOGOUT_MMAP ||
+        settings->out_type == LOGOUT_BINARY || settings->out_type == LOGOUT_MMAP) {
+        log_write_int_err(old, "LOGMAN_ERROR::Binary and mmap outputs cannot be reconfigured\n");
+        return LOGERR_LOGRECONFIGURE;
+    }
+
+    logman_src* obj = (logman_src*)calloc(1, sizeof(logman_src));
+    if (obj == NULL) {
+        log_write_int_err(old, "LOGMAN_ERROR::Unable to allocate memory for the new settings\n");
+        return LOGERR_LOGBUFFINIT;
+    }
+    // records written under the old settings stay in the files
+    logman_settings applied = *settings;
+    applied.file_append = true;
+    obj->recorder_size = old->recorder_size;
+    obj->trace_resume = log_trace_same(old, applied.trace_file);
+    obj->trace_base = old->trace_base;
+    logman_error err = log_src_init(obj, &applied);
+    if (err != LOGERR_NOERR) {
+        if (obj->err_message != NULL) {
+            memcpy(old->err_message, obj->err_message, INTERR_BUF_SIZE);
+        }
+        // the old instance still closes the trace array
+        obj->trace_handed_over = obj->trace_resume;
+        log_src_destruct(obj);
+        free(obj->err_message);
+        free(obj);
+        return err;
+    }
+
+    // log_get_internal_error() keeps returning the same buffer
+    char* err_message = obj->err_message;
+    obj->err_message = old->err_message;
+    old->err_message = err_message;
+    if (obj->recorder_size != 0) {
+        logman_filebuf* pending = NULL;
+        int fd = log_recorder_target(obj, &pending);
+        log_recorder_output(fd, pending);
+    }
+
+    old->trace_handed_over = obj->trace_resume;
+    log_rcu_init();
+    __atomic_store_n(&log_active, obj, __ATOMIC_RELEASE);
+    log_level_apply(obj, obj->out_level);
+    // the old outputs are flushed and closed once no thread writes through them anymore
+    log_rcu_synchronize();
+    log_src_destruct(old);
+    free(old->err_message);
+    if (old == &log_obj) {
+        memset(&log_obj, 0, sizeof(log_obj));
+    } else {
+        free(old);
+    }
+
+    log_settings_keep(&applied);
+    return LOGERR_NOERR;
+}
+
+logman_error log_reconfigure(logman_settings* settings)
+{
+    pthread_mutex_lock(&log_reconfigure_lock);
+    logman_error err = log_reconfigure_locked(settings);
+    pthread_mutex_unlock(&log_reconfigure_lock);
+    return err;
+}
+
+static void log_control_signal(int sig)
+{
+    (void)sig;
+    sem_post(&log_control_sem);
+}
+
+// applies the SIGUSR1 switch, the handler itself cannot allocate or take locks
+static void* log_control_main(void* arg)
+{
+    (void)arg;
+    for (;;) {
+        if (sem_wait(&log_control_sem) != 0) {
+            continue;
+        }
+        if (__atomic_load_n(&log_control_quit, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+
+        pthread_mutex_lock(&log_reconfigure_lock);
+        if (log_settings_kept) {
+            logman_settings settings = log_settings;
+            settings.type = (settings.type == LOGTYPE_DEBUG) ? LOGTYPE_PRODUCT : LOGTYPE_DEBUG;
+            log_reconfigure_locked(&settings);
+        }
+        pthread_mutex_unlock(&log_reconfigure_lock);
+    }
+    return NULL;
+}
+
+static logman_error log_control_init(logman_src* obj)
+{
+    if (sem_init(&log_control_sem, 0, 0) != 0) {
+        log_write_int_err(obj, "LOGMAN_ERROR::Unable to set up the reconfiguration signal\n");
+        return LOGERR_LOGRECONFIGURE;
+    }
+    log_control_quit = false;
+    if (pthread_create(&log_control_thread, NULL, log_control_main, NULL) != 0) {
+        sem_destroy(&log_control_sem);
+        log_write_int_err(obj, "LOGMAN_ERROR::Unable to set up the reconfiguration signal\n");
+        return LOGERR_LOGRECONFIGURE;
+    }
+    log_control_running = true;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = log_control_signal;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    if (sigaction(SIGUSR1, &sa, &log_control_old) != 0) {
+        log_write_int_err(obj, "LOGMAN_ERROR::Unable to set up the reconfiguration signal\n");
+        return LOGERR_LOGRECONFIGURE;
+    }
+    return LOGERR_NOERR;
+}
+
+static void log_control_destruct(void)
+{
+    if (!log_control_running) {
+        return;
+    }
+    sigaction(SIGUSR1, &log_control_old, NULL);
+    __atomic_store_n(&log_control_quit, true, __ATOMIC_RELEASE);
+    sem_post(&log_control_sem);
+    pthread_join(log_control_thread, NULL);
+    sem_destroy(&log_control_sem);
+    log_control_running = false;
+}
+
+logman_error log_init(logman_settings* settings)
+{
+    log_stats_reset();
+    // the flight recorder is process wide, it belongs to the default instance
+    log_obj.recorder_size = (settings != NULL) ? settings->recorder_size : 0;
+    logman_error err = log_src_init(&log_obj, settings);
+    if (err != LOGERR_NOERR || settings == NULL) {
+        return err;
+    }
+
+    if (log_obj.recorder_size != 0) {
+        err = log_set_recorder(&log_obj, settings->recorder_signals);
+        if (err != LOGERR_NOERR) {
+            return err;
+        }
+    }
+    log_settings_keep(settings);
+    if (settings->reconfigure_signal) {
+        return log_control_init(&log_obj);
+    }
+    return LOGERR_NOERR;
+}
+
+logman_error logman_flush(logman_t* handle)
+{
+    logman_src* obj = handle;
+    // records already handed to the backend thread are part of the flush
+    log_async_wait(&obj->async);
+
+    if (obj->out_type == LOGOUT_MMAP) {
+        if (!log_mmap_flush(&obj->mmap)) {
+            log_write_int_err(obj, "LOGMAN_ERROR::Unable to flush the log file mapping\n");
+            return LOGERR_LOGWRITE;
+        }
+    } else if (obj->socket != NULL) {
+        if (!log_socket_flush(obj->socket)) {
+            log_write_int_err(obj, "LOGMAN_ERROR::Unable to send to the log socket\n");
+            return LOGERR_LOGWRITE;
+        }
+    } else if (obj->filebuf.data != NULL) {
+        if (!log_filebuf_flush(&obj->filebuf)) {
+            log_write_int_err(obj, "LOGMAN_ERROR::Unable to write to log file\n");
+            return LOGERR_LOGWRITE;
+        }
+    } else if (obj->out_stream != NULL && fflush(obj->out_stream) != 0) {
+        log_write_int_err(obj, "LOGMAN_ERROR::Unable to flush the stream\n");
+        return LOGERR_LOGWRITE;
+    }
+
+    if (obj->trace.data != NULL && !log_filebuf_flush(&obj->trace)) {
+        log_write_int_err(obj, "LOGMAN_ERROR::Unable to write to the trace file\n");
+        return LOGERR_LOGWRITE;
+    }
+    for (size_t i = 0; i < obj->sinks_count; i++) {
+        logman_sink* sink = &obj->sinks[i];
+        bool ok = (sink->out_type == LOGOUT_FILE) ? log_filebuf_flush(&sink->filebuf) : fflush(sink->out_stream) == 0;
+        if (!ok) {
+            log_write_int_err(obj, "LOGMAN_ERROR::Unable to flush the sink\n");
+            return LOGERR_LOGWRITE;
+        }
+    }
+    return LOGERR_NOERR;
+}
+
+logman_error log_flush(void)
+{
+    log_rcu_enter();
+    logman_error err = logman_flush(log_current());
+    log_rcu_exit();
+    return err;
+}
+
+void log_destruct(void)
+{
+    // a switch in progress finishes first
+    log_control_destruct();
+    logman_src* obj = log_current();
+    log_src_destruct(obj);
+    log_recorder_destruct();
+    // buffers of other threads are released when those threads exit
+    log_tls_destruct();
+    free(obj->err_message);
+    if (obj != &log_obj) {
+        free(obj);
+        __atomic_store_n(&log_active, &log_obj, __ATOMIC_RELEASE);
+    }
+    log_settings_release();
+    memset(&log_obj, 0, sizeof(log_obj));
+    log_set_level(LOGLEVEL_DEBUG);
+}
+
+logman_t* logman_create(logman_settings* settings)
+{
+    logman_src* obj = (logman_src*)calloc(1, sizeof(logman_src));
+    if (obj == NULL) {
+        return NULL;
+    }
+    if (log_src_init(obj, settings) != LOGERR_NOERR) {
+        log_src_destruct(obj);
+        free(obj->err_message);
+        free(obj);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&log_instances_lock);
+    obj->next = log_instances;
+    log_instances = obj;
+    pthread_mutex_unlock(&log_instances_lock);
+    return obj;
+}
+
+void logman_destroy(logman_t* handle)
+{
+    if (handle == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&log_instances_lock);
+    logman_src** link = &log_instances;
+    while (*link != NULL && *link != handle) {
+        link = &(*link)->next;
+    }
+    if (*link != NULL) {
+        *link = handle->next;
+    }
+    pthread_mutex_unlock(&log_instances_lock);
+
+    log_src_destruct(handle);
+    free(handle->err_message);
+    free(handle);
+}
+
+static uint64_t log_stats_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// counts the record, the returned start time is 0 while the latency histogram is off
+static uint64_t log_record_begin(logman_src* obj, logman_level level)
+{
+    log_stat_add(&log_stats()->records[level], 1);
+    return obj->stats_latency ? log_stats_now() : 0;
+}
+
+static void log_record_end(uint64_t start)
+{
+    if (start != 0) {
+        log_stats_latency(log_stats(), log_stats_now() - start);
+    }
+}
+
+// hands the record to the flight recorder, true while it stays below the output level
+static bool log_record_keep(logman_src* obj, logman_site* site, const char* message, va_list* va)
+{
+    if (site->level == LOGLEVEL_ERROR) {
+        log_recorder_dump(obj, log_recorder_to_stderr(obj) ? log_write_recent_err : obj->writer);
+    }
+    log_recorder_add(site->level, site, message, va);
+    return site->level < obj->out_level;
+}
+
+static void log_log_va(logman_src* obj, logman_site* site, size_t suppressed, const char* message, va_list va)
+{
+    if (obj->recorder_size != 0) {
+        va_list copy;
+        va_copy(copy, va);
+        bool kept = log_record_keep(obj, site, message, &copy);
+        va_end(copy);
+        if (kept) {
+            return;
+        }
+    }
+
+    logman_tls* tls = log_tls_get();
+    if (obj->message_former == NULL || tls == NULL) {
+        log_write_int_err(obj, "LOGMAN_ERROR::Message buffer uninitialized\n");
+        return;
+    }
+    uint64_t start = log_record_begin(obj, site->level);
+    tls->suppressed = suppressed;
+
+    if (obj->sinks_count != 0 || obj->format >= LOGFORMAT_JSON) {
+        // a va_list parameter may be a pointer in disguise, the record needs a real one
+        va_list copy;
+        va_copy(copy, va);
+        logman_record rec = { site->level, site, message, &copy, NULL, 0 };
+        log_fan_out(obj, tls, &rec);
+        va_end(copy);
+        tls->suppressed = 0;
+    } else {
+        LOG_STAGE_BEGIN(former);
+        size_t len = obj->message_former(obj, tls, site->level, site, message, va);
+        LOG_STAGE_END(former, former);
+        tls->suppressed = 0;
+        if (len != 0) {
+            LOG_STAGE_BEGIN(writer);
+            obj->writer(obj, tls->record, len, site->level);
+            LOG_STAGE_END(writer, writer);
+        }
+    }
+    log_record_end(start);
+}
+
+static void log_log_kv(logman_src* obj, logman_site* site, const char* message, const logman_kv* kv, size_t kv_count)
+{
+    // the recorder keeps the message of a structured record, not its fields
+    if (obj->recorder_size != 0 && log_record_keep(obj, site, message, NULL)) {
+        return;
+    }
+
+    logman_tls* tls = log_tls_get();
+    if (obj->message_former == NULL || tls == NULL) {
+        log_write_int_err(obj, "LOGMAN_ERROR::Message buffer uninitialized\n");
+        return;
+    }
+    uint64_t start = log_record_begin(obj, site->level);
+
+    logman_record rec = { site->level, site, message, NULL, kv, kv_count };
+    log_fan_out(obj, tls, &rec);
+    log_record_end(start);
+}
+
+void __log_log_site(logman_site* site, const char* message, ...)
+{
+    // direct calls bypass the check in the log_* macros
+    if ((int)site->level < __atomic_load_n(&__log_min_level, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    va_list va;
+    va_start(va, message);
+    log_rcu_enter();
+    log_log_va(log_current(), site, 0, message, va);
+    log_rcu_exit();
+    va_end(va);
+}
+
+void __log_log_site_kv(logman_site* site, const char* message, const logman_kv* kv, size_t kv_count)
+{
+    if ((int)site->level < __atomic_load_n(&__log_min_level, __ATOMIC_RELAXED)) {
+        return;
+    }
+    log_rcu_enter();
+    log_log_kv(log_current(), site, message, kv, kv_count);
+    log_rcu_exit();
+}
+
+void __log_log_limited(logman_site* site, size_t suppressed, const char* message, ...)
+{
+    if ((int)site->level < __atomic_load_n(&__log_min_level, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    va_list va;
+    va_start(va, message);
+    log_rcu_enter();
+    log_log_va(log_current(), site, suppressed, message, va);
+    log_rcu_exit();
+    va_end(va);
+}
+
+static void log_trace_event(logman_src* obj, const logman_timer* timer, uint64_t duration_ns)
+{
+    static __thread long tid;
+    if (tid == 0) {
+        tid = (long)syscall(SYS_gettid);
+    }
+    double ts_us = (double)log_clock_span_ns(timer->start - obj->trace_base) / 1000.0;
+    char buf[TRACE_EVENT_SIZE];
+    logman_enc enc = { .buf = buf, .len = 0, .cap = sizeof(buf) };
+    log_enc_trace(&enc, timer->site, timer->name, ts_us, (double)duration_ns / 1000.0, (long)getpid(), tid);
+    if (enc.full) {
+        log_write_overflow(obj);
+        return;
+    }
+    if (!log_filebuf_write(&obj->trace, buf, enc.len, LOGLEVEL_DEBUG)) {
+        log_write_int_err(obj, "LOGMAN_ERROR::Unable to write to the trace file\n");
+    }
+}
+
+// a site that does not fit is left out of the list, it logs all the same
+void __log_site_add(const logman_site* site)
+{
+    pthread_mutex_lock(&log_sites_lock);
+    if (log_sites_count == log_sites_cap) {
+        size_t cap = (log_sites_cap == 0) ? 64 : log_sites_cap * 2;
+        const logman_site** list = (const logman_site**)realloc(log_sites_list, cap * sizeof(*list));
+        if (list != NULL) {
+            log_sites_list = list;
+            log_sites_cap = cap;
+        }
+    }
+    if (log_sites_count < log_sites_cap) {
+        log_sites_list[log_sites_count++] = site;
+    }
+    pthread_mutex_unlock(&log_sites_lock);
+}
+
+size_t __log_sites_added(const logman_site** sites, size_t max)
+{
+    pthread_mutex_lock(&log_sites_lock);
+    size_t count = log_sites_count;
+    size_t copied = (count < max) ? count : max;
+    if (copied != 0) {
+        memcpy(sites, log_sites_list, copied * sizeof(*sites));
+    }
+    pthread_mutex_unlock(&log_sites_lock);
+    return count;
+}
+
+void __log_timer_end(logman_timer* timer, unsigned long long end)
+{
+    uint64_t duration_ns = log_clock_span_ns(end - timer->start);
+    log_rcu_enter();
+    logman_src* obj = log_current();
+    if (obj->trace.data != NULL) {
+        log_trace_event(obj, timer, duration_ns);
+    }
+    if (duration_ns >= obj->timer_threshold_ns && (int)timer->site->level >= __atomic_load_n(&__log_min_level,
+            __ATOMIC_RELAXED)) {
+        logman_kv kv = __logkv_uint("duration_ns", duration_ns);
+        log_log_kv(obj, timer->site, timer->name, &kv, 1);
+    }
+    log_rcu_exit();
+}
+
+// a call site on the stack, its file::func::line part is rendered for every record
+void __log_log(logman_level level, const char* file, const char* func, const int line, const char* message, ...)
+{
+    if ((int)level < __atomic_load_n(&__log_min_level, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    logman_site site = { file, func, line, level, false, 0, NULL, false };
+    va_list va;
+    va_start(va, message);
+    log_rcu_enter();
+    log_log_va(log_current(), &site, 0, message, va);
+    log_rcu_exit();
+    va_end(va);
+}
+
+void __log_log_kv(logman_level level, const char* file, const char* func, const int line, const char* message,
+    const logman_kv* kv, size_t kv_count)
+{
+    if ((int)level < __atomic_load_n(&__log_min_level, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    logman_site site = { file, func, line, level, false, 0, NULL, false };
+    log_rcu_enter();
+    log_log_kv(log_current(), &site, message, kv, kv_count);
+    log_rcu_exit();
+}
+
+void __logman_log_site(logman_t* handle, logman_site* site, const char* message, ...)
+{
+    if ((int)site->level < __atomic_load_n(&handle->min_level, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    va_list va;
+    va_start(va, message);
+    log_log_va(handle, site, 0, message, va);
+    va_end(va);
+}
+
+void __logman_log_site_kv(logman_t* handle, logman_site* site, const char* message, const logman_kv* kv,
+    size_t kv_count)
+{
+    if ((int)site->level < __atomic_load_n(&handle->min_level, __ATOMIC_RELAXED)) {
+        return;
+    }
+    log_log_kv(handle, site, message, kv, kv_count);
+}
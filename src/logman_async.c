@@ -0,0 +1,209 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "logman_int.h"
+
+static size_t log_async_round_size(size_t size)
+{
+    size_t rounded = 2;
+    while (rounded < size) {
+        rounded <<= 1;
+    }
+    return rounded;
+}
+
+logman_error log_async_init(logman_async* async, size_t size, logman_writer sink)
+{
+    memset(async, 0, sizeof(*async));
+    size = log_async_round_size(size == 0 ? ASYNC_QUEUE_SIZE_DEFAULT : size);
+
+    async->slots = (logman_async_slot*)malloc(size * sizeof(logman_async_slot));
+    if (async->slots == NULL) {
+        return LOGERR_LOGASYNCINIT;
+    }
+    for (size_t i = 0; i < size; i++) {
+        async->slots[i].seq = i;
+    }
+    async->mask = size - 1;
+    async->sink = sink;
+    return LOGERR_NOERR;
+}
+
+// pool class of a spilled record, -1 for records past the largest class
+static int log_async_class(size_t len, size_t* size)
+{
+    int cls = 0;
+    *size = SPILL_BUF_SIZE_MIN;
+    while (*size < len) {
+        *size <<= 1;
+        cls++;
+    }
+    return (cls < ASYNC_POOL_CLASSES) ? cls : -1;
+}
+
+static char* log_async_large_get(logman_async* async, size_t len, int* cls)
+{
+    size_t size;
+    *cls = log_async_class(len, &size);
+    if (*cls >= 0) {
+        for (size_t i = 0; i < ASYNC_POOL_DEPTH; i++) {
+            char* large = __atomic_exchange_n(&async->pool[*cls][i], NULL, __ATOMIC_ACQUIRE);
+            if (large != NULL) {
+                return large;
+            }
+        }
+    }
+    return (char*)malloc(size);
+}
+
+static void log_async_large_put(logman_async* async, char* large, int cls)
+{
+    if (cls >= 0) {
+        for (size_t i = 0; i < ASYNC_POOL_DEPTH; i++) {
+            char* empty = NULL;
+            if (__atomic_compare_exchange_n(&async->pool[cls][i], &empty, large, false,
+                    __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+                return;
+            }
+        }
+    }
+    free(large);
+}
+
+bool log_async_push(logman_async* async, const char* buf, size_t len, logman_level level)
+{
+    return log_async_push_to(async, 0, buf, len, level);
+}
+
+/* Target 0 is the main writer, others are passed to the route callback. A record is
+ * dropped when the queue is full or no buffer could be had for a spilled record.
+ */
+bool log_async_push_to(logman_async* async, uint32_t target, const char* buf, size_t len, logman_level level)
+{
+    // records from the spill buffer do not fit the slot, the backend thread returns their buffer
+    char* large = NULL;
+    int large_class = -1;
+    if (len > MESSAGE_BUF_SIZE) {
+        large = log_async_large_get(async, len, &large_class);
+        if (large == NULL) {
+            __atomic_fetch_add(&async->dropped, 1, __ATOMIC_RELAXED);
+            return false;
+        }
+    }
+
+    logman_async_slot* slot;
+    size_t pos = __atomic_load_n(&async->enqueue_pos, __ATOMIC_RELAXED);
+    for (;;) {
+        slot = &async->slots[pos & async->mask];
+        size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&async->enqueue_pos, &pos, pos + 1, true,
+                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (diff < 0) {
+            if (large != NULL) {
+                log_async_large_put(async, large, large_class);
+            }
+            __atomic_fetch_add(&async->dropped, 1, __ATOMIC_RELAXED);
+            return false;
+        } else {
+            pos = __atomic_load_n(&async->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    slot->large = large;
+    slot->large_class = large_class;
+    memcpy((large != NULL) ? large : slot->buf, buf, len);
+    slot->len = len;
+    slot->level = level;
+    slot->target = target;
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+size_t log_async_drain(logman_async* async, size_t max)
+{
+    size_t count = 0;
+    while (count < max) {
+        size_t pos = async->dequeue_pos;
+        logman_async_slot* slot = &async->slots[pos & async->mask];
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1) {
+            break;
+        }
+
+        const char* buf = (slot->large != NULL) ? slot->large : slot->buf;
+        if (slot->target == 0) {
+            async->sink(async->owner, buf, slot->len, slot->level);
+        } else {
+            async->route(async->owner, slot->target, buf, slot->len, slot->level);
+        }
+        if (slot->large != NULL) {
+            log_async_large_put(async, slot->large, slot->large_class);
+        }
+        __atomic_store_n(&slot->seq, pos + async->mask + 1, __ATOMIC_RELEASE);
+        __atomic_store_n(&async->dequeue_pos, pos + 1, __ATOMIC_RELEASE);
+        count++;
+    }
+    return count;
+}
+
+void log_async_wait(logman_async* async)
+{
+    const struct timespec idle = { .tv_sec = 0, .tv_nsec = ASYNC_IDLE_SLEEP_NS };
+    size_t target = __atomic_load_n(&async->enqueue_pos, __ATOMIC_ACQUIRE);
+    while (async->running && __atomic_load_n(&async->dequeue_pos, __ATOMIC_ACQUIRE) < target) {
+        nanosleep(&idle, NULL);
+    }
+}
+
+static void* log_async_worker(void* arg)
+{
+    logman_async* async = (logman_async*)arg;
+    const struct timespec idle = { .tv_sec = 0, .tv_nsec = ASYNC_IDLE_SLEEP_NS };
+
+    for (;;) {
+        if (log_async_drain(async, ASYNC_BATCH_SIZE) != 0) {
+            continue;
+        }
+        if (__atomic_load_n(&async->stop, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        nanosleep(&idle, NULL);
+    }
+
+    // producers are gone by now, flush whatever was published after the last empty check
+    while (log_async_drain(async, ASYNC_BATCH_SIZE) != 0) {}
+    return NULL;
+}
+
+logman_error log_async_start(logman_async* async)
+{
+    if (pthread_create(&async->thread, NULL, log_async_worker, async) != 0) {
+        return LOGERR_LOGASYNCINIT;
+    }
+    async->running = true;
+    return LOGERR_NOERR;
+}
+
+void log_async_destruct(logman_async* async)
+{
+    if (async->running) {
+        __atomic_store_n(&async->stop, true, __ATOMIC_RELEASE);
+        pthread_join(async->thread, NULL);
+    } else if (async->slots != NULL) {
+        while (log_async_drain(async, ASYNC_BATCH_SIZE) != 0) {}
+    }
+
+    for (size_t cls = 0; cls < ASYNC_POOL_CLASSES; cls++) {
+        for (size_t i = 0; i < ASYNC_POOL_DEPTH; i++) {
+            free(async->pool[cls][i]);
+        }
+    }
+    free(async->slots);
+    memset(async, 0, sizeof(*async));
+}
@@ -0,0 +1,684 @@
+#include <ctype.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#include "logman_int.h"
+
+#define BINARY_VERSION     1
+
+size_t log_fmt_parse_spec(const char* fmt, logman_fmt_spec* spec)
+{
+    const char* p = fmt + 1;
+    memset(spec, 0, sizeof(*spec));
+    spec->prec = -1;
+
+    while (*p != '\0' && strchr("-+ #0'", *p) != NULL) {
+        p++;
+    }
+    if (*p == '*') {
+        spec->width_arg = true;
+        p++;
+    } else {
+        while (isdigit((unsigned char)*p)) {
+            p++;
+        }
+    }
+    if (*p == '.') {
+        p++;
+        spec->prec = 0;
+        if (*p == '*') {
+            spec->prec_arg = true;
+            p++;
+        } else {
+            while (isdigit((unsigned char)*p)) {
+                spec->prec = spec->prec * 10 + (*p++ - '0');
+            }
+        }
+    }
+
+    // 'q' stands for ll, glibc also accepts L for integers
+    char length = 0;
+    switch (*p) {
+        case 'h':
+            length = *p++;
+            if (*p == 'h') {
+                p++;
+            }
+            break;
+        case 'l':
+            length = *p++;
+            if (*p == 'l') {
+                length = 'q';
+                p++;
+            }
+            break;
+        case 'q':
+        case 'L':
+        case 'j':
+        case 'z':
+        case 't':
+            length = *p++;
+            break;
+        default:
+            break;
+    }
+
+    switch (*p) {
+        case 'd':
+        case 'i':
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            switch (length) {
+                case 'l': spec->type = LOGARG_LONG; break;
+                case 'q':
+                case 'L': spec->type = LOGARG_LLONG; break;
+                case 'j': spec->type = LOGARG_INTMAX; break;
+                case 'z': spec->type = LOGARG_SIZE; break;
+                case 't': spec->type = LOGARG_PTRDIFF; break;
+                default: spec->type = LOGARG_INT; break;
+            }
+            break;
+        case 'c':
+            spec->type = (length == 'l') ? LOGARG_WINT : LOGARG_INT;
+            break;
+        case 'C':
+            spec->type = LOGARG_WINT;
+            break;
+        case 's':
+            spec->type = (length == 'l') ? LOGARG_WSTRING : LOGARG_STRING;
+            break;
+        case 'S':
+            spec->type = LOGARG_WSTRING;
+            break;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            spec->type = (length == 'L') ? LOGARG_LDOUBLE : LOGARG_DOUBLE;
+            break;
+        case 'p':
+            spec->type = LOGARG_PTR;
+            break;
+        case 'n':
+            spec->type = LOGARG_COUNT;
+            break;
+        default:
+            // '%%' and conversions without an argument
+            spec->type = LOGARG_NONE;
+            break;
+    }
+    if (*p != '\0') {
+        p++;
+    }
+
+    spec->len = p - fmt;
+    return spec->len;
+}
+
+logman_error log_binary_init(logman_binary* bin)
+{
+    bin->sites = (logman_bin_site*)calloc(BINARY_SITES_MAX, sizeof(logman_bin_site));
+    if (bin->sites == NULL) {
+        return LOGERR_LOGBUFFINIT;
+    }
+    bin->sites_count = 0;
+    pthread_mutex_init(&bin->lock, NULL);
+    return LOGERR_NOERR;
+}
+
+void log_binary_destruct(logman_binary* bin)
+{
+    if (bin->sites == NULL) {
+        return;
+    }
+    pthread_mutex_destroy(&bin->lock);
+    for (uint32_t i = 0; i < BINARY_SITES_MAX; i++) {
+        if (bin->sites[i].ready && bin->sites[i].site == NULL) {
+            free(bin->sites[i].file);
+            free(bin->sites[i].func);
+        }
+    }
+    free(bin->sites);
+    bin->sites = NULL;
+    bin->sites_count = 0;
+}
+
+size_t log_binary_header(char* buf, logman_type type, logman_time_format format, logman_time_precision precision)
+{
+    memcpy(buf, BINARY_MAGIC, BINARY_MAGIC_LEN);
+    buf[BINARY_MAGIC_LEN] = BINARY_VERSION;
+    buf[BINARY_MAGIC_LEN + 1] = (char)type;
+    buf[BINARY_MAGIC_LEN + 2] = (char)format;
+    buf[BINARY_MAGIC_LEN + 3] = (char)precision;
+    return BINARY_HEADER_SIZE;
+}
+
+static uint32_t log_binary_mix(uint64_t h)
+{
+    h ^= h >> 29;
+    h *= 0xbf58476d1ce4e5b9ull;
+    h ^= h >> 32;
+    return (uint32_t)h & (BINARY_SITES_MAX - 1);
+}
+
+// persistent sites are keyed by their descriptor, the others by file, function and line
+static uint32_t log_binary_hash(const logman_site* site)
+{
+    if (site->persistent) {
+        return log_binary_mix((uint64_t)(uintptr_t)site);
+    }
+    uint64_t h = 14695981039346656037ull ^ ((uint64_t)(uint32_t)site->line * 2654435761u);
+    for (const char* p = site->file; *p != '\0'; p++) {
+        h = (h ^ (unsigned char)*p) * 1099511628211ull;
+    }
+    for (const char* p = site->func; *p != '\0'; p++) {
+        h = (h ^ (unsigned char)*p) * 1099511628211ull;
+    }
+    return log_binary_mix(h);
+}
+
+static bool log_binary_site_match(const logman_bin_site* entry, const logman_site* site)
+{
+    if (site->persistent) {
+        return entry->site == site;
+    }
+    return entry->site == NULL && entry->line == site->line && strcmp(entry->file, site->file) == 0 &&
+        strcmp(entry->func, site->func) == 0;
+}
+
+static size_t log_binary_site_entry(char* buf, uint32_t id, const char* file, uint16_t file_len, const char* func,
+    uint16_t func_len, int line, const char* fmt, uint32_t fmt_len)
+{
+    uint32_t line_val = (uint32_t)line;
+    buf[0] = BINARY_TAG_SITE;
+    memcpy(&buf[1], &id, sizeof(id));
+    memcpy(&buf[5], &line_val, sizeof(line_val));
+    memcpy(&buf[9], &file_len, sizeof(file_len));
+    memcpy(&buf[11], &func_len, sizeof(func_len));
+    memcpy(&buf[13], &fmt_len, sizeof(fmt_len));
+    memcpy(&buf[BINARY_SITE_HEAD_SIZE], file, file_len);
+    memcpy(&buf[BINARY_SITE_HEAD_SIZE + file_len], func, func_len);
+    memcpy(&buf[BINARY_SITE_HEAD_SIZE + file_len + func_len], fmt, fmt_len);
+    return BINARY_SITE_HEAD_SIZE + (size_t)file_len + func_len + fmt_len;
+}
+
+/* A persistent site passes the same format on every call. The others are matched by their
+ * contents and have to pass one fixed format, their strings are copied into the table.
+ */
+bool log_binary_site(logman_binary* bin, logman_src* obj, logman_bin_writer writer, const logman_site* site,
+    const char* fmt, uint32_t* id)
+{
+    uint32_t start = log_binary_hash(site);
+    for (uint32_t i = 0; i < BINARY_SITES_MAX; i++) {
+        logman_bin_site* entry = &bin->sites[(start + i) & (BINARY_SITES_MAX - 1)];
+        if (!__atomic_load_n(&entry->ready, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        if (log_binary_site_match(entry, site)) {
+            *id = entry->id;
+            return true;
+        }
+    }
+
+    bool found = false;
+    pthread_mutex_lock(&bin->lock);
+    for (uint32_t i = 0; i < BINARY_SITES_MAX && bin->sites_count < BINARY_SITES_MAX - 1; i++) {
+        logman_bin_site* entry = &bin->sites[(start + i) & (BINARY_SITES_MAX - 1)];
+        if (entry->ready) {
+            if (log_binary_site_match(entry, site)) {
+                *id = entry->id;
+                found = true;
+                break;
+            }
+            continue;
+        }
+
+        // the dictionary entry reaches the writer before any record can refer to it,
+        // it is written once per call site, so a format of any length gets its own buffer
+        uint16_t file_len = (uint16_t)strnlen(site->file, UINT16_MAX);
+        uint16_t func_len = (uint16_t)strnlen(site->func, UINT16_MAX);
+        uint32_t fmt_len = (uint32_t)strlen(fmt);
+        char* file = site->persistent ? (char*)site->file : strndup(site->file, file_len);
+        char* func = site->persistent ? (char*)site->func : strndup(site->func, func_len);
+        char* data = (char*)malloc(BINARY_SITE_HEAD_SIZE + (size_t)file_len + func_len + fmt_len);
+        bool written = false;
+        if (file != NULL && func != NULL && data != NULL) {
+            size_t len = log_binary_site_entry(data, bin->sites_count, site->file, file_len, site->func, func_len,
+                site->line, fmt, fmt_len);
+            written = writer(obj, data, len);
+        }
+        free(data);
+        // records may refer to the site only once its entry is in the file, a failed one is tried again
+        if (!written) {
+            if (!site->persistent) {
+                free(file);
+                free(func);
+            }
+            break;
+        }
+
+        entry->site = site->persistent ? site : NULL;
+        entry->file = file;
+        entry->func = func;
+        entry->line = site->line;
+        entry->id = bin->sites_count++;
+        __atomic_store_n(&entry->ready, true, __ATOMIC_RELEASE);
+        *id = entry->id;
+        found = true;
+        break;
+    }
+    pthread_mutex_unlock(&bin->lock);
+    return found;
+}
+
+// a fixed size argument that does not fit fails the record, it is still counted in need
+#define BINARY_PUT(type) \
+    do { \
+        type value = va_arg(va, type); \
+        need += sizeof(value); \
+        if (pos != 0 && pos + sizeof(value) <= size) { \
+            memcpy(&buf[pos], &value, sizeof(value)); \
+            pos += sizeof(value); \
+        } else { \
+            pos = 0; \
+        } \
+    } while (0)
+
+static size_t log_binary_put_bytes(char* buf, size_t size, size_t pos, const void* data, size_t len)
+{
+    if (pos == 0 || pos + sizeof(uint32_t) > size) {
+        return 0;
+    }
+    // strings are cut to what is left of the record
+    uint32_t cut = (uint32_t)((len > size - pos - sizeof(uint32_t)) ? size - pos - sizeof(uint32_t) : len);
+    memcpy(&buf[pos], &cut, sizeof(cut));
+    memcpy(&buf[pos + sizeof(cut)], data, cut);
+    return pos + sizeof(cut) + cut;
+}
+
+/* Returns the record length, 0 if it did not fit. need (if not NULL) receives the length
+ * of the record with no string cut, so a caller can encode it again into a larger buffer.
+ */
+size_t log_binary_encode(char* buf, size_t size, uint32_t id, logman_level level, uint64_t ts,
+    const char* fmt, va_list va, size_t* need_len)
+{
+    size_t pos = BINARY_RECORD_HEAD_SIZE;
+    size_t need = BINARY_RECORD_HEAD_SIZE;
+    for (const char* p = strchr(fmt, '%'); p != NULL; p = strchr(p, '%')) {
+        logman_fmt_spec spec;
+        p += log_fmt_parse_spec(p, &spec);
+
+        if (spec.width_arg) {
+            BINARY_PUT(int);
+        }
+        if (spec.prec_arg) {
+            int prec = va_arg(va, int);
+            need += sizeof(prec);
+            if (pos != 0 && pos + sizeof(prec) <= size) {
+                memcpy(&buf[pos], &prec, sizeof(prec));
+                pos += sizeof(prec);
+            } else {
+                pos = 0;
+            }
+            spec.prec = prec;
+        }
+
+        switch (spec.type) {
+            case LOGARG_INT: BINARY_PUT(int); break;
+            case LOGARG_LONG: BINARY_PUT(long); break;
+            case LOGARG_LLONG: BINARY_PUT(long long); break;
+            case LOGARG_INTMAX: BINARY_PUT(intmax_t); break;
+            case LOGARG_SIZE: BINARY_PUT(size_t); break;
+            case LOGARG_PTRDIFF: BINARY_PUT(ptrdiff_t); break;
+            case LOGARG_DOUBLE: BINARY_PUT(double); break;
+            case LOGARG_LDOUBLE: BINARY_PUT(long double); break;
+            case LOGARG_PTR: BINARY_PUT(void*); break;
+            case LOGARG_WINT: BINARY_PUT(wint_t); break;
+            case LOGARG_STRING: {
+                const char* str = va_arg(va, const char*);
+                if (str == NULL) {
+                    str = "(null)";
+                }
+                size_t len = (spec.prec >= 0) ? strnlen(str, spec.prec) : strlen(str);
+                need += sizeof(uint32_t) + len;
+                pos = log_binary_put_bytes(buf, size, pos, str, len);
+                break;
+            }
+            case LOGARG_WSTRING: {
+                const wchar_t* str = va_arg(va, const wchar_t*);
+                if (str == NULL) {
+                    str = L"(null)";
+                }
+                size_t len = wcslen(str) * sizeof(wchar_t);
+                need += sizeof(uint32_t) + len;
+                pos = log_binary_put_bytes(buf, size, pos, str, len);
+                break;
+            }
+            case LOGARG_COUNT:
+                (void)va_arg(va, void*);
+                break;
+            default:
+                break;
+        }
+        if (pos == 0 && need_len == NULL) {
+            return 0;
+        }
+    }
+    if (need_len != NULL) {
+        *need_len = need;
+    }
+    if (pos == 0) {
+        return 0;
+    }
+
+    uint32_t args_len = (uint32_t)(pos - BINARY_RECORD_HEAD_SIZE);
+    buf[0] = BINARY_TAG_RECORD;
+    memcpy(&buf[1], &id, sizeof(id));
+    buf[5] = (char)level;
+    memcpy(&buf[6], &ts, sizeof(ts));
+    memcpy(&buf[14], &args_len, sizeof(args_len));
+    return pos;
+}
+
+typedef struct logman_bin_dict {
+    const char* file;
+    const char* func;
+    const char* fmt;
+    uint16_t file_len;
+    uint16_t func_len;
+    uint32_t fmt_len;
+    uint32_t line;
+    bool defined;
+} logman_bin_dict;
+
+typedef struct logman_bin_reader {
+    const char* args;
+    size_t len;
+    size_t pos;
+    char* str;
+    size_t str_size;
+} logman_bin_reader;
+
+static bool log_binary_get(logman_bin_reader* rd, void* value, size_t size)
+{
+    if (rd->pos + size > rd->len) {
+        return false;
+    }
+    memcpy(value, &rd->args[rd->pos], size);
+    rd->pos += size;
+    return true;
+}
+
+// copies an inline string argument and terminates it with enough zero bytes for a wide string
+static const char* log_binary_get_str(logman_bin_reader* rd)
+{
+    uint32_t len;
+    if (!log_binary_get(rd, &len, sizeof(len)) || rd->pos + len > rd->len) {
+        return NULL;
+    }
+    if (rd->str_size < len + sizeof(wchar_t)) {
+        char* str = (char*)realloc(rd->str, len + sizeof(wchar_t));
+        if (str == NULL) {
+            return NULL;
+        }
+        rd->str = str;
+        rd->str_size = len + sizeof(wchar_t);
+    }
+    memcpy(rd->str, &rd->args[rd->pos], len);
+    memset(&rd->str[len], 0, sizeof(wchar_t));
+    rd->pos += len;
+    return rd->str;
+}
+
+#define BINARY_PRINT(value) \
+    do { \
+        if (spec.width_arg && spec.prec_arg) { \
+            fprintf(out, spec_buf, width, prec, value); \
+        } else if (spec.width_arg || spec.prec_arg) { \
+            fprintf(out, spec_buf, spec.width_arg ? width : prec, value); \
+        } else { \
+            fprintf(out, spec_buf, value); \
+        } \
+    } while (0)
+
+#define BINARY_GET_PRINT(type) \
+    do { \
+        type value; \
+        if (!log_binary_get(rd, &value, sizeof(value))) { \
+            return LOGERR_LOGBADFORMAT; \
+        } \
+        BINARY_PRINT(value); \
+    } while (0)
+
+static logman_error log_binary_render(FILE* out, const logman_bin_dict* site, logman_bin_reader* rd)
+{
+    const char* fmt = site->fmt;
+    const char* end = site->fmt + site->fmt_len;
+    while (fmt < end) {
+        const char* p = memchr(fmt, '%', end - fmt);
+        if (p == NULL) {
+            fwrite(fmt, sizeof(char), end - fmt, out);
+            break;
+        }
+        fwrite(fmt, sizeof(char), p - fmt, out);
+
+        logman_fmt_spec spec;
+        char spec_buf[64];
+        fmt = p + log_fmt_parse_spec(p, &spec);
+        if (spec.len >= sizeof(spec_buf)) {
+            return LOGERR_LOGBADFORMAT;
+        }
+        memcpy(spec_buf, p, spec.len);
+        spec_buf[spec.len] = '\0';
+
+        int width = 0;
+        int prec = 0;
+        if ((spec.width_arg && !log_binary_get(rd, &width, sizeof(width))) ||
+            (spec.prec_arg && !log_binary_get(rd, &prec, sizeof(prec)))) {
+            return LOGERR_LOGBADFORMAT;
+        }
+
+        switch (spec.type) {
+            case LOGARG_INT: BINARY_GET_PRINT(int); break;
+            case LOGARG_LONG: BINARY_GET_PRINT(long); break;
+            case LOGARG_LLONG: BINARY_GET_PRINT(long long); break;
+            case LOGARG_INTMAX: BINARY_GET_PRINT(intmax_t); break;
+            case LOGARG_SIZE: BINARY_GET_PRINT(size_t); break;
+            case LOGARG_PTRDIFF: BINARY_GET_PRINT(ptrdiff_t); break;
+            case LOGARG_DOUBLE: BINARY_GET_PRINT(double); break;
+            case LOGARG_LDOUBLE: BINARY_GET_PRINT(long double); break;
+            case LOGARG_PTR: BINARY_GET_PRINT(void*); break;
+            case LOGARG_WINT: BINARY_GET_PRINT(wint_t); break;
+            case LOGARG_STRING:
+            case LOGARG_WSTRING: {
+                const char* str = log_binary_get_str(rd);
+                if (str == NULL) {
+                    return LOGERR_LOGBADFORMAT;
+                }
+                if (spec.type == LOGARG_STRING) {
+                    BINARY_PRINT(str);
+                } else {
+                    BINARY_PRINT((const wchar_t*)str);
+                }
+                break;
+            }
+            case LOGARG_COUNT:
+                break;
+            default:
+                fputs(spec.len == 2 && p[1] == '%' ? "%" : spec_buf, out);
+                break;
+        }
+    }
+    return LOGERR_NOERR;
+}
+
+static char* log_binary_read_all(FILE* in, size_t* size)
+{
+    size_t cap = 1 << 16;
+    size_t len = 0;
+    char* data = (char*)malloc(cap);
+    while (data != NULL) {
+        len += fread(&data[len], sizeof(char), cap - len, in);
+        if (len < cap) {
+            break;
+        }
+        cap *= 2;
+        char* grown = (char*)realloc(data, cap);
+        if (grown == NULL) {
+            free(data);
+        }
+        data = grown;
+    }
+    *size = len;
+    return data;
+}
+
+// length of the complete entry at pos, 0 for an entry cut by the end of the file or with an unknown tag
+static size_t log_binary_entry_len(const char* data, size_t size, size_t pos)
+{
+    size_t len;
+    if (data[pos] == BINARY_TAG_RECORD) {
+        uint32_t args_len;
+        if (size - pos < BINARY_RECORD_HEAD_SIZE) {
+            return 0;
+        }
+        memcpy(&args_len, &data[pos + 14], sizeof(args_len));
+        len = BINARY_RECORD_HEAD_SIZE + (size_t)args_len;
+    } else if (data[pos] == BINARY_TAG_SITE) {
+        uint16_t file_len, func_len;
+        uint32_t fmt_len;
+        if (size - pos < BINARY_SITE_HEAD_SIZE) {
+            return 0;
+        }
+        memcpy(&file_len, &data[pos + 9], sizeof(file_len));
+        memcpy(&func_len, &data[pos + 11], sizeof(func_len));
+        memcpy(&fmt_len, &data[pos + 13], sizeof(fmt_len));
+        len = BINARY_SITE_HEAD_SIZE + (size_t)file_len + func_len + fmt_len;
+    } else {
+        return 0;
+    }
+    return (len > size - pos) ? 0 : len;
+}
+
+// a writer that did not finish leaves a cut entry or the zero padding of direct I/O behind,
+// the data ends before it and *end is set there
+static logman_error log_binary_load_sites(const char* data, size_t size, logman_bin_dict** sites, uint32_t* count,
+    size_t* end)
+{
+    size_t pos = BINARY_HEADER_SIZE;
+    size_t len;
+    while (pos < size && (len = log_binary_entry_len(data, size, pos)) != 0) {
+        if (data[pos] == BINARY_TAG_RECORD) {
+            pos += len;
+            continue;
+        }
+
+        logman_bin_dict site;
+        uint32_t id;
+        memcpy(&id, &data[pos + 1], sizeof(id));
+        if (id >= BINARY_SITES_MAX) {
+            break;
+        }
+        memcpy(&site.line, &data[pos + 5], sizeof(site.line));
+        memcpy(&site.file_len, &data[pos + 9], sizeof(site.file_len));
+        memcpy(&site.func_len, &data[pos + 11], sizeof(site.func_len));
+        memcpy(&site.fmt_len, &data[pos + 13], sizeof(site.fmt_len));
+        site.file = &data[pos + BINARY_SITE_HEAD_SIZE];
+        site.func = site.file + site.file_len;
+        site.fmt = site.func + site.func_len;
+        site.defined = true;
+        pos += len;
+
+        if (id >= *count) {
+            logman_bin_dict* grown = (logman_bin_dict*)realloc(*sites, (id + 1) * sizeof(logman_bin_dict));
+            if (grown == NULL) {
+                return LOGERR_LOGBUFFINIT;
+            }
+            memset(&grown[*count], 0, (id + 1 - *count) * sizeof(logman_bin_dict));
+            *sites = grown;
+            *count = id + 1;
+        }
+        (*sites)[id] = site;
+    }
+    *end = pos;
+    return LOGERR_NOERR;
+}
+
+logman_error log_binary_decode(FILE* in, FILE* out)
+{
+    size_t size;
+    char* data = log_binary_read_all(in, &size);
+    if (data == NULL) {
+        return LOGERR_LOGBUFFINIT;
+    }
+    if (size < BINARY_HEADER_SIZE || memcmp(data, BINARY_MAGIC, BINARY_MAGIC_LEN) != 0 ||
+        data[BINARY_MAGIC_LEN] != BINARY_VERSION) {
+        free(data);
+        return LOGERR_LOGBADFORMAT;
+    }
+    logman_type type = (logman_type)data[BINARY_MAGIC_LEN + 1];
+    logman_time_format format = (logman_time_format)data[BINARY_MAGIC_LEN + 2];
+    logman_time_precision precision = (logman_time_precision)data[BINARY_MAGIC_LEN + 3];
+
+    // sites are collected first, so the output does not depend on how writers interleaved
+    logman_bin_dict* sites = NULL;
+    uint32_t sites_count = 0;
+    size_t end = BINARY_HEADER_SIZE;
+    logman_error err = log_binary_load_sites(data, size, &sites, &sites_count, &end);
+
+    logman_time_cache cache;
+    memset(&cache, 0, sizeof(cache));
+    logman_bin_reader rd;
+    memset(&rd, 0, sizeof(rd));
+    char date_buf[DATE_BUF_SIZE];
+    size_t pos = BINARY_HEADER_SIZE;
+    while (err == LOGERR_NOERR && pos < end) {
+        if (data[pos] == BINARY_TAG_SITE) {
+            pos += log_binary_entry_len(data, end, pos);
+            continue;
+        }
+
+        uint32_t id;
+        uint64_t ts_ns;
+        uint32_t args_len;
+        uint8_t level = (uint8_t)data[pos + 5];
+        memcpy(&id, &data[pos + 1], sizeof(id));
+        memcpy(&ts_ns, &data[pos + 6], sizeof(ts_ns));
+        memcpy(&args_len, &data[pos + 14], sizeof(args_len));
+        rd.len = args_len;
+        rd.args = &data[pos + BINARY_RECORD_HEAD_SIZE];
+        rd.pos = 0;
+        pos += BINARY_RECORD_HEAD_SIZE + rd.len;
+        // a record whose site entry never made it to the file is skipped
+        if (id >= sites_count || !sites[id].defined || level >= LOGLEVEL_COUNT) {
+            continue;
+        }
+
+        const logman_bin_dict* site = &sites[id];
+        struct timespec ts = { .tv_sec = (time_t)(ts_ns / 1000000000ull), .tv_nsec = (long)(ts_ns % 1000000000ull) };
+        log_time_render(&cache, date_buf, &ts, format, precision);
+        if (type == LOGTYPE_PRODUCT) {
+            fprintf(out, "%s::%s::", date_buf, level_tag[level]);
+        } else {
+            fprintf(out, "%s::%s::%.*s::%.*s::%i::", date_buf, level_tag[level], site->file_len, site->file,
+                site->func_len, site->func, (int)site->line);
+        }
+        err = log_binary_render(out, site, &rd);
+        fputc('\n', out);
+    }
+
+    free(rd.str);
+    free(sites);
+    free(data);
+    return err;
+}
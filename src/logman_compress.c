@@ -0,0 +1,556 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "logman_int.h"
+
+#if LOGMAN_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#if LOGMAN_HAVE_LZ4
+#include <lz4.h>
+#endif
+
+#define LZ4_MAGIC              0x184D2204u
+#define LZ4_FLG                0x68    // version 01, independent blocks, content size
+#define LZ4_BD                 0x70    // 4 MiB blocks
+#define LZ4_BLOCK_MAX          (4 * 1024 * 1024)
+#define LZ4_FRAME_HEAD_SIZE    15
+#define LZ4_UNCOMPRESSED       0x80000000u
+#define LZ4_HASH_LOG           12
+#define LZ4_MIN_MATCH          4
+#define LZ4_LAST_LITERALS      5
+#define LZ4_MF_LIMIT           12
+#define LZ4_OFFSET_MAX         65535
+#define ZSTD_MAGIC             0xFD2FB528u
+
+#define XXH_PRIME1 2654435761u
+#define XXH_PRIME2 2246822519u
+#define XXH_PRIME3 3266489917u
+#define XXH_PRIME4 668265263u
+#define XXH_PRIME5 374761393u
+
+static inline uint32_t log_read32(const uint8_t* p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void log_write32_le(uint8_t* p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static inline uint32_t log_read32_le(const uint8_t* p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline uint32_t log_rotl32(uint32_t v, int r)
+{
+    return (v << r) | (v >> (32 - r));
+}
+
+static inline uint32_t log_xxh32_round(uint32_t acc, uint32_t in)
+{
+    return log_rotl32(acc + in * XXH_PRIME2, 13) * XXH_PRIME1;
+}
+
+// little endian hosts only, as the rest of the binary formats
+log_static uint32_t log_xxh32(const uint8_t* p, size_t len, uint32_t seed)
+{
+    const uint8_t* end = p + len;
+    uint32_t h;
+    if (len >= 16) {
+        uint32_t v1 = seed + XXH_PRIME1 + XXH_PRIME2;
+        uint32_t v2 = seed + XXH_PRIME2;
+        uint32_t v3 = seed;
+        uint32_t v4 = seed - XXH_PRIME1;
+        do {
+            v1 = log_xxh32_round(v1, log_read32(p));
+            v2 = log_xxh32_round(v2, log_read32(p + 4));
+            v3 = log_xxh32_round(v3, log_read32(p + 8));
+            v4 = log_xxh32_round(v4, log_read32(p + 12));
+            p += 16;
+        } while (p + 16 <= end);
+        h = log_rotl32(v1, 1) + log_rotl32(v2, 7) + log_rotl32(v3, 12) + log_rotl32(v4, 18);
+    } else {
+        h = seed + XXH_PRIME5;
+    }
+    h += (uint32_t)len;
+    for (; p + 4 <= end; p += 4) {
+        h = log_rotl32(h + log_read32(p) * XXH_PRIME3, 17) * XXH_PRIME4;
+    }
+    for (; p < end; p++) {
+        h = log_rotl32(h + *p * XXH_PRIME5, 11) * XXH_PRIME1;
+    }
+    h ^= h >> 15;
+    h *= XXH_PRIME2;
+    h ^= h >> 13;
+    h *= XXH_PRIME3;
+    h ^= h >> 16;
+    return h;
+}
+
+static uint8_t* log_lz4_length(uint8_t* op, size_t len)
+{
+    for (; len >= 255; len -= 255) {
+        *op++ = 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+// match_len 0 - the last sequence, literals only
+static uint8_t* log_lz4_sequence(uint8_t* op, const uint8_t* lit, size_t lit_len, size_t offset, size_t match_len)
+{
+    uint8_t* token = op++;
+    *token = (uint8_t)((lit_len >= 15 ? 15 : lit_len) << 4);
+    if (lit_len >= 15) {
+        op = log_lz4_length(op, lit_len - 15);
+    }
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+    if (match_len == 0) {
+        return op;
+    }
+
+    *op++ = (uint8_t)offset;
+    *op++ = (uint8_t)(offset >> 8);
+    size_t ml = match_len - LZ4_MIN_MATCH;
+    *token |= (uint8_t)(ml >= 15 ? 15 : ml);
+    if (ml >= 15) {
+        op = log_lz4_length(op, ml - 15);
+    }
+    return op;
+}
+
+/* Greedy single-probe LZ4 block encoder, used without liblz4. dst holds at least
+ * LOG_LZ4_BOUND(len) bytes, table 1 << LZ4_HASH_LOG entries.
+ */
+log_static size_t log_lz4_block(const uint8_t* src, size_t len, uint8_t* dst, uint32_t* table)
+{
+    const uint8_t* ip = src;
+    const uint8_t* anchor = src;
+    const uint8_t* end = src + len;
+    uint8_t* op = dst;
+
+    if (len > LZ4_MF_LIMIT) {
+        const uint8_t* mf_limit = end - LZ4_MF_LIMIT;
+        const uint8_t* match_limit = end - LZ4_LAST_LITERALS;
+        memset(table, 0, sizeof(uint32_t) << LZ4_HASH_LOG);
+        while (ip < mf_limit) {
+            uint32_t seq = log_read32(ip);
+            uint32_t h = (seq * XXH_PRIME1) >> (32 - LZ4_HASH_LOG);
+            const uint8_t* ref = src + table[h];
+            table[h] = (uint32_t)(ip - src);
+            if (ref >= ip || ip - ref > LZ4_OFFSET_MAX || log_read32(ref) != seq) {
+                // runs of literals are probed more sparsely
+                ip += 1 + ((size_t)(ip - anchor) >> 6);
+                continue;
+            }
+
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            const uint8_t* m = ip + LZ4_MIN_MATCH;
+            const uint8_t* r = ref + LZ4_MIN_MATCH;
+            while (m < match_limit && *m == *r) {
+                m++;
+                r++;
+            }
+            op = log_lz4_sequence(op, anchor, (size_t)(ip - anchor), (size_t)(ip - ref), (size_t)(m - ip));
+            ip = m;
+            anchor = ip;
+        }
+    }
+    op = log_lz4_sequence(op, anchor, (size_t)(end - anchor), 0, 0);
+    return (size_t)(op - dst);
+}
+
+static size_t log_lz4_data_block(logman_compressor* comp, const char* src, size_t len, uint8_t* dst)
+{
+#if LOGMAN_HAVE_LZ4
+    (void)comp;
+    int n = LZ4_compress_default(src, (char*)dst, (int)len, (int)LOG_LZ4_BOUND(len));
+    return (n > 0) ? (size_t)n : len;
+#else
+    return log_lz4_block((const uint8_t*)src, len, dst, comp->table);
+#endif
+}
+
+// one frame per buffer, with the content size so readers can skip it whole
+log_static size_t log_lz4_frame(logman_compressor* comp, const char* src, size_t len, uint8_t* dst)
+{
+    uint8_t* op = dst;
+    log_write32_le(op, LZ4_MAGIC);
+    op[4] = LZ4_FLG;
+    op[5] = LZ4_BD;
+    log_write32_le(&op[6], (uint32_t)len);
+    log_write32_le(&op[10], (uint32_t)((uint64_t)len >> 32));
+    op[14] = (uint8_t)(log_xxh32(&op[4], 10, 0) >> 8);
+    op += LZ4_FRAME_HEAD_SIZE;
+
+    for (size_t pos = 0; pos < len; ) {
+        size_t part = (len - pos < LZ4_BLOCK_MAX) ? len - pos : LZ4_BLOCK_MAX;
+        size_t n = log_lz4_data_block(comp, &src[pos], part, op + 4);
+        if (n >= part) {
+            // incompressible, stored as it is
+            memcpy(op + 4, &src[pos], part);
+            log_write32_le(op, (uint32_t)part | LZ4_UNCOMPRESSED);
+            n = part;
+        } else {
+            log_write32_le(op, (uint32_t)n);
+        }
+        op += 4 + n;
+        pos += part;
+    }
+    log_write32_le(op, 0);
+    return (size_t)(op + 4 - dst);
+}
+
+static size_t log_compress_bound(logman_compress codec, size_t len)
+{
+#if LOGMAN_HAVE_ZSTD
+    if (codec == LOGCOMPRESS_ZSTD) {
+        return ZSTD_compressBound(len);
+    }
+#endif
+    (void)codec;
+    size_t blocks = len / LZ4_BLOCK_MAX + 1;
+    return LZ4_FRAME_HEAD_SIZE + blocks * 4 + LOG_LZ4_BOUND(len) + 4;
+}
+
+static bool log_compress_block(logman_compressor* comp, const char* block, size_t len, int fd)
+{
+    size_t n = 0;
+#if LOGMAN_HAVE_ZSTD
+    if (comp->codec == LOGCOMPRESS_ZSTD) {
+        n = ZSTD_compressCCtx((ZSTD_CCtx*)comp->cctx, comp->out, comp->out_size, block, len, COMPRESS_ZSTD_LEVEL);
+        if (ZSTD_isError(n)) {
+            return false;
+        }
+    }
+#endif
+    if (comp->codec == LOGCOMPRESS_LZ4) {
+        n = log_lz4_frame(comp, block, len, (uint8_t*)comp->out);
+    }
+    return log_fd_write(fd, comp->out, n);
+}
+
+static void* log_compress_worker(void* arg)
+{
+    logman_compressor* comp = (logman_compressor*)arg;
+
+    pthread_mutex_lock(&comp->lock);
+    for (;;) {
+        if (comp->block != NULL) {
+            // the writers wait for the block to clear before handing over the next one
+            char* block = comp->block;
+            size_t len = comp->block_len;
+            int fd = comp->fd;
+            pthread_mutex_unlock(&comp->lock);
+            bool ok = log_compress_block(comp, block, len, fd);
+            pthread_mutex_lock(&comp->lock);
+            comp->failed = comp->failed || !ok;
+            comp->spare = block;
+            comp->block = NULL;
+            pthread_cond_broadcast(&comp->cond);
+            continue;
+        }
+        if (comp->stop) {
+            break;
+        }
+        pthread_cond_wait(&comp->cond, &comp->lock);
+    }
+    pthread_mutex_unlock(&comp->lock);
+    return NULL;
+}
+
+bool log_compress_available(logman_compress codec)
+{
+#if LOGMAN_HAVE_ZSTD
+    if (codec == LOGCOMPRESS_ZSTD) {
+        return true;
+    }
+#endif
+    return codec == LOGCOMPRESS_LZ4;
+}
+
+logman_compressor* log_compress_create(logman_compress codec, size_t block_size)
+{
+    logman_compressor* comp = (logman_compressor*)calloc(1, sizeof(logman_compressor));
+    if (comp == NULL) {
+        return NULL;
+    }
+    comp->codec = codec;
+    comp->out_size = log_compress_bound(codec, block_size);
+    comp->out = (char*)malloc(comp->out_size);
+    comp->spare = (char*)malloc(block_size);
+    comp->table = (uint32_t*)malloc(sizeof(uint32_t) << LZ4_HASH_LOG);
+#if LOGMAN_HAVE_ZSTD
+    comp->cctx = (codec == LOGCOMPRESS_ZSTD) ? ZSTD_createCCtx() : NULL;
+    bool cctx_ok = (codec != LOGCOMPRESS_ZSTD || comp->cctx != NULL);
+#else
+    bool cctx_ok = true;
+#endif
+    pthread_mutex_init(&comp->lock, NULL);
+    pthread_cond_init(&comp->cond, NULL);
+
+    if (comp->out == NULL || comp->spare == NULL || comp->table == NULL || !cctx_ok ||
+        pthread_create(&comp->worker, NULL, log_compress_worker, comp) != 0) {
+        comp->stop = true;
+        log_compress_destruct(comp);
+        return NULL;
+    }
+    comp->running = true;
+    return comp;
+}
+
+/* Hands the full buffer *data over to the worker and gives back the spare one.
+ * Waits while the previous block is still being compressed.
+ */
+bool log_compress_submit(logman_compressor* comp, int fd, char** data, size_t len)
+{
+    pthread_mutex_lock(&comp->lock);
+    while (comp->block != NULL) {
+        pthread_cond_wait(&comp->cond, &comp->lock);
+    }
+    comp->block = *data;
+    comp->block_len = len;
+    comp->fd = fd;
+    *data = comp->spare;
+    comp->spare = NULL;
+    bool ok = !comp->failed;
+    comp->failed = false;
+    pthread_cond_broadcast(&comp->cond);
+    pthread_mutex_unlock(&comp->lock);
+    return ok;
+}
+
+// returns once the submitted block is written out
+bool log_compress_wait(logman_compressor* comp)
+{
+    pthread_mutex_lock(&comp->lock);
+    while (comp->block != NULL) {
+        pthread_cond_wait(&comp->cond, &comp->lock);
+    }
+    bool ok = !comp->failed;
+    comp->failed = false;
+    pthread_mutex_unlock(&comp->lock);
+    return ok;
+}
+
+void log_compress_destruct(logman_compressor* comp)
+{
+    if (comp->running) {
+        pthread_mutex_lock(&comp->lock);
+        comp->stop = true;
+        pthread_cond_broadcast(&comp->cond);
+        pthread_mutex_unlock(&comp->lock);
+        pthread_join(comp->worker, NULL);
+    }
+#if LOGMAN_HAVE_ZSTD
+    ZSTD_freeCCtx((ZSTD_CCtx*)comp->cctx);
+#endif
+    pthread_cond_destroy(&comp->cond);
+    pthread_mutex_destroy(&comp->lock);
+    free(comp->table);
+    free(comp->spare);
+    free(comp->out);
+    free(comp);
+}
+
+static bool log_read_exact(FILE* in, void* buf, size_t len)
+{
+    return fread(buf, 1, len, in) == len;
+}
+
+log_static size_t log_lz4_unblock(const uint8_t* src, size_t len, uint8_t* dst, size_t cap)
+{
+    const uint8_t* ip = src;
+    const uint8_t* end = src + len;
+    uint8_t* op = dst;
+    while (ip < end) {
+        uint8_t token = *ip++;
+        size_t lit_len = token >> 4;
+        if (lit_len == 15) {
+            uint8_t b;
+            do {
+                if (ip >= end) {
+                    return SIZE_MAX;
+                }
+                b = *ip++;
+                lit_len += b;
+            } while (b == 255);
+        }
+        if (lit_len > (size_t)(end - ip) || lit_len > cap - (size_t)(op - dst)) {
+            return SIZE_MAX;
+        }
+        memcpy(op, ip, lit_len);
+        op += lit_len;
+        ip += lit_len;
+        if (ip == end) {
+            break;
+        }
+
+        if (end - ip < 2) {
+            return SIZE_MAX;
+        }
+        size_t offset = (size_t)ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        size_t match_len = token & 15;
+        if (match_len == 15) {
+            uint8_t b;
+            do {
+                if (ip >= end) {
+                    return SIZE_MAX;
+                }
+                b = *ip++;
+                match_len += b;
+            } while (b == 255);
+        }
+        match_len += LZ4_MIN_MATCH;
+        if (offset == 0 || offset > (size_t)(op - dst) || match_len > cap - (size_t)(op - dst)) {
+            return SIZE_MAX;
+        }
+        // overlapping copies repeat the last offset bytes
+        const uint8_t* ref = op - offset;
+        for (size_t i = 0; i < match_len; i++) {
+            op[i] = ref[i];
+        }
+        op += match_len;
+    }
+    return (size_t)(op - dst);
+}
+
+// the frames logman writes, independent blocks without dictionaries
+static logman_error log_lz4_decode_frame(FILE* in, FILE* out, uint8_t* src, uint8_t* dst)
+{
+    uint8_t head[LZ4_FRAME_HEAD_SIZE];
+    if (!log_read_exact(in, head, 2)) {
+        return LOGERR_LOGBADFORMAT;
+    }
+    uint8_t flg = head[0];
+    if ((flg >> 6) != 1 || (flg & 0x20) == 0 || (flg & 0x03) != 0 || ((head[1] >> 4) & 7) < 4) {
+        return LOGERR_LOGBADFORMAT;
+    }
+    size_t desc_len = 2 + ((flg & 0x08) ? 8 : 0);
+    if (!log_read_exact(in, &head[2], desc_len - 2 + 1) ||
+        (uint8_t)(log_xxh32(head, desc_len, 0) >> 8) != head[desc_len]) {
+        return LOGERR_LOGBADFORMAT;
+    }
+
+    for (;;) {
+        uint8_t word[4];
+        if (!log_read_exact(in, word, 4)) {
+            return LOGERR_LOGBADFORMAT;
+        }
+        uint32_t size = log_read32_le(word);
+        if (size == 0) {
+            break;
+        }
+        size_t len = size & ~LZ4_UNCOMPRESSED;
+        if (len > LZ4_BLOCK_MAX || !log_read_exact(in, src, len)) {
+            return LOGERR_LOGBADFORMAT;
+        }
+        if ((flg & 0x10) && !log_read_exact(in, word, 4)) {
+            return LOGERR_LOGBADFORMAT;
+        }
+        if (size & LZ4_UNCOMPRESSED) {
+            fwrite(src, 1, len, out);
+            continue;
+        }
+        size_t n = log_lz4_unblock(src, len, dst, LZ4_BLOCK_MAX);
+        if (n == SIZE_MAX) {
+            return LOGERR_LOGBADFORMAT;
+        }
+        fwrite(dst, 1, n, out);
+    }
+    uint8_t checksum[4];
+    if ((flg & 0x04) && !log_read_exact(in, checksum, 4)) {
+        return LOGERR_LOGBADFORMAT;
+    }
+    return LOGERR_NOERR;
+}
+
+#if LOGMAN_HAVE_ZSTD
+static logman_error log_zstd_decode(FILE* in, FILE* out, const uint8_t* magic)
+{
+    ZSTD_DCtx* dctx = ZSTD_createDCtx();
+    size_t in_size = ZSTD_DStreamInSize();
+    size_t out_size = ZSTD_DStreamOutSize();
+    char* src = (char*)malloc(in_size);
+    char* dst = (char*)malloc(out_size);
+    logman_error err = (dctx == NULL || src == NULL || dst == NULL) ? LOGERR_LOGBUFFINIT : LOGERR_NOERR;
+
+    size_t len = 4;
+    memcpy(src, magic, len);
+    size_t last = 0;
+    while (err == LOGERR_NOERR && (len += fread(&src[len], 1, in_size - len, in)) > 0) {
+        ZSTD_inBuffer input = { src, len, 0 };
+        while (input.pos < input.size) {
+            ZSTD_outBuffer output = { dst, out_size, 0 };
+            last = ZSTD_decompressStream(dctx, &output, &input);
+            if (ZSTD_isError(last)) {
+                err = LOGERR_LOGBADFORMAT;
+                break;
+            }
+            fwrite(dst, 1, output.pos, out);
+        }
+        len = 0;
+    }
+    // a frame cut short by a crash
+    if (err == LOGERR_NOERR && last != 0) {
+        err = LOGERR_LOGBADFORMAT;
+    }
+    ZSTD_freeDCtx(dctx);
+    free(src);
+    free(dst);
+    return err;
+}
+#endif
+
+/* Decompresses a file of LOGCOMPRESS_LZ4 or LOGCOMPRESS_ZSTD frames. Every frame
+ * up to a damaged one is written out.
+ */
+logman_error log_compress_decode(FILE* in, FILE* out)
+{
+    uint8_t magic[4];
+    if (!log_read_exact(in, magic, 4)) {
+        return LOGERR_LOGBADFORMAT;
+    }
+#if LOGMAN_HAVE_ZSTD
+    if (log_read32_le(magic) == ZSTD_MAGIC) {
+        return log_zstd_decode(in, out, magic);
+    }
+#endif
+    uint8_t* src = (uint8_t*)malloc(LZ4_BLOCK_MAX);
+    uint8_t* dst = (uint8_t*)malloc(LZ4_BLOCK_MAX);
+    logman_error err = (src == NULL || dst == NULL) ? LOGERR_LOGBUFFINIT : LOGERR_NOERR;
+    for (bool first = true; err == LOGERR_NOERR; first = false) {
+        if (!first && !log_read_exact(in, magic, 4)) {
+            break;
+        }
+        err = (log_read32_le(magic) == LZ4_MAGIC) ? log_lz4_decode_frame(in, out, src, dst) : LOGERR_LOGBADFORMAT;
+    }
+    free(src);
+    free(dst);
+    return err;
+}
+
+bool log_compress_magic(const char* data, size_t len)
+{
+    if (len < 4) {
+        return false;
+    }
+    uint32_t magic = log_read32_le((const uint8_t*)data);
+    return magic == LZ4_MAGIC || magic == ZSTD_MAGIC;
+}
@@ -0,0 +1,615 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logman_int.h"
+
+static bool log_filebuf_writev(int fd, struct iovec* iov, int iovcnt)
+{
+    logman_stats* stats = log_stats();
+    while (iovcnt > 0) {
+        ssize_t written = writev(fd, iov, iovcnt);
+        log_stat_add(&stats->write_calls, 1);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_stat_add(&stats->write_errors, 1);
+            return false;
+        }
+        // skip what went out on a short write
+        while (iovcnt > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char*)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return true;
+}
+
+bool log_fd_write(int fd, const char* buf, size_t len)
+{
+    struct iovec iov = { .iov_base = (void*)buf, .iov_len = len };
+    return log_filebuf_writev(fd, &iov, 1);
+}
+
+// records go straight to the descriptor, what stdio still holds goes out first
+int log_stream_fd(FILE* stream)
+{
+    fflush(stream);
+    return fileno(stream);
+}
+
+static bool log_filebuf_pwrite(logman_filebuf* fb, size_t len)
+{
+    logman_stats* stats = log_stats();
+    size_t done = 0;
+    while (done < len) {
+        ssize_t written = pwrite(fb->fd, &fb->data[done], len - done, fb->base + (off_t)done);
+        log_stat_add(&stats->write_calls, 1);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            log_stat_add(&stats->write_errors, 1);
+            return false;
+        }
+        done += (size_t)written;
+    }
+    return true;
+}
+
+// whole blocks move the base on, the padded partial block stays in the buffer
+static bool log_filebuf_flush_direct(logman_filebuf* fb)
+{
+    size_t whole = fb->used / fb->align * fb->align;
+    size_t len = (fb->used + fb->align - 1) / fb->align * fb->align;
+    memset(&fb->data[fb->used], 0, len - fb->used);
+    bool ok = log_filebuf_pwrite(fb, len);
+
+    memmove(fb->data, &fb->data[whole], fb->used - whole);
+    fb->base += (off_t)whole;
+    fb->used -= whole;
+    return ok;
+}
+
+static bool log_filebuf_flush_locked(logman_filebuf* fb)
+{
+    if (fb->used == 0) {
+        return true;
+    }
+    if (fb->align != 0) {
+        return log_filebuf_flush_direct(fb);
+    }
+    if (fb->comp != NULL) {
+        size_t used = fb->used;
+        fb->used = 0;
+        return log_compress_submit(fb->comp, fb->fd, &fb->data, used);
+    }
+    struct iovec iov = { .iov_base = fb->data, .iov_len = fb->used };
+    fb->used = 0;
+    return log_filebuf_writev(fb->fd, &iov, 1);
+}
+
+// the padding of the last block is cut off the file
+static bool log_filebuf_seal_direct(logman_filebuf* fb)
+{
+    bool ok = log_filebuf_flush_locked(fb);
+    ok = (ftruncate(fb->fd, fb->base + (off_t)fb->used) == 0) && ok;
+    fb->base = 0;
+    fb->used = 0;
+    return ok;
+}
+
+static void* log_filebuf_flusher(void* arg)
+{
+    logman_filebuf* fb = (logman_filebuf*)arg;
+
+    pthread_mutex_lock(&fb->lock);
+    while (!fb->stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += fb->interval_ms / 1000;
+        deadline.tv_nsec += (long)(fb->interval_ms % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&fb->cond, &fb->lock, &deadline);
+
+        if (!log_filebuf_flush_locked(fb)) {
+            fb->failed = true;
+        }
+    }
+    pthread_mutex_unlock(&fb->lock);
+    return NULL;
+}
+
+static void log_rotate_path(char* buf, size_t size, const char* path, unsigned int index)
+{
+    snprintf(buf, size, "%s.%u", path, index);
+}
+
+// <path>.<keep> is dropped, <path>.N moves to <path>.N+1, the retired file becomes <path>.1
+static void log_rotate_shift(logman_rotate* rot)
+{
+    size_t size = strlen(rot->path) + ROTATE_SUFFIX_SIZE;
+    char* from = (char*)malloc(size);
+    char* to = (char*)malloc(size);
+    if (from == NULL || to == NULL) {
+        free(from);
+        free(to);
+        return;
+    }
+
+    log_rotate_path(to, size, rot->path, rot->keep);
+    unlink(to);
+    for (unsigned int i = rot->keep; i > 1; i--) {
+        log_rotate_path(from, size, rot->path, i - 1);
+        log_rotate_path(to, size, rot->path, i);
+        rename(from, to);
+    }
+    log_rotate_path(to, size, rot->path, 1);
+    rename(rot->path, to);
+    snprintf(from, size, "%s" ROTATE_NEXT_SUFFIX, rot->path);
+    rename(from, rot->path);
+
+    free(from);
+    free(to);
+}
+
+static int log_rotate_open_next(logman_rotate* rot)
+{
+    size_t size = strlen(rot->path) + ROTATE_SUFFIX_SIZE;
+    char* next = (char*)malloc(size);
+    if (next == NULL) {
+        return -1;
+    }
+    snprintf(next, size, "%s" ROTATE_NEXT_SUFFIX, rot->path);
+    int fd = open(next, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    free(next);
+    return fd;
+}
+
+static void* log_rotate_worker(void* arg)
+{
+    logman_rotate* rot = (logman_rotate*)arg;
+
+    pthread_mutex_lock(&rot->lock);
+    for (;;) {
+        if (rot->retired_fd >= 0) {
+            int retired = rot->retired_fd;
+            rot->retired_fd = -1;
+            pthread_mutex_unlock(&rot->lock);
+            close(retired);
+            log_rotate_shift(rot);
+            pthread_mutex_lock(&rot->lock);
+            continue;
+        }
+        if (rot->stop) {
+            break;
+        }
+        if (__atomic_load_n(&rot->next_fd, __ATOMIC_ACQUIRE) < 0) {
+            pthread_mutex_unlock(&rot->lock);
+            int fd = log_rotate_open_next(rot);
+            pthread_mutex_lock(&rot->lock);
+            if (fd >= 0) {
+                __atomic_store_n(&rot->next_fd, fd, __ATOMIC_RELEASE);
+                continue;
+            }
+
+            // retry later, the writers keep using the current file meanwhile
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += 1;
+            pthread_cond_timedwait(&rot->cond, &rot->lock, &deadline);
+            continue;
+        }
+        pthread_cond_wait(&rot->cond, &rot->lock);
+    }
+    pthread_mutex_unlock(&rot->lock);
+    return NULL;
+}
+
+// called with fb->lock held, never waits for the worker
+static void log_rotate_switch(logman_filebuf* fb)
+{
+    logman_rotate* rot = &fb->rotate;
+    int next = __atomic_load_n(&rot->next_fd, __ATOMIC_ACQUIRE);
+    if (next < 0) {
+        return;
+    }
+    if (!((fb->align != 0) ? log_filebuf_seal_direct(fb) : log_filebuf_flush_locked(fb))) {
+        fb->failed = true;
+    }
+    // the worker may still write the last frame to the retired descriptor
+    if (fb->comp != NULL && !log_compress_wait(fb->comp)) {
+        fb->failed = true;
+    }
+    if (fb->align != 0 && fcntl(next, F_SETFL, (fcntl(next, F_GETFL) & ~O_APPEND) | O_DIRECT) != 0) {
+        fb->failed = true;
+    }
+
+    int retired = fb->fd;
+    fb->fd = next;
+    rot->file_size = 0;
+    rot->deadline = time(NULL) + rot->interval_s;
+    __atomic_store_n(&rot->next_fd, -1, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&rot->lock);
+    rot->retired_fd = retired;
+    pthread_cond_signal(&rot->cond);
+    pthread_mutex_unlock(&rot->lock);
+}
+
+logman_error log_filebuf_rotate(logman_filebuf* fb, const char* path, size_t max_size, unsigned int interval_s,
+    unsigned int keep)
+{
+    logman_rotate* rot = &fb->rotate;
+    rot->path = strdup(path);
+    if (rot->path == NULL) {
+        return LOGERR_LOGBUFFINIT;
+    }
+    struct stat st;
+    rot->file_size = (fstat(fb->fd, &st) == 0) ? (size_t)st.st_size : 0;
+    rot->max_size = max_size;
+    rot->interval_s = interval_s;
+    rot->deadline = time(NULL) + interval_s;
+    rot->keep = (keep == 0) ? ROTATE_KEEP_DEFAULT : keep;
+    rot->next_fd = -1;
+    rot->retired_fd = -1;
+    pthread_mutex_init(&rot->lock, NULL);
+    pthread_cond_init(&rot->cond, NULL);
+
+    if (pthread_create(&rot->worker, NULL, log_rotate_worker, rot) != 0) {
+        pthread_cond_destroy(&rot->cond);
+        pthread_mutex_destroy(&rot->lock);
+        free(rot->path);
+        rot->path = NULL;
+        return LOGERR_LOGBUFFINIT;
+    }
+    return LOGERR_NOERR;
+}
+
+static void log_rotate_destruct(logman_rotate* rot)
+{
+    if (rot->path == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&rot->lock);
+    rot->stop = true;
+    pthread_cond_signal(&rot->cond);
+    pthread_mutex_unlock(&rot->lock);
+    pthread_join(rot->worker, NULL);
+
+    if (rot->next_fd >= 0) {
+        close(rot->next_fd);
+        size_t size = strlen(rot->path) + ROTATE_SUFFIX_SIZE;
+        char* next = (char*)malloc(size);
+        if (next != NULL) {
+            snprintf(next, size, "%s" ROTATE_NEXT_SUFFIX, rot->path);
+            unlink(next);
+            free(next);
+        }
+    }
+    pthread_cond_destroy(&rot->cond);
+    pthread_mutex_destroy(&rot->lock);
+    free(rot->path);
+}
+
+logman_error log_filebuf_init(logman_filebuf* fb, int fd, size_t size, unsigned int interval_ms, bool flush_on_error)
+{
+    memset(fb, 0, sizeof(*fb));
+    fb->size = (size == 0) ? FILE_BUFFER_SIZE_DEFAULT : size;
+    fb->data = (char*)malloc(fb->size);
+    if (fb->data == NULL) {
+        return LOGERR_LOGBUFFINIT;
+    }
+    fb->fd = fd;
+    fb->interval_ms = interval_ms;
+    fb->flush_on_error = flush_on_error;
+    pthread_mutex_init(&fb->lock, NULL);
+    pthread_cond_init(&fb->cond, NULL);
+
+    if (interval_ms != 0) {
+        if (pthread_create(&fb->flusher, NULL, log_filebuf_flusher, fb) != 0) {
+            // the descriptor stays with the caller on failure
+            fb->fd = -1;
+            log_filebuf_destruct(fb);
+            return LOGERR_LOGBUFFINIT;
+        }
+        fb->flusher_running = true;
+    }
+    return LOGERR_NOERR;
+}
+
+/* Moves an open buffer to O_DIRECT mode. The descriptor must be readable to append:
+ * the partial block at the end of the file is read back into the buffer.
+ */
+logman_error log_filebuf_direct(logman_filebuf* fb, bool append)
+{
+    size_t size = (fb->size + FILE_DIRECT_ALIGN - 1) / FILE_DIRECT_ALIGN * FILE_DIRECT_ALIGN;
+    char* data = NULL;
+    if (posix_memalign((void**)&data, FILE_DIRECT_ALIGN, size) != 0) {
+        return LOGERR_LOGBUFFINIT;
+    }
+    free(fb->data);
+    fb->data = data;
+    fb->size = size;
+
+    struct stat st;
+    off_t end = (append && fstat(fb->fd, &st) == 0) ? st.st_size : 0;
+    off_t base = end / FILE_DIRECT_ALIGN * FILE_DIRECT_ALIGN;
+    // writes go to explicit offsets, O_APPEND would move them to the end of the file
+    if (fcntl(fb->fd, F_SETFL, (fcntl(fb->fd, F_GETFL) & ~O_APPEND) | O_DIRECT) != 0) {
+        return LOGERR_LOGFILECREATE;
+    }
+    if (end != base && pread(fb->fd, fb->data, FILE_DIRECT_ALIGN, base) < end - base) {
+        return LOGERR_LOGFILECREATE;
+    }
+    fb->base = base;
+    fb->used = (size_t)(end - base);
+    fb->align = FILE_DIRECT_ALIGN;
+    return LOGERR_NOERR;
+}
+
+/* Compresses the buffers of an open file buffer, every full buffer becomes a frame.
+ * The size is that of a frame, the buffer is reallocated for it.
+ */
+logman_error log_filebuf_compress(logman_filebuf* fb, logman_compress codec, size_t block_size)
+{
+    char* data = (char*)malloc(block_size);
+    if (data == NULL) {
+        return LOGERR_LOGBUFFINIT;
+    }
+    logman_compressor* comp = log_compress_create(codec, block_size);
+    if (comp == NULL) {
+        free(data);
+        return LOGERR_LOGCOMPRESS;
+    }
+    pthread_mutex_lock(&fb->lock);
+    free(fb->data);
+    fb->data = data;
+    fb->size = block_size;
+    fb->comp = comp;
+    pthread_mutex_unlock(&fb->lock);
+    return LOGERR_NOERR;
+}
+
+// the direct and compressed paths stage every byte in the buffer, a flush cuts it at its size
+static bool log_filebuf_write_staged(logman_filebuf* fb, const char* buf, size_t len, logman_level level)
+{
+    bool ok = true;
+    while (len > 0) {
+        size_t part = fb->size - fb->used;
+        part = (len < part) ? len : part;
+        memcpy(&fb->data[fb->used], buf, part);
+        fb->used += part;
+        buf += part;
+        len -= part;
+        if (fb->used == fb->size) {
+            ok = log_filebuf_flush_locked(fb) && ok;
+        }
+    }
+    if (fb->flush_on_error && level >= LOGLEVEL_ERROR) {
+        ok = log_filebuf_flush_locked(fb) && ok;
+    }
+    return ok;
+}
+
+bool log_filebuf_write(logman_filebuf* fb, const char* buf, size_t len, logman_level level)
+{
+    bool ok = true;
+    pthread_mutex_lock(&fb->lock);
+    if (fb->index != NULL && !log_index_add(fb->index, len, level)) {
+        fb->failed = true;
+    }
+    if (fb->align != 0 || fb->comp != NULL) {
+        ok = log_filebuf_write_staged(fb, buf, len, level);
+    } else if (fb->used + len > fb->size) {
+        // hand the buffered bytes and the record to the kernel in one call
+        struct iovec iov[2] = {
+            { .iov_base = fb->data, .iov_len = fb->used },
+            { .iov_base = (void*)buf, .iov_len = len },
+        };
+        fb->used = 0;
+        ok = log_filebuf_writev(fb->fd, iov, 2);
+    } else {
+        memcpy(&fb->data[fb->used], buf, len);
+        fb->used += len;
+        if (fb->used == fb->size || (fb->flush_on_error && level >= LOGLEVEL_ERROR)) {
+            ok = log_filebuf_flush_locked(fb);
+        }
+    }
+
+    if (fb->rotate.path != NULL) {
+        fb->rotate.file_size += len;
+        if ((fb->rotate.max_size != 0 && fb->rotate.file_size >= fb->rotate.max_size) ||
+            (fb->rotate.interval_s != 0 && time(NULL) >= fb->rotate.deadline)) {
+            log_rotate_switch(fb);
+        }
+    }
+    if (fb->failed) {
+        fb->failed = false;
+        ok = false;
+    }
+    pthread_mutex_unlock(&fb->lock);
+    return ok;
+}
+
+bool log_filebuf_flush(logman_filebuf* fb)
+{
+    pthread_mutex_lock(&fb->lock);
+    bool ok = log_filebuf_flush_locked(fb);
+    if (fb->comp != NULL) {
+        ok = log_compress_wait(fb->comp) && ok;
+    }
+    pthread_mutex_unlock(&fb->lock);
+    return ok;
+}
+
+bool log_filebuf_destruct(logman_filebuf* fb)
+{
+    if (fb->data == NULL) {
+        return true;
+    }
+    if (fb->flusher_running) {
+        pthread_mutex_lock(&fb->lock);
+        fb->stop = true;
+        pthread_cond_signal(&fb->cond);
+        pthread_mutex_unlock(&fb->lock);
+        pthread_join(fb->flusher, NULL);
+    }
+
+    bool ok = ((fb->align != 0) ? log_filebuf_seal_direct(fb) : log_filebuf_flush_locked(fb)) && !fb->failed;
+    if (fb->comp != NULL) {
+        ok = log_compress_wait(fb->comp) && ok;
+        log_compress_destruct(fb->comp);
+    }
+    if (fb->index != NULL) {
+        ok = log_index_destruct(fb->index) && ok;
+    }
+    log_rotate_destruct(&fb->rotate);
+    ok = (close(fb->fd) == 0) && ok;
+    pthread_cond_destroy(&fb->cond);
+    pthread_mutex_destroy(&fb->lock);
+    free(fb->data);
+    memset(fb, 0, sizeof(*fb));
+    return ok;
+}
+
+// maps the next chunk into the slot of a chunk that is full, called with the lock held
+static bool log_mmap_map_chunk(logman_mmap* mm)
+{
+    logman_mmap_chunk* chunk = &mm->chunk[mm->mapped % 2];
+    if (chunk->map != NULL) {
+        munmap(chunk->map, mm->chunk_size);
+        chunk->map = NULL;
+    }
+    off_t offset = (off_t)(mm->mapped * mm->chunk_size);
+    // preallocate the chunk so page faults never hit a hole on a full disk
+    if (posix_fallocate(mm->fd, offset, (off_t)mm->chunk_size) != 0) {
+        return false;
+    }
+    void* map = mmap(NULL, mm->chunk_size, PROT_READ | PROT_WRITE, MAP_SHARED, mm->fd, offset);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    chunk->map = (char*)map;
+    chunk->committed = 0;
+    __atomic_store_n(&mm->mapped, mm->mapped + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static bool log_mmap_map_upto(logman_mmap* mm, size_t index)
+{
+    pthread_mutex_lock(&mm->lock);
+    while (!mm->failed && mm->mapped <= index) {
+        logman_mmap_chunk* chunk = &mm->chunk[mm->mapped % 2];
+        if (chunk->map != NULL && __atomic_load_n(&chunk->committed, __ATOMIC_ACQUIRE) < mm->chunk_size) {
+            // writers of the chunk two back are still copying, some of them may wait here
+            // for a chunk that is mapped by now
+            pthread_mutex_unlock(&mm->lock);
+            sched_yield();
+            pthread_mutex_lock(&mm->lock);
+            continue;
+        }
+        mm->failed = !log_mmap_map_chunk(mm);
+    }
+    bool ok = !mm->failed;
+    pthread_mutex_unlock(&mm->lock);
+    return ok;
+}
+
+logman_error log_mmap_init(logman_mmap* mm, const char* file_name, size_t chunk_size)
+{
+    memset(mm, 0, sizeof(*mm));
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    chunk_size = (chunk_size == 0) ? MMAP_CHUNK_SIZE_DEFAULT : chunk_size;
+    mm->chunk_size = (chunk_size + page - 1) / page * page;
+
+    mm->fd = open(file_name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (mm->fd < 0) {
+        memset(mm, 0, sizeof(*mm));
+        return LOGERR_LOGFILECREATE;
+    }
+    if (!log_mmap_map_chunk(mm)) {
+        close(mm->fd);
+        memset(mm, 0, sizeof(*mm));
+        return LOGERR_LOGFILECREATE;
+    }
+    pthread_mutex_init(&mm->lock, NULL);
+    return LOGERR_NOERR;
+}
+
+bool log_mmap_write(logman_mmap* mm, const char* buf, size_t len)
+{
+    size_t offset = __atomic_fetch_add(&mm->pos, len, __ATOMIC_RELAXED);
+    while (len > 0) {
+        size_t index = offset / mm->chunk_size;
+        if (__atomic_load_n(&mm->mapped, __ATOMIC_ACQUIRE) <= index && !log_mmap_map_upto(mm, index)) {
+            return false;
+        }
+        // the chunk stays mapped until this writer commits its part
+        logman_mmap_chunk* chunk = &mm->chunk[index % 2];
+        size_t at = offset % mm->chunk_size;
+        size_t part = mm->chunk_size - at;
+        part = (len < part) ? len : part;
+        memcpy(&chunk->map[at], buf, part);
+        __atomic_fetch_add(&chunk->committed, part, __ATOMIC_RELEASE);
+        offset += part;
+        buf += part;
+        len -= part;
+    }
+    return true;
+}
+
+bool log_mmap_flush(logman_mmap* mm)
+{
+    pthread_mutex_lock(&mm->lock);
+    // start the write-back, the pages are already visible to readers of the file
+    bool ok = true;
+    for (size_t i = 0; i < 2; i++) {
+        if (mm->chunk[i].map != NULL) {
+            ok = (msync(mm->chunk[i].map, mm->chunk_size, MS_ASYNC) == 0) && ok;
+        }
+    }
+    pthread_mutex_unlock(&mm->lock);
+    return ok;
+}
+
+bool log_mmap_destruct(logman_mmap* mm)
+{
+    if (mm->chunk_size == 0) {
+        return true;
+    }
+    bool ok = true;
+    for (size_t i = 0; i < 2; i++) {
+        if (mm->chunk[i].map != NULL) {
+            munmap(mm->chunk[i].map, mm->chunk_size);
+        }
+    }
+    if (mm->fd >= 0) {
+        // drop the preallocated tail, ranges reserved past a chunk that failed to map were never written
+        size_t end = mm->mapped * mm->chunk_size;
+        end = (mm->pos < end) ? mm->pos : end;
+        ok = ftruncate(mm->fd, (off_t)end) == 0;
+        ok = (close(mm->fd) == 0) && ok;
+    }
+    pthread_mutex_destroy(&mm->lock);
+    memset(mm, 0, sizeof(*mm));
+    return ok;
+}
@@ -0,0 +1,352 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "logman_int.h"
+
+// the open block ends up in the index file, an empty one is not written
+static bool log_index_close(logman_index* ix)
+{
+    if (ix->entry.length == 0) {
+        return true;
+    }
+    bool ok = log_fd_write(ix->fd, (const char*)&ix->entry, sizeof(ix->entry));
+    memset(&ix->entry, 0, sizeof(ix->entry));
+    return ok;
+}
+
+logman_index* log_index_open(const char* path, int data_fd, bool append, size_t block_size)
+{
+    logman_index* ix = (logman_index*)calloc(1, sizeof(logman_index));
+    size_t size = strlen(path) + sizeof(INDEX_SUFFIX);
+    char* name = (char*)malloc(size);
+    if (ix == NULL || name == NULL) {
+        free(ix);
+        free(name);
+        return NULL;
+    }
+    snprintf(name, size, "%s" INDEX_SUFFIX, path);
+    ix->fd = open(name, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC | (append ? 0 : O_TRUNC), 0644);
+    free(name);
+
+    struct stat st;
+    bool ok = ix->fd >= 0 && fstat(ix->fd, &st) == 0;
+    // entries of an appended file go on from where the data ends
+    ix->offset = (ok && fstat(data_fd, &st) == 0) ? (uint64_t)st.st_size : 0;
+    if (ok && fstat(ix->fd, &st) == 0 && st.st_size == 0) {
+        ok = log_fd_write(ix->fd, INDEX_MAGIC, INDEX_MAGIC_LEN);
+    }
+    if (!ok) {
+        if (ix->fd >= 0) {
+            close(ix->fd);
+        }
+        free(ix);
+        return NULL;
+    }
+    ix->block_size = (block_size == 0) ? INDEX_BLOCK_SIZE_DEFAULT : block_size;
+    return ix;
+}
+
+// called under the lock of the file buffer, in the order the records reach the file
+bool log_index_add(logman_index* ix, size_t len, logman_level level)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+    bool ok = true;
+    if (ix->entry.length != 0 && (ix->entry.length >= ix->block_size || ts.tv_sec != ix->entry.first)) {
+        ok = log_index_close(ix);
+    }
+    if (ix->entry.length == 0) {
+        ix->entry.offset = ix->offset;
+        ix->entry.first = ts.tv_sec;
+    }
+    ix->entry.last = ts.tv_sec;
+    ix->entry.length += len;
+    ix->entry.count[level]++;
+    ix->offset += len;
+    return ok;
+}
+
+bool log_index_destruct(logman_index* ix)
+{
+    bool ok = log_index_close(ix);
+    ok = (close(ix->fd) == 0) && ok;
+    free(ix);
+    return ok;
+}
+
+static bool log_query_digits(const char* s, int n, int* value)
+{
+    *value = 0;
+    for (int i = 0; i < n; i++) {
+        if (s[i] < '0' || s[i] > '9') {
+            return false;
+        }
+        *value = *value * 10 + (s[i] - '0');
+    }
+    return true;
+}
+
+/* Reads "dd.mm.yyyy hh:mm:ss" in local time or "yyyy-mm-ddThh:mm:ss" in UTC, with
+ * an optional fraction and the Z of the latter. Returns the length read, 0 if none.
+ * With t NULL the text is only measured.
+ */
+size_t log_query_parse_time(const char* s, size_t len, time_t* t)
+{
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    bool iso = len >= 19 && s[4] == '-';
+    if (len < 19 || s[13] != ':' || s[16] != ':' ||
+        !log_query_digits(&s[11], 2, &tm.tm_hour) || !log_query_digits(&s[14], 2, &tm.tm_min) ||
+        !log_query_digits(&s[17], 2, &tm.tm_sec)) {
+        return 0;
+    }
+    if (iso) {
+        if (s[7] != '-' || s[10] != 'T' || !log_query_digits(s, 4, &tm.tm_year) ||
+            !log_query_digits(&s[5], 2, &tm.tm_mon) || !log_query_digits(&s[8], 2, &tm.tm_mday)) {
+            return 0;
+        }
+    } else if (s[2] != '.' || s[5] != '.' || s[10] != ' ' || !log_query_digits(s, 2, &tm.tm_mday) ||
+        !log_query_digits(&s[3], 2, &tm.tm_mon) || !log_query_digits(&s[6], 4, &tm.tm_year)) {
+        return 0;
+    }
+    if (t != NULL) {
+        tm.tm_year -= 1900;
+        tm.tm_mon -= 1;
+        tm.tm_isdst = -1;
+        *t = iso ? timegm(&tm) : mktime(&tm);
+    }
+
+    size_t pos = 19;
+    if (pos < len && s[pos] == '.') {
+        for (pos++; pos < len && s[pos] >= '0' && s[pos] <= '9'; pos++) {
+        }
+    }
+    if (iso && pos < len && s[pos] == 'Z') {
+        pos++;
+    }
+    return pos;
+}
+
+typedef struct logman_query_state {
+    const logman_query* query;
+    FILE* out;
+    // the last date text read and its time, records of one second share it
+    char date[DATE_PREFIX_LEN];
+    time_t time;
+    // lines without a date belong to the record before them
+    bool taken;
+} logman_query_state;
+
+static bool log_query_level(const char* p, const char* end, logman_level* level)
+{
+    for (int i = LOGLEVEL_COUNT - 1; i >= 0; i--) {
+        size_t len = strlen(level_tag[i]);
+        if ((size_t)(end - p) >= len && memcmp(p, level_tag[i], len) == 0) {
+            *level = (logman_level)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Date and level of a text, JSON or logfmt record line. The date follows the
+ * lead-in of the format, the level the separators and key after it.
+ */
+static bool log_query_record(logman_query_state* st, const char* line, const char* end, time_t* t,
+    logman_level* level)
+{
+    const char* p = line;
+    static const char* lead[] = { "{\"time\":\"", "time=\"", "time=" };
+    for (size_t i = 0; i < sizeof(lead) / sizeof(lead[0]); i++) {
+        size_t len = strlen(lead[i]);
+        if ((size_t)(end - p) >= len && memcmp(p, lead[i], len) == 0) {
+            p += len;
+            break;
+        }
+    }
+    if (end - p < DATE_PREFIX_LEN) {
+        return false;
+    }
+
+    // mktime() is the expensive part, it runs once per second of records
+    bool cached = memcmp(p, st->date, DATE_PREFIX_LEN) == 0;
+    size_t date_len = log_query_parse_time(p, (size_t)(end - p), cached ? NULL : &st->time);
+    if (date_len == 0) {
+        return false;
+    }
+    memcpy(st->date, p, DATE_PREFIX_LEN);
+    *t = st->time;
+
+    p += date_len;
+    while (p < end && strchr("\":,= ", *p) != NULL) {
+        p++;
+    }
+    if (end - p >= 5 && memcmp(p, "level", 5) == 0) {
+        for (p += 5; p < end && strchr("\":,= ", *p) != NULL; p++) {
+        }
+    }
+    return log_query_level(p, end, level);
+}
+
+// next newline at or after p, 16 bytes per step
+static const char* log_query_newline(const char* p, const char* end)
+{
+#if defined(__SSE2__)
+    const __m128i newline = _mm_set1_epi8('\n');
+    while (end - p >= 16) {
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), newline));
+        if (mask != 0) {
+            return p + __builtin_ctz((unsigned int)mask);
+        }
+        p += 16;
+    }
+#endif
+    const char* nl = (const char*)memchr(p, '\n', (size_t)(end - p));
+    return (nl != NULL) ? nl : end;
+}
+
+// check_time false - the whole block is known to be in the range
+static void log_query_block(logman_query_state* st, const char* data, size_t len, bool check_time)
+{
+    const logman_query* q = st->query;
+    const char* end = data + len;
+    const char* line = data;
+    while (line < end) {
+        const char* nl = log_query_newline(line, end);
+        const char* next = (nl < end) ? nl + 1 : end;
+        time_t t;
+        logman_level level;
+        if (log_query_record(st, line, nl, &t, &level)) {
+            st->taken = level >= q->min_level &&
+                (!check_time || (t >= q->from && (q->to == 0 || t <= q->to)));
+        }
+        if (st->taken) {
+            fwrite(line, 1, (size_t)(next - line), st->out);
+        }
+        line = next;
+    }
+}
+
+static bool log_query_block_levels(const logman_index_entry* entry, logman_level min_level)
+{
+    for (int i = min_level; i < LOGLEVEL_COUNT; i++) {
+        if (entry->count[i] != 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static logman_index_entry* log_query_load_index(const char* file_name, size_t* count)
+{
+    *count = 0;
+    size_t size = strlen(file_name) + sizeof(INDEX_SUFFIX);
+    char* name = (char*)malloc(size);
+    if (name == NULL) {
+        return NULL;
+    }
+    snprintf(name, size, "%s" INDEX_SUFFIX, file_name);
+    FILE* in = fopen(name, "rb");
+    free(name);
+    if (in == NULL) {
+        return NULL;
+    }
+
+    char magic[INDEX_MAGIC_LEN];
+    struct stat st;
+    logman_index_entry* entries = NULL;
+    if (fread(magic, 1, INDEX_MAGIC_LEN, in) == INDEX_MAGIC_LEN && memcmp(magic, INDEX_MAGIC, INDEX_MAGIC_LEN) == 0 &&
+        fstat(fileno(in), &st) == 0 && st.st_size > INDEX_MAGIC_LEN) {
+        size_t n = ((size_t)st.st_size - INDEX_MAGIC_LEN) / sizeof(logman_index_entry);
+        entries = (logman_index_entry*)malloc((n != 0 ? n : 1) * sizeof(logman_index_entry));
+        // an entry cut by a crash is left out
+        *count = (entries != NULL) ? fread(entries, sizeof(logman_index_entry), n, in) : 0;
+    }
+    fclose(in);
+    return entries;
+}
+
+/* Writes the records of file_name within the time range and at or above the level.
+ * Index entries are write times, records may be stamped up to INDEX_SLACK_S earlier.
+ * Without an index the whole file is scanned.
+ */
+logman_error log_index_query(const char* file_name, const logman_query* query, FILE* out)
+{
+    int fd = open(file_name, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return LOGERR_LOGFILECREATE;
+    }
+    size_t size = (size_t)st.st_size;
+    const char* data = NULL;
+    if (size != 0) {
+        data = (const char*)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return LOGERR_LOGBUFFINIT;
+        }
+    }
+    close(fd);
+
+    logman_query_state state;
+    memset(&state, 0, sizeof(state));
+    state.query = query;
+    state.out = out;
+    size_t count;
+    logman_index_entry* entries = log_query_load_index(file_name, &count);
+
+    // blocks end in time order, the first one that may hold the start of the range
+    size_t lo = 0;
+    size_t hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (entries[mid].last < (int64_t)query->from) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    uint64_t tail = (count != 0) ? entries[count - 1].offset + entries[count - 1].length : 0;
+    for (size_t i = lo; i < count; i++) {
+        const logman_index_entry* entry = &entries[i];
+        if (query->to != 0 && entry->first > (int64_t)query->to + INDEX_SLACK_S) {
+            tail = size;
+            break;
+        }
+        if (entry->offset >= size || !log_query_block_levels(entry, query->min_level)) {
+            state.taken = false;
+            continue;
+        }
+        size_t len = (entry->offset + entry->length > size) ? size - entry->offset : entry->length;
+        bool inside = entry->first - INDEX_SLACK_S >= (int64_t)query->from &&
+            (query->to == 0 || entry->last <= (int64_t)query->to);
+        size_t lead = entry->offset % (size_t)sysconf(_SC_PAGESIZE);
+        madvise((void*)&data[entry->offset - lead], len + lead, MADV_SEQUENTIAL);
+        log_query_block(&state, &data[entry->offset], len, !inside);
+    }
+    // records past the last entry, written after a crash or without an index
+    if (tail < size) {
+        state.taken = false;
+        log_query_block(&state, &data[tail], size - tail, true);
+    }
+
+    free(entries);
+    if (data != NULL) {
+        munmap((void*)data, size);
+    }
+    return LOGERR_NOERR;
+}
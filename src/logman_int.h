@@ -1,5 +1,11 @@
 #pragma once
 
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
 #include "../include/logman/logman.h"
 
 #if (defined(UTEST_BUILD) && UTEST_BUILD == 1)
@@ -9,20 +15,632 @@
 #endif
 
 #define DATE_BUF_SIZE      32
+#define DATE_PREFIX_LEN    19
 #define MESSAGE_BUF_SIZE   512
 #define INTERR_BUF_SIZE    128
+#define PREFIX_BUF_SIZE    256
+#define SPILL_BUF_SIZE_MIN (2 * MESSAGE_BUF_SIZE)
+#define MESSAGE_SIZE_MAX_DEFAULT (64 * 1024)
+#define KV_NUMBER_SIZE     32
+#define KV_CLOSE_SIZE      3
+#define SUPPRESSED_BUF_SIZE 40
+#define SINKS_MAX          LOGMAN_SINKS_MAX
 
+#define CACHE_LINE_SIZE    64
+
+#define BINARY_SITES_MAX       4096
+#define BINARY_MAGIC           "LOGMANB1"
+#define BINARY_MAGIC_LEN       8
+#define BINARY_HEADER_SIZE     12
+#define BINARY_TAG_SITE        'S'
+#define BINARY_TAG_RECORD      'R'
+#define BINARY_SITE_HEAD_SIZE  17
+#define BINARY_RECORD_HEAD_SIZE 18
+
+#define FILE_BUFFER_SIZE_DEFAULT   (64 * 1024)
+#define FILE_DIRECT_ALIGN          4096
+#define MMAP_CHUNK_SIZE_DEFAULT    (16 * 1024 * 1024)
+#define ROTATE_KEEP_DEFAULT        7
+#define ROTATE_NEXT_SUFFIX         ".next"
+#define ROTATE_SUFFIX_SIZE         16
+#define COMPRESS_BLOCK_DEFAULT     (1024 * 1024)
+#define INDEX_SUFFIX               ".idx"
+#define INDEX_MAGIC                "LOGMANI1"
+#define INDEX_MAGIC_LEN            8
+#define INDEX_BLOCK_SIZE_DEFAULT   (64 * 1024)
+#define INDEX_SLACK_S              2
+#define COMPRESS_ZSTD_LEVEL        3
+#define LOG_LZ4_BOUND(len)         ((len) + (len) / 255 + 16)
+
+#define SOCKET_BATCH_DEFAULT       64
+#define SOCKET_BUFFER_SIZE         (64 * 1024)
+#define SOCKET_FLUSH_MS_DEFAULT    100
+#define SOCKET_RECONNECT_MS        200
+#define SOCKET_POLL_MS             100
+#define SOCKET_SYSLOG_FACILITY     1
+#define SOCKET_SYSLOG_TAIL_SIZE    320
+#define SOCKET_SYSLOG_HEAD_MAX     40
+
+#define TRACE_EVENT_SIZE           1024
+
+#define CLOCK_CALIBRATE_NS         (2 * 1000 * 1000)
+#define CLOCK_RESYNC_MS            1000
+#define CLOCK_STEER_PPM            500
+#define CLOCK_STEP_NS              (1000 * 1000)
+#define CLOCK_RATE_WINDOW          64
+
+#define RECORDER_DATA_SIZE         200
+#define RECORDER_LINE_SIZE         1024
+
+#define ASYNC_QUEUE_SIZE_DEFAULT   1024
+#define ASYNC_BATCH_SIZE           64
+#define ASYNC_IDLE_SLEEP_NS        200000
+// spilled records reuse buffers of SPILL_BUF_SIZE_MIN << class bytes, larger ones are allocated
+#define ASYNC_POOL_CLASSES         7
+#define ASYNC_POOL_DEPTH           8
+
+typedef void (*logman_writer)(struct logman_src* obj, const char *buf, size_t len, logman_level level);
+// writes a call site entry of the binary output, which must not be dropped
+typedef bool (*logman_bin_writer)(struct logman_src* obj, const char *buf, size_t len);
+
+/* Second for which the date prefix in date_buf was rendered */
+typedef struct logman_time_cache {
+    time_t sec;
+    logman_time_format format;
+} logman_time_cache;
+
+/* Formatting buffers owned by a single thread, allocated on its first record
+ * and freed when the thread exits. Records that do not fit message_buf are
+ * formatted again into spill, which only grows in power of two steps.
+ */
+typedef struct logman_tls {
+    logman_time_cache date_cache;
+    char date_buf[DATE_BUF_SIZE];
+    char message_buf[MESSAGE_BUF_SIZE];
+    char* record;
+    char* spill;
+    size_t spill_size;
+    char* enc;
+    size_t enc_size;
+    size_t suppressed;
+} logman_tls;
+
+/* Record on its way to the outputs, either printf style (va) or structured (kv) */
+typedef struct logman_record {
+    logman_level level;
+    logman_site* site;
+    const char* message;
+    va_list* va;
+    const logman_kv* kv;
+    size_t kv_count;
+} logman_record;
+
+/* Output of the structured encoders. Writes past cap set full and are dropped,
+ * KV_CLOSE_SIZE bytes after cap stay for the record terminator.
+ */
+typedef struct logman_enc {
+    char* buf;
+    size_t len;
+    size_t cap;
+    bool full;
+} logman_enc;
+
+/* Storage class of a printf conversion, it tells how the argument is read from va_list */
+typedef enum {
+    LOGARG_NONE = 0,
+    LOGARG_INT,
+    LOGARG_LONG,
+    LOGARG_LLONG,
+    LOGARG_INTMAX,
+    LOGARG_SIZE,
+    LOGARG_PTRDIFF,
+    LOGARG_DOUBLE,
+    LOGARG_LDOUBLE,
+    LOGARG_PTR,
+    LOGARG_STRING,
+    LOGARG_WINT,
+    LOGARG_WSTRING,
+    LOGARG_COUNT,
+} logman_arg_type;
+
+typedef struct logman_fmt_spec {
+    size_t len;
+    int prec;
+    bool width_arg;
+    bool prec_arg;
+    logman_arg_type type;
+} logman_fmt_spec;
+
+// site is NULL for entries matched by contents, file and func are their own copies then
+typedef struct logman_bin_site {
+    const logman_site* site;
+    char* file;
+    char* func;
+    int line;
+    uint32_t id;
+    bool ready;
+} logman_bin_site;
+
+/* Call sites seen by the binary former. Lookups are lock-free, registration
+ * of a new site is serialized so its dictionary entry precedes its records.
+ */
+typedef struct logman_binary {
+    logman_bin_site* sites;
+    uint32_t sites_count;
+    pthread_mutex_t lock;
+} logman_binary;
+
+/* Rotation of the file output. The worker thread pre-opens <path>.next and does
+ * the renames, writers only swap the descriptor.
+ */
+typedef struct logman_rotate {
+    char* path;
+    size_t max_size;
+    unsigned int interval_s;
+    unsigned int keep;
+    size_t file_size;
+    time_t deadline;
+
+    int next_fd;
+    int retired_fd;
+    bool stop;
+    pthread_t worker;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} logman_rotate;
+
+/* Compression of the file output. A full buffer is swapped with the spare one, the
+ * worker thread turns it into a self-contained frame and writes it out.
+ */
+typedef struct logman_compressor {
+    logman_compress codec;
+    char* block;
+    size_t block_len;
+    int fd;
+    char* spare;
+    char* out;
+    size_t out_size;
+    uint32_t* table;
+    void* cctx;
+    bool failed;
+    bool stop;
+    bool running;
+    pthread_t worker;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} logman_compressor;
+
+/* Entry of the sidecar index: a block of records written within one second, in
+ * wall clock seconds of the writes. Stored as it is after INDEX_MAGIC.
+ */
+typedef struct logman_index_entry {
+    uint64_t offset;
+    uint64_t length;
+    int64_t first;
+    int64_t last;
+    uint32_t count[LOGLEVEL_COUNT];
+} logman_index_entry;
+
+typedef struct logman_index {
+    int fd;
+    size_t block_size;
+    uint64_t offset;
+    logman_index_entry entry;
+} logman_index;
+
+/* Range of log_index_query(), bounds included (to 0 - no upper bound) */
+typedef struct logman_query {
+    time_t from;
+    time_t to;
+    logman_level min_level;
+} logman_query;
+
+/* Datagram output, a record per datagram. Records are staged in data and go out in
+ * batches of up to batch messages with one sendmmsg() call. The socket is non-blocking,
+ * policy decides between dropping and waiting when it is full. A collector that went
+ * away is reconnected at most every SOCKET_RECONNECT_MS, fd is -1 until then.
+ */
+typedef struct logman_socket {
+    int fd;
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    logman_socket_policy policy;
+    bool flush_on_error;
+    bool lost;
+    uint64_t retry_ns;
+
+    char* data;
+    size_t size;
+    size_t used;
+    // every message has two parts: the syslog header and the record
+    struct mmsghdr* msgs;
+    struct iovec* iov;
+    size_t batch;
+    size_t count;
+
+    bool syslog;
+    char syslog_tail[SOCKET_SYSLOG_TAIL_SIZE];
+    size_t syslog_tail_len;
+
+    unsigned int interval_ms;
+    pthread_t flusher;
+    bool flusher_running;
+    bool stop;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} logman_socket;
+
+/* Write buffer of a file output, flushed with a single write(v) call. It owns the
+ * file descriptor. With align set the descriptor is in O_DIRECT mode: data is aligned,
+ * whole blocks go out at base with pwrite and the partial block at the end is written
+ * padded and kept, the next flush writes it over.
+ */
+typedef struct logman_filebuf {
+    char* data;
+    size_t size;
+    size_t used;
+    int fd;
+    bool flush_on_error;
+    bool failed;
+    size_t align;
+    off_t base;
+    logman_compressor* comp;
+    logman_index* index;
+
+    unsigned int interval_ms;
+    pthread_t flusher;
+    bool flusher_running;
+    bool stop;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    logman_rotate rotate;
+} logman_filebuf;
+
+typedef struct logman_mmap_chunk {
+    char* map;
+    // bytes copied in by the writers, the chunk is unmapped only once it is full
+    size_t committed;
+} logman_mmap_chunk;
+
+/* Window of the log file mapped for writing, moved forward chunk by chunk. Writers
+ * reserve their range with an atomic add on pos, the lock is taken only to map a
+ * chunk. Chunk n lives in chunk[n % 2] until chunk n + 2 is mapped.
+ */
+typedef struct logman_mmap {
+    int fd;
+    size_t chunk_size;
+    // end of the reserved bytes, an offset in the file
+    size_t pos;
+    // number of chunks mapped so far
+    size_t mapped;
+    bool failed;
+    logman_mmap_chunk chunk[2];
+    pthread_mutex_t lock;
+} logman_mmap;
+
+typedef struct logman_async_slot {
+    size_t seq;
+    size_t len;
+    logman_level level;
+    uint32_t target;
+    int large_class;
+    char* large;
+    char buf[MESSAGE_BUF_SIZE];
+} logman_async_slot;
+
+/* Bounded multi-producer/single-consumer ring drained by one backend thread.
+ * Producers and the consumer keep their positions on separate cache lines.
+ * Records larger than a slot go to buffers the backend hands back to pool,
+ * an empty pool entry is NULL and entries are taken and returned by atomic swaps.
+ */
+typedef struct logman_async {
+    logman_async_slot* slots;
+    size_t mask;
+    logman_writer sink;
+    void (*route)(struct logman_src* obj, uint32_t target, const char *buf, size_t len, logman_level level);
+    // instance passed to sink and route
+    struct logman_src* owner;
+    pthread_t thread;
+    bool running;
+    bool stop;
+
+    size_t enqueue_pos __attribute__((aligned(CACHE_LINE_SIZE)));
+    size_t dropped;
+
+    size_t dequeue_pos __attribute__((aligned(CACHE_LINE_SIZE)));
+
+    char* pool[ASYNC_POOL_CLASSES][ASYNC_POOL_DEPTH] __attribute__((aligned(CACHE_LINE_SIZE)));
+} logman_async;
+
+/* Record kept by the flight recorder: the format arguments as the binary former
+ * encodes them, or the text of a literal message. The owner thread keeps seq odd
+ * while it writes the slot, readers drop slots whose seq moved during their copy.
+ */
+typedef struct logman_recorder_slot {
+    size_t seq;
+    const char* file;
+    const char* func;
+    const char* fmt;
+    uint64_t ts;
+    int line;
+    logman_level level;
+    uint32_t len;
+    bool literal;
+    char data[RECORDER_DATA_SIZE];
+} logman_recorder_slot;
+
+/* Ring of the last records of one thread. Rings are never freed: a ring of an
+ * exited thread keeps its records until another thread takes it over.
+ */
+typedef struct logman_ring {
+    struct logman_ring* next;
+    size_t mask;
+    uint32_t generation;
+    bool released;
+    size_t head;
+    size_t dumped;
+    logman_recorder_slot slots[];
+} logman_ring;
+
+/* Additional output, records reach it already formatted */
+typedef struct logman_sink {
+    logman_output out_type;
+    FILE* out_stream;
+    int out_fd;
+    logman_filebuf filebuf;
+    logman_level min_level;
+    logman_format format;
+} logman_sink;
+
+/* Counters of one thread. Only the owner writes them, readers sum all blocks. */
+typedef struct logman_stats_block {
+    logman_stats stats;
+    struct logman_stats_block* next;
+} __attribute__((aligned(CACHE_LINE_SIZE))) logman_stats_block;
+
+extern __thread logman_stats_block* log_stats_local;
+logman_stats* log_stats_register(void);
+void log_stats_reset(void);
+void log_stats_latency(logman_stats* stats, unsigned long long ns);
+
+static inline logman_stats* log_stats(void)
+{
+    if (__builtin_expect(log_stats_local != NULL, 1)) {
+        return &log_stats_local->stats;
+    }
+    return log_stats_register();
+}
+
+/* Read side of the runtime reconfiguration. seq is odd while the thread may hold a
+ * pointer to the active configuration, log_rcu_synchronize() waits for the threads
+ * seen inside to leave. The writer makes the stores of seq visible with membarrier(),
+ * without it the readers pay a full fence.
+ */
+typedef struct logman_reader {
+    size_t seq;
+    size_t nest;
+    bool registered;
+    struct logman_reader* next;
+} __attribute__((aligned(CACHE_LINE_SIZE))) logman_reader;
+
+extern __thread logman_reader log_reader;
+extern bool log_rcu_fence;
+void log_reader_register(logman_reader* reader);
+void log_rcu_init(void);
+void log_rcu_synchronize(void);
+
+static inline void log_rcu_enter(void)
+{
+    logman_reader* r = &log_reader;
+    if (__builtin_expect(!r->registered, 0)) {
+        log_reader_register(r);
+    }
+    if (r->nest++ == 0) {
+        __atomic_store_n(&r->seq, r->seq + 1, __ATOMIC_RELAXED);
+        if (__atomic_load_n(&log_rcu_fence, __ATOMIC_RELAXED)) {
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        } else {
+            __atomic_signal_fence(__ATOMIC_SEQ_CST);
+        }
+    }
+}
+
+static inline void log_rcu_exit(void)
+{
+    logman_reader* r = &log_reader;
+    if (--r->nest == 0) {
+        __atomic_store_n(&r->seq, r->seq + 1, __ATOMIC_RELEASE);
+    }
+}
+
+// single writer, a plain increment published for the readers
+static inline void log_stat_add(unsigned long long* counter, unsigned long long value)
+{
+    __atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+#if defined(LOGMAN_STATS_TSC) && LOGMAN_STATS_TSC == 1
+ #if defined(__x86_64__) || defined(__i386__)
+  #include <x86intrin.h>
+  #define log_stats_cycles() __rdtsc()
+ #elif defined(__aarch64__)
+static inline unsigned long long log_stats_cycles(void)
+{
+    unsigned long long cnt;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(cnt));
+    return cnt;
+}
+ #else
+  #define log_stats_cycles() ((unsigned long long)clock())
+ #endif
+ #define LOG_STAGE_BEGIN(name) unsigned long long name = log_stats_cycles()
+ #define LOG_STAGE_END(name, stage) \
+    do { \
+        logman_stats* __stats = log_stats(); \
+        log_stat_add(&__stats->stage##_cycles, log_stats_cycles() - name); \
+        log_stat_add(&__stats->stage##_calls, 1); \
+    } while (0)
+#else
+ #define LOG_STAGE_BEGIN(name)
+ #define LOG_STAGE_END(name, stage)
+#endif
+
+/* Logger instance, log_obj is the default one. min_level leads the struct, the
+ * logman_* macros read it through the opaque handle.
+ */
 typedef struct logman_src {
+    int min_level;
     logman_output out_type;
     FILE* out_stream;
-    
-    char* date_buf;
-    char* message_buf;
-    
+    // descriptor of out_stream, records bypass stdio
+    int out_fd;
+    logman_format format;
+    logman_sink sinks[SINKS_MAX];
+    size_t sinks_count;
+
+    logman_time_precision time_precision;
+    logman_time_format time_format;
+    bool time_tsc;
+
+    size_t file_buffer_size;
+    unsigned int flush_interval_ms;
+    bool flush_on_error;
+    bool file_append;
+    bool file_direct;
+    logman_compress file_compress;
+    bool file_index;
+    size_t index_block_size;
+    size_t rotate_size;
+    unsigned int rotate_interval_s;
+    unsigned int rotate_keep;
+    size_t max_message_size;
+    bool stats_latency;
+    // records below out_level only reach the flight recorder
+    logman_level out_level;
+    size_t recorder_size;
+    logman_filebuf filebuf;
+    size_t mmap_chunk_size;
+    logman_mmap mmap;
+    size_t socket_batch;
+    logman_socket_policy socket_policy;
+    bool socket_syslog;
+    logman_socket* socket;
+    unsigned long long timer_threshold_ns;
+    // Chrome trace events of the timers, their times count from trace_base
+    logman_filebuf trace;
+    uint64_t trace_base;
+    // the trace array is continued from the replaced instance / closed by the next one
+    bool trace_resume;
+    bool trace_handed_over;
+
     char* err_message;
     void (*error_callback)(void);
 
-    void (*writer)(char *buf);
-    void (*message_former)(logman_level level, const char* file, const char* func, const int line, 
+    logman_writer writer;
+    size_t (*message_former)(struct logman_src* obj, logman_tls* tls, logman_level level, logman_site* site,
         const char* message, va_list va);
+
+    logman_async async;
+    logman_binary binary;
+    struct logman_src* next;
 } logman_src;
+
+#ifdef __cplusplus
+static_assert(offsetof(logman_src, min_level) == 0, "__logman_enabled reads min_level at the handle");
+#else
+_Static_assert(offsetof(logman_src, min_level) == 0, "__logman_enabled reads min_level at the handle");
+#endif
+
+void log_utoa_fixed(char* dst, uint32_t value, int width);
+size_t log_utoa(char* dst, uint64_t value);
+size_t log_time_render_utc(char* buf, uint64_t ns);
+void log_time_now(struct timespec* ts, logman_time_precision precision, bool tsc);
+size_t log_time_render(logman_time_cache* cache, char* buf, const struct timespec* ts,
+    logman_time_format format, logman_time_precision precision);
+
+/* Counter behind time_tsc and the timers, __log_clock_read() of the public header: the
+ * TSC where it is invariant (the generic timer on aarch64), CLOCK_MONOTONIC_RAW nanoseconds
+ * otherwise. log_clock_ns() maps a reading to wall clock nanoseconds with the calibration
+ * kept by the thread of log_clock_start(), log_clock_span_ns() a difference of readings.
+ */
+logman_error log_clock_start(void);
+void log_clock_stop(void);
+uint64_t log_clock_ns(uint64_t counter);
+void log_clock_span_init(void);
+uint64_t log_clock_span_ns(uint64_t ticks);
+
+static inline uint64_t log_clock_read(void)
+{
+    return __log_clock_read();
+}
+
+extern const char* level_tag[LOGLEVEL_COUNT];
+
+size_t log_fmt_parse_spec(const char* fmt, logman_fmt_spec* spec);
+logman_error log_binary_init(logman_binary* bin);
+void log_binary_destruct(logman_binary* bin);
+size_t log_binary_header(char* buf, logman_type type, logman_time_format format, logman_time_precision precision);
+bool log_binary_site(logman_binary* bin, logman_src* obj, logman_bin_writer writer, const logman_site* site,
+    const char* fmt, uint32_t* id);
+size_t log_binary_encode(char* buf, size_t size, uint32_t id, logman_level level, uint64_t ts,
+    const char* fmt, va_list va, size_t* need_len);
+logman_error log_binary_decode(FILE* in, FILE* out);
+
+size_t log_kv_bound(const logman_kv* kv, size_t count);
+void log_enc_fields(logman_enc* enc, const logman_kv* kv, size_t count);
+void log_enc_json(logman_enc* enc, const char* date, const logman_record* rec, const char* msg, size_t msg_len);
+void log_enc_logfmt(logman_enc* enc, const char* date, const logman_record* rec, const char* msg, size_t msg_len);
+void log_enc_trace(logman_enc* enc, const logman_site* site, const char* name, double ts_us, double dur_us,
+    long pid, long tid);
+
+logman_error log_recorder_init(size_t size, bool signals, bool tsc, int fd, logman_filebuf* pending);
+void log_recorder_output(int fd, logman_filebuf* pending);
+void log_recorder_destruct(void);
+void log_recorder_add(logman_level level, logman_site* site, const char* message, va_list* va);
+void log_recorder_dump(logman_src* obj, logman_writer writer);
+size_t log_recorder_render(char* buf, size_t size, const char* fmt, const char* args, size_t len);
+
+bool log_fd_write(int fd, const char* buf, size_t len);
+int log_stream_fd(FILE* stream);
+logman_error log_filebuf_init(logman_filebuf* fb, int fd, size_t size, unsigned int interval_ms, bool flush_on_error);
+logman_error log_filebuf_direct(logman_filebuf* fb, bool append);
+logman_error log_filebuf_rotate(logman_filebuf* fb, const char* path, size_t max_size, unsigned int interval_s,
+    unsigned int keep);
+bool log_filebuf_write(logman_filebuf* fb, const char* buf, size_t len, logman_level level);
+bool log_filebuf_flush(logman_filebuf* fb);
+bool log_filebuf_destruct(logman_filebuf* fb);
+logman_error log_filebuf_compress(logman_filebuf* fb, logman_compress codec, size_t block_size);
+
+bool log_compress_available(logman_compress codec);
+logman_compressor* log_compress_create(logman_compress codec, size_t block_size);
+bool log_compress_submit(logman_compressor* comp, int fd, char** data, size_t len);
+bool log_compress_wait(logman_compressor* comp);
+void log_compress_destruct(logman_compressor* comp);
+logman_error log_compress_decode(FILE* in, FILE* out);
+bool log_compress_magic(const char* data, size_t len);
+
+logman_index* log_index_open(const char* path, int data_fd, bool append, size_t block_size);
+bool log_index_add(logman_index* ix, size_t len, logman_level level);
+bool log_index_destruct(logman_index* ix);
+size_t log_query_parse_time(const char* s, size_t len, time_t* t);
+logman_error log_index_query(const char* file_name, const logman_query* query, FILE* out);
+
+logman_socket* log_socket_open(const char* address, size_t batch, logman_socket_policy policy, bool syslog,
+    unsigned int interval_ms, bool flush_on_error);
+bool log_socket_write(logman_socket* sock, const char* buf, size_t len, logman_level level);
+bool log_socket_flush(logman_socket* sock);
+bool log_socket_destruct(logman_socket* sock);
+
+logman_error log_mmap_init(logman_mmap* mm, const char* file_name, size_t chunk_size);
+bool log_mmap_write(logman_mmap* mm, const char* buf, size_t len);
+bool log_mmap_flush(logman_mmap* mm);
+bool log_mmap_destruct(logman_mmap* mm);
+
+logman_error log_async_init(logman_async* async, size_t size, logman_writer sink);
+logman_error log_async_start(logman_async* async);
+bool log_async_push(logman_async* async, const char* buf, size_t len, logman_level level);
+bool log_async_push_to(logman_async* async, uint32_t target, const char* buf, size_t len, logman_level level);
+void log_async_wait(logman_async* async);
+size_t log_async_drain(logman_async* async, size_t max);
+void log_async_destruct(logman_async* async);
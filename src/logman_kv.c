@@ -0,0 +1,362 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+    #include <immintrin.h>
+#endif
+
+#include "logman_int.h"
+
+static const char log_hex[] = "0123456789abcdef";
+
+/* Index of the first byte that is <= ctrl or equal to one of a, b, c. JSON strings
+ * stop at control characters, quotes and backslashes, logfmt values also at
+ * spaces and '=', the common case is a long run of plain bytes.
+ */
+static size_t log_kv_scan(const char* s, size_t len, unsigned char ctrl, char a, char b, char c)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256i ctrl32 = _mm256_set1_epi8((char)ctrl);
+    const __m256i a32 = _mm256_set1_epi8(a);
+    const __m256i b32 = _mm256_set1_epi8(b);
+    const __m256i c32 = _mm256_set1_epi8(c);
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)&s[i]);
+        // unsigned v <= ctrl
+        __m256i hit = _mm256_cmpeq_epi8(_mm256_max_epu8(v, ctrl32), ctrl32);
+        hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, a32));
+        hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, b32));
+        hit = _mm256_or_si256(hit, _mm256_cmpeq_epi8(v, c32));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(hit);
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i ctrl16 = _mm_set1_epi8((char)ctrl);
+    const __m128i a16 = _mm_set1_epi8(a);
+    const __m128i b16 = _mm_set1_epi8(b);
+    const __m128i c16 = _mm_set1_epi8(c);
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)&s[i]);
+        __m128i hit = _mm_cmpeq_epi8(_mm_max_epu8(v, ctrl16), ctrl16);
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, a16));
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, b16));
+        hit = _mm_or_si128(hit, _mm_cmpeq_epi8(v, c16));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(hit);
+        if (mask != 0) {
+            return i + __builtin_ctz(mask);
+        }
+    }
+#endif
+    for (; i < len; i++) {
+        unsigned char ch = (unsigned char)s[i];
+        if (ch <= ctrl || ch == (unsigned char)a || ch == (unsigned char)b || ch == (unsigned char)c) {
+            return i;
+        }
+    }
+    return len;
+}
+
+static bool log_enc_raw(logman_enc* enc, const char* s, size_t len)
+{
+    if (enc->full || enc->len + len > enc->cap) {
+        enc->full = true;
+        return false;
+    }
+    memcpy(&enc->buf[enc->len], s, len);
+    enc->len += len;
+    return true;
+}
+
+static bool log_enc_char(logman_enc* enc, char c)
+{
+    return log_enc_raw(enc, &c, 1);
+}
+
+/* Escaped string body without the quotes, cut when the encoder is out of room.
+ * room bytes past the content are kept for the caller.
+ */
+static void log_enc_escaped(logman_enc* enc, const char* s, size_t len, size_t room)
+{
+    if (enc->full || enc->len + room > enc->cap) {
+        enc->full = true;
+        return;
+    }
+    size_t cap = enc->cap - room;
+    size_t i = 0;
+    while (i < len) {
+        size_t run = log_kv_scan(&s[i], len - i, 0x1f, '"', '\\', '"');
+        if (enc->len + run > cap) {
+            run = cap - enc->len;
+            enc->full = true;
+        }
+        memcpy(&enc->buf[enc->len], &s[i], run);
+        enc->len += run;
+        i += run;
+        if (enc->full || i == len) {
+            return;
+        }
+
+        char esc[6] = { '\\', 0, '0', '0', 0, 0 };
+        size_t esc_len = 2;
+        unsigned char c = (unsigned char)s[i];
+        switch (c) {
+            case '"':  esc[1] = '"';  break;
+            case '\\': esc[1] = '\\'; break;
+            case '\n': esc[1] = 'n';  break;
+            case '\r': esc[1] = 'r';  break;
+            case '\t': esc[1] = 't';  break;
+            default:
+                esc[1] = 'u';
+                esc[4] = log_hex[c >> 4];
+                esc[5] = log_hex[c & 0xf];
+                esc_len = 6;
+                break;
+        }
+        if (enc->len + esc_len > cap) {
+            enc->full = true;
+            return;
+        }
+        memcpy(&enc->buf[enc->len], esc, esc_len);
+        enc->len += esc_len;
+        i++;
+    }
+}
+
+static bool log_enc_quoted(logman_enc* enc, const char* s, size_t len)
+{
+    if (enc->full || enc->len + 2 > enc->cap) {
+        enc->full = true;
+        return false;
+    }
+    enc->buf[enc->len++] = '"';
+    // the closing quote always fits, a cut value is still a valid string
+    log_enc_escaped(enc, s, len, 1);
+    enc->buf[enc->len++] = '"';
+    return true;
+}
+
+static size_t log_enc_int(char* dst, long long value)
+{
+    if (value < 0) {
+        dst[0] = '-';
+        return 1 + log_utoa(&dst[1], 0 - (uint64_t)value);
+    }
+    return log_utoa(dst, (uint64_t)value);
+}
+
+/* Fixed six decimals with trailing zeros dropped while the value is exact enough for it,
+ * printf for the rest.
+ */
+static size_t log_enc_double(char* dst, double value, bool json)
+{
+    if (!__builtin_isfinite(value)) {
+        if (json) {
+            memcpy(dst, "null", 4);
+            return 4;
+        }
+        return snprintf(dst, KV_NUMBER_SIZE, "%f", value);
+    }
+    double abs = (value < 0) ? -value : value;
+    if (abs >= 1e9 || (abs != 0 && abs < 1e-6)) {
+        return snprintf(dst, KV_NUMBER_SIZE, "%.17g", value);
+    }
+
+    uint64_t scaled = (uint64_t)(abs * 1e6 + 0.5);
+    uint64_t frac = scaled % 1000000;
+    size_t len = 0;
+    if (value < 0 && scaled != 0) {
+        dst[len++] = '-';
+    }
+    len += log_utoa(&dst[len], scaled / 1000000);
+    if (frac != 0) {
+        dst[len++] = '.';
+        log_utoa_fixed(&dst[len], (uint32_t)frac, 6);
+        len += 6;
+        while (dst[len - 1] == '0') {
+            len--;
+        }
+    }
+    return len;
+}
+
+static size_t log_enc_value(char* dst, const logman_kv* kv, bool json)
+{
+    switch (kv->type) {
+        case LOGKV_TYPE_INT:
+            return log_enc_int(dst, kv->value.i);
+        case LOGKV_TYPE_UINT:
+            return log_utoa(dst, kv->value.u);
+        case LOGKV_TYPE_DOUBLE:
+            return log_enc_double(dst, kv->value.d, json);
+        case LOGKV_TYPE_BOOL:
+            memcpy(dst, kv->value.b ? "true" : "false", kv->value.b ? 4 : 5);
+            return kv->value.b ? 4 : 5;
+        default:
+            return 0;
+    }
+}
+
+// logfmt value, quoted only when it would not survive unquoted
+static bool log_enc_logfmt_value(logman_enc* enc, const char* s, size_t len)
+{
+    if (len == 0 || log_kv_scan(s, len, ' ', '=', '"', '\\') != len) {
+        return log_enc_quoted(enc, s, len);
+    }
+    if (enc->full || enc->len >= enc->cap) {
+        enc->full = true;
+        return false;
+    }
+    if (enc->len + len > enc->cap) {
+        // a cut value is still a single token
+        len = enc->cap - enc->len;
+        enc->full = true;
+    }
+    memcpy(&enc->buf[enc->len], s, len);
+    enc->len += len;
+    return true;
+}
+
+size_t log_kv_bound(const logman_kv* kv, size_t count)
+{
+    size_t bound = 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t key = (kv[i].key != NULL) ? strlen(kv[i].key) : 0;
+        size_t value = (kv[i].type == LOGKV_TYPE_STR && kv[i].value.s != NULL) ?
+            strlen(kv[i].value.s) * 6 + 2 : KV_NUMBER_SIZE;
+        bound += key * 6 + 4 + value;
+    }
+    return bound;
+}
+
+/* " key=value" pairs appended to text and logfmt records. A field that does not fit
+ * is left out as a whole, except for string values which are cut.
+ */
+void log_enc_fields(logman_enc* enc, const logman_kv* kv, size_t count)
+{
+    for (size_t i = 0; i < count && !enc->full; i++) {
+        size_t start = enc->len;
+        const char* key = (kv[i].key != NULL) ? kv[i].key : "";
+        log_enc_char(enc, ' ');
+        log_enc_logfmt_value(enc, key, strlen(key));
+        log_enc_char(enc, '=');
+        if (!enc->full) {
+            if (kv[i].type == LOGKV_TYPE_STR) {
+                const char* value = (kv[i].value.s != NULL) ? kv[i].value.s : "(null)";
+                if (log_enc_logfmt_value(enc, value, strlen(value))) {
+                    continue;
+                }
+            } else {
+                char number[KV_NUMBER_SIZE];
+                if (log_enc_raw(enc, number, log_enc_value(number, &kv[i], false))) {
+                    continue;
+                }
+            }
+        }
+        enc->len = start;
+        enc->full = true;
+    }
+}
+
+// ,"key":value with the same rules as log_enc_fields
+static void log_enc_json_field(logman_enc* enc, const char* key, const logman_kv* kv, const char* str, size_t len)
+{
+    size_t start = enc->len;
+    log_enc_char(enc, ',');
+    log_enc_quoted(enc, key, strlen(key));
+    log_enc_char(enc, ':');
+    if (!enc->full) {
+        if (kv == NULL) {
+            if (log_enc_quoted(enc, str, len)) {
+                return;
+            }
+        } else {
+            char number[KV_NUMBER_SIZE];
+            if (log_enc_raw(enc, number, log_enc_value(number, kv, true))) {
+                return;
+            }
+        }
+    }
+    enc->len = start;
+    enc->full = true;
+}
+
+void log_enc_json(logman_enc* enc, const char* date, const logman_record* rec, const char* msg, size_t msg_len)
+{
+    logman_kv line_kv = __logkv_int("line", rec->site->line);
+
+    log_enc_raw(enc, "{\"time\":", 8);
+    log_enc_quoted(enc, date, strlen(date));
+    log_enc_json_field(enc, "level", NULL, level_tag[rec->level], strlen(level_tag[rec->level]));
+    log_enc_json_field(enc, "file", NULL, rec->site->file, strlen(rec->site->file));
+    log_enc_json_field(enc, "func", NULL, rec->site->func, strlen(rec->site->func));
+    log_enc_json_field(enc, "line", &line_kv, NULL, 0);
+    log_enc_json_field(enc, "msg", NULL, msg, msg_len);
+    for (size_t i = 0; i < rec->kv_count && !enc->full; i++) {
+        const logman_kv* kv = &rec->kv[i];
+        const char* key = (kv->key != NULL) ? kv->key : "";
+        if (kv->type == LOGKV_TYPE_STR) {
+            const char* value = (kv->value.s != NULL) ? kv->value.s : "(null)";
+            log_enc_json_field(enc, key, NULL, value, strlen(value));
+        } else {
+            log_enc_json_field(enc, key, kv, NULL, 0);
+        }
+    }
+
+    // KV_CLOSE_SIZE is kept for this
+    enc->buf[enc->len++] = '}';
+    enc->buf[enc->len++] = '\n';
+    enc->buf[enc->len] = '\0';
+}
+
+void log_enc_logfmt(logman_enc* enc, const char* date, const logman_record* rec, const char* msg, size_t msg_len)
+{
+    char line[KV_NUMBER_SIZE];
+
+    log_enc_raw(enc, "time=", 5);
+    log_enc_logfmt_value(enc, date, strlen(date));
+    log_enc_raw(enc, " level=", 7);
+    log_enc_raw(enc, level_tag[rec->level], strlen(level_tag[rec->level]));
+    log_enc_raw(enc, " file=", 6);
+    log_enc_logfmt_value(enc, rec->site->file, strlen(rec->site->file));
+    log_enc_raw(enc, " func=", 6);
+    log_enc_logfmt_value(enc, rec->site->func, strlen(rec->site->func));
+    log_enc_raw(enc, " line=", 6);
+    log_enc_raw(enc, line, log_enc_int(line, rec->site->line));
+    log_enc_raw(enc, " msg=", 5);
+    log_enc_quoted(enc, msg, msg_len);
+    log_enc_fields(enc, rec->kv, rec->kv_count);
+
+    enc->buf[enc->len++] = '\n';
+    enc->buf[enc->len] = '\0';
+}
+
+/* Complete event ("ph":"X") of the Chrome trace event format, times in microseconds.
+ * The event is followed by ",\n", the file is closed by a metadata event.
+ */
+void log_enc_trace(logman_enc* enc, const logman_site* site, const char* name, double ts_us, double dur_us,
+    long pid, long tid)
+{
+    char number[KV_NUMBER_SIZE];
+    logman_kv pid_kv = __logkv_int("pid", pid);
+    logman_kv tid_kv = __logkv_int("tid", tid);
+    logman_kv line_kv = __logkv_int("line", site->line);
+
+    log_enc_raw(enc, "{\"name\":", 8);
+    log_enc_quoted(enc, name, strlen(name));
+    log_enc_raw(enc, ",\"cat\":\"logman\",\"ph\":\"X\",\"ts\":", 30);
+    log_enc_raw(enc, number, log_enc_double(number, ts_us, true));
+    log_enc_raw(enc, ",\"dur\":", 7);
+    log_enc_raw(enc, number, log_enc_double(number, dur_us, true));
+    log_enc_json_field(enc, "pid", &pid_kv, NULL, 0);
+    log_enc_json_field(enc, "tid", &tid_kv, NULL, 0);
+    log_enc_raw(enc, ",\"args\":{\"file\":", 16);
+    log_enc_quoted(enc, site->file, strlen(site->file));
+    log_enc_json_field(enc, "func", NULL, site->func, strlen(site->func));
+    log_enc_json_field(enc, "line", &line_kv, NULL, 0);
+    log_enc_raw(enc, "}},\n", 4);
+}
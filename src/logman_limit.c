@@ -0,0 +1,57 @@
+#include <stdint.h>
+#include <time.h>
+
+#include "logman_int.h"
+
+static uint64_t log_limit_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static bool log_limit_suppress(logman_limit* limit)
+{
+    __atomic_fetch_add(&limit->suppressed, 1, __ATOMIC_RELAXED);
+    return false;
+}
+
+bool __log_limit_interval(logman_limit* limit, unsigned long long interval_ns)
+{
+    uint64_t now = log_limit_now();
+    unsigned long long next = __atomic_load_n(&limit->next, __ATOMIC_RELAXED);
+    if (now < next) {
+        return log_limit_suppress(limit);
+    }
+    // of the threads that see the same deadline pass only one moves it
+    if (!__atomic_compare_exchange_n(&limit->next, &next, now + interval_ns, false, __ATOMIC_RELAXED,
+        __ATOMIC_RELAXED)) {
+        return log_limit_suppress(limit);
+    }
+    return true;
+}
+
+/* Token bucket kept as a single timestamp: each record moves next one emission
+ * interval forward, a record passes while next stays within burst intervals of now.
+ */
+bool __log_limit_bucket(logman_limit* limit, double per_sec, size_t burst)
+{
+    if (per_sec <= 0.0 || burst == 0) {
+        return log_limit_suppress(limit);
+    }
+    uint64_t step = (uint64_t)(1e9 / per_sec);
+    uint64_t window = step * burst;
+    uint64_t now = log_limit_now();
+
+    unsigned long long next = __atomic_load_n(&limit->next, __ATOMIC_RELAXED);
+    do {
+        uint64_t start = (next > now) ? next : now;
+        if (start + step > now + window) {
+            return log_limit_suppress(limit);
+        }
+        if (__atomic_compare_exchange_n(&limit->next, &next, start + step, true, __ATOMIC_RELAXED,
+            __ATOMIC_RELAXED)) {
+            return true;
+        }
+    } while (true);
+}
@@ -0,0 +1,85 @@
+#include <linux/membarrier.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "logman_int.h"
+
+__thread logman_reader log_reader;
+// readers fence themselves until the first log_init() registers for membarrier()
+bool log_rcu_fence = true;
+
+static pthread_key_t log_reader_key;
+static pthread_once_t log_reader_once = PTHREAD_ONCE_INIT;
+static pthread_once_t log_rcu_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t log_reader_lock = PTHREAD_MUTEX_INITIALIZER;
+// readers of the running threads
+static logman_reader* log_readers;
+
+// runs before the thread local storage of the exiting thread goes away
+static void log_reader_unlink(void* arg)
+{
+    logman_reader* reader = (logman_reader*)arg;
+    pthread_mutex_lock(&log_reader_lock);
+    logman_reader** link = &log_readers;
+    while (*link != reader) {
+        link = &(*link)->next;
+    }
+    *link = reader->next;
+    pthread_mutex_unlock(&log_reader_lock);
+    reader->registered = false;
+}
+
+static void log_reader_key_create(void)
+{
+    pthread_key_create(&log_reader_key, log_reader_unlink);
+}
+
+void log_reader_register(logman_reader* reader)
+{
+    pthread_once(&log_reader_once, log_reader_key_create);
+    pthread_mutex_lock(&log_reader_lock);
+    reader->next = log_readers;
+    log_readers = reader;
+    pthread_mutex_unlock(&log_reader_lock);
+    pthread_setspecific(log_reader_key, reader);
+    reader->registered = true;
+}
+
+static void log_rcu_register(void)
+{
+    if (syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) == 0) {
+        __atomic_store_n(&log_rcu_fence, false, __ATOMIC_RELAXED);
+    }
+}
+
+void log_rcu_init(void)
+{
+    pthread_once(&log_rcu_once, log_rcu_register);
+}
+
+// pairs with the compiler-only fence of the readers
+static void log_rcu_barrier(void)
+{
+    if (__atomic_load_n(&log_rcu_fence, __ATOMIC_RELAXED) ||
+        syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0) != 0) {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+}
+
+/* Returns once every thread that was inside a read section when it was called has
+ * left it. The new configuration must be published before.
+ */
+void log_rcu_synchronize(void)
+{
+    log_rcu_barrier();
+    pthread_mutex_lock(&log_reader_lock);
+    for (logman_reader* reader = log_readers; reader != NULL; reader = reader->next) {
+        size_t seq = __atomic_load_n(&reader->seq, __ATOMIC_ACQUIRE);
+        while ((seq & 1) != 0 && __atomic_load_n(&reader->seq, __ATOMIC_ACQUIRE) == seq) {
+            sched_yield();
+        }
+    }
+    pthread_mutex_unlock(&log_reader_lock);
+    log_rcu_barrier();
+}
@@ -0,0 +1,538 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <wchar.h>
+
+#include "logman_int.h"
+
+/* Flight recorder: the last records of every thread, the ones below the output
+ * level included, kept unformatted in per-thread rings. The rings are rendered
+ * only when dumped, with code that is safe to run in a signal handler.
+ */
+
+// running rings first, published with release so the signal handler can walk the list
+static logman_ring* log_rings;
+static pthread_mutex_t log_rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t log_dump_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t log_ring_key;
+static pthread_once_t log_ring_once = PTHREAD_ONCE_INIT;
+
+// rings of an older log_init() are skipped and taken over
+static uint32_t log_recorder_gen;
+static size_t log_recorder_size;
+static int log_recorder_fd = -1;
+static logman_filebuf* log_recorder_pending;
+
+static bool log_recorder_signals;
+// slots hold log_clock_read() counters, converted to wall clock by the dump
+static bool log_recorder_tsc;
+static volatile sig_atomic_t log_recorder_crashed;
+static struct sigaction log_recorder_old_segv;
+static struct sigaction log_recorder_old_abrt;
+
+static __thread logman_ring* log_ring;
+static __thread uint32_t log_ring_gen;
+
+static void log_ring_release(void* arg)
+{
+    logman_ring* ring = (logman_ring*)arg;
+    pthread_mutex_lock(&log_rings_lock);
+    if (ring->generation == log_ring_gen) {
+        ring->released = true;
+    }
+    pthread_mutex_unlock(&log_rings_lock);
+    log_ring = NULL;
+}
+
+static void log_ring_key_create(void)
+{
+    pthread_key_create(&log_ring_key, log_ring_release);
+}
+
+static logman_ring* log_ring_acquire(uint32_t gen)
+{
+    pthread_once(&log_ring_once, log_ring_key_create);
+    pthread_mutex_lock(&log_rings_lock);
+    size_t size = log_recorder_size;
+    logman_ring* ring = log_rings;
+    while (ring != NULL && (ring->mask != size - 1 || (ring->generation == gen && !ring->released))) {
+        ring = ring->next;
+    }
+    if (ring != NULL) {
+        ring->head = 0;
+        ring->dumped = 0;
+        ring->released = false;
+        __atomic_store_n(&ring->generation, gen, __ATOMIC_RELEASE);
+    } else {
+        ring = (logman_ring*)calloc(1, sizeof(logman_ring) + size * sizeof(logman_recorder_slot));
+        if (ring != NULL) {
+            ring->mask = size - 1;
+            ring->generation = gen;
+            ring->next = log_rings;
+            __atomic_store_n(&log_rings, ring, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&log_rings_lock);
+
+    if (ring != NULL) {
+        pthread_setspecific(log_ring_key, ring);
+        log_ring = ring;
+        log_ring_gen = gen;
+    }
+    return ring;
+}
+
+/* Called by the owner thread only. va is NULL for a literal message. */
+void log_recorder_add(logman_level level, logman_site* site, const char* message, va_list* va)
+{
+    uint32_t gen = __atomic_load_n(&log_recorder_gen, __ATOMIC_RELAXED);
+    logman_ring* ring = (log_ring != NULL && log_ring_gen == gen) ? log_ring : log_ring_acquire(gen);
+    if (ring == NULL) {
+        return;
+    }
+
+    size_t pos = ring->head;
+    logman_recorder_slot* slot = &ring->slots[pos & ring->mask];
+    __atomic_store_n(&slot->seq, 2 * pos + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    if (log_recorder_tsc) {
+        slot->ts = log_clock_read();
+    } else {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        slot->ts = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    }
+    // a site on the stack is gone by the time of the dump
+    slot->file = site->file;
+    slot->func = site->func;
+    slot->line = site->line;
+    slot->level = level;
+    slot->fmt = NULL;
+    slot->len = 0;
+    // only a string literal format outlives the call, the dump may read it much later
+    if (va != NULL && site->persistent && site->literal) {
+        va_list copy;
+        va_copy(copy, *va);
+        slot->len = (uint32_t)log_binary_encode(slot->data, RECORDER_DATA_SIZE, 0, level, slot->ts, message, copy,
+            NULL);
+        va_end(copy);
+        slot->fmt = message;
+    }
+    // other messages and records whose arguments do not fit keep the text
+    slot->literal = slot->len == 0;
+    if (slot->literal && va != NULL) {
+        va_list copy;
+        va_copy(copy, *va);
+        int len = vsnprintf(slot->data, RECORDER_DATA_SIZE, message, copy);
+        va_end(copy);
+        slot->len = (uint32_t)((len < 0) ? 0 : (len >= RECORDER_DATA_SIZE) ? RECORDER_DATA_SIZE - 1 : len);
+    } else if (slot->literal) {
+        size_t len = strlen(message);
+        slot->len = (uint32_t)((len > RECORDER_DATA_SIZE) ? RECORDER_DATA_SIZE : len);
+        memcpy(slot->data, message, slot->len);
+    }
+
+    __atomic_store_n(&slot->seq, 2 * pos + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->head, pos + 1, __ATOMIC_RELEASE);
+}
+
+typedef struct logman_line {
+    char* buf;
+    size_t len;
+    size_t cap;
+} logman_line;
+
+static void log_line_put(logman_line* line, const char* data, size_t len)
+{
+    size_t room = line->cap - line->len;
+    len = (len > room) ? room : len;
+    memcpy(&line->buf[line->len], data, len);
+    line->len += len;
+}
+
+static void log_line_char(logman_line* line, char c)
+{
+    log_line_put(line, &c, 1);
+}
+
+static void log_line_uint(logman_line* line, uint64_t value, unsigned int base, bool upper)
+{
+    const char* digits = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    char tmp[24];
+    size_t pos = sizeof(tmp);
+    do {
+        tmp[--pos] = digits[value % base];
+        value /= base;
+    } while (value != 0);
+    log_line_put(line, &tmp[pos], sizeof(tmp) - pos);
+}
+
+static void log_line_double(logman_line* line, double value, int prec)
+{
+    if (value != value) {
+        log_line_put(line, "nan", 3);
+        return;
+    }
+    if (value < 0) {
+        log_line_char(line, '-');
+        value = -value;
+    }
+    if (value > 1.7976931348623157e308) {
+        log_line_put(line, "inf", 3);
+        return;
+    }
+
+    prec = (prec < 0) ? 6 : (prec > 9) ? 9 : prec;
+    int exp = 0;
+    while (value >= 1e18) {
+        value /= 10;
+        exp++;
+    }
+    uint32_t scale = 1;
+    for (int i = 0; i < prec; i++) {
+        scale *= 10;
+    }
+    uint64_t whole = (uint64_t)value;
+    uint64_t frac = (uint64_t)((value - (double)whole) * scale + 0.5);
+    if (frac >= scale) {
+        whole++;
+        frac -= scale;
+    }
+    log_line_uint(line, whole, 10, false);
+    if (prec > 0) {
+        char tmp[10];
+        log_utoa_fixed(tmp, (uint32_t)frac, prec);
+        log_line_char(line, '.');
+        log_line_put(line, tmp, prec);
+    }
+    if (exp != 0) {
+        log_line_put(line, "e+", 2);
+        log_line_uint(line, exp, 10, false);
+    }
+}
+
+#define RECORDER_GET(type) \
+    do { \
+        type value; \
+        if (pos + sizeof(value) > len) { \
+            return false; \
+        } \
+        memcpy(&value, &args[pos], sizeof(value)); \
+        pos += sizeof(value); \
+        arg = (int64_t)value; \
+        bits = sizeof(value) * 8; \
+    } while (0)
+
+/* printf conversions without the C library: flags and width are left out,
+ * floating point values come out in fixed notation.
+ */
+static bool log_recorder_format(logman_line* line, const char* fmt, const char* args, size_t len)
+{
+    size_t pos = BINARY_RECORD_HEAD_SIZE;
+    for (const char* p = fmt; *p != '\0';) {
+        const char* next = strchr(p, '%');
+        if (next == NULL) {
+            log_line_put(line, p, strlen(p));
+            break;
+        }
+        log_line_put(line, p, next - p);
+
+        logman_fmt_spec spec;
+        p = next + log_fmt_parse_spec(next, &spec);
+        char conv = next[spec.len - 1];
+        int64_t arg = 0;
+        int bits = 64;
+        if (spec.width_arg) {
+            RECORDER_GET(int);
+        }
+        if (spec.prec_arg) {
+            RECORDER_GET(int);
+            spec.prec = (int)arg;
+        }
+
+        switch (spec.type) {
+            case LOGARG_INT: RECORDER_GET(int); break;
+            case LOGARG_LONG: RECORDER_GET(long); break;
+            case LOGARG_LLONG: RECORDER_GET(long long); break;
+            case LOGARG_INTMAX: RECORDER_GET(intmax_t); break;
+            case LOGARG_SIZE: RECORDER_GET(size_t); break;
+            case LOGARG_PTRDIFF: RECORDER_GET(ptrdiff_t); break;
+            case LOGARG_PTR: RECORDER_GET(uintptr_t); break;
+            case LOGARG_WINT: RECORDER_GET(wint_t); break;
+            case LOGARG_DOUBLE:
+            case LOGARG_LDOUBLE: {
+                double value;
+                if (spec.type == LOGARG_LDOUBLE) {
+                    long double ld;
+                    if (pos + sizeof(ld) > len) {
+                        return false;
+                    }
+                    memcpy(&ld, &args[pos], sizeof(ld));
+                    pos += sizeof(ld);
+                    value = (double)ld;
+                } else {
+                    if (pos + sizeof(value) > len) {
+                        return false;
+                    }
+                    memcpy(&value, &args[pos], sizeof(value));
+                    pos += sizeof(value);
+                }
+                log_line_double(line, value, spec.prec);
+                continue;
+            }
+            case LOGARG_STRING:
+            case LOGARG_WSTRING: {
+                uint32_t str_len;
+                if (pos + sizeof(str_len) > len) {
+                    return false;
+                }
+                memcpy(&str_len, &args[pos], sizeof(str_len));
+                pos += sizeof(str_len);
+                if (pos + str_len > len) {
+                    return false;
+                }
+                if (spec.type == LOGARG_STRING) {
+                    log_line_put(line, &args[pos], str_len);
+                } else {
+                    log_line_char(line, '?');
+                }
+                pos += str_len;
+                continue;
+            }
+            case LOGARG_COUNT:
+                continue;
+            default:
+                if (conv == '%' && spec.len > 1) {
+                    log_line_char(line, '%');
+                } else {
+                    log_line_put(line, next, spec.len);
+                }
+                continue;
+        }
+
+        uint64_t value = (bits == 64) ? (uint64_t)arg : (uint64_t)arg & ((1ull << bits) - 1);
+        switch (conv) {
+            case 'd':
+            case 'i':
+                if (arg < 0) {
+                    log_line_char(line, '-');
+                }
+                log_line_uint(line, (arg < 0) ? 0 - (uint64_t)arg : (uint64_t)arg, 10, false);
+                break;
+            case 'c':
+                log_line_char(line, (char)arg);
+                break;
+            case 'o':
+                log_line_uint(line, value, 8, false);
+                break;
+            case 'x':
+            case 'X':
+                log_line_uint(line, value, 16, conv == 'X');
+                break;
+            case 'p':
+                log_line_put(line, "0x", 2);
+                log_line_uint(line, value, 16, false);
+                break;
+            default:
+                log_line_uint(line, value, 10, false);
+                break;
+        }
+    }
+    return true;
+}
+
+size_t log_recorder_render(char* buf, size_t size, const char* fmt, const char* args, size_t len)
+{
+    logman_line line = { buf, 0, size };
+    if (!log_recorder_format(&line, fmt, args, len)) {
+        log_line_put(&line, "<bad arguments>", 15);
+    }
+    return line.len;
+}
+
+static size_t log_recorder_line(char* buf, const logman_recorder_slot* slot)
+{
+    logman_line line = { buf, 0, RECORDER_LINE_SIZE - 1 };
+    line.len = log_time_render_utc(buf, log_recorder_tsc ? log_clock_ns(slot->ts) : slot->ts);
+    log_line_put(&line, "::", 2);
+    log_line_put(&line, level_tag[slot->level], strlen(level_tag[slot->level]));
+    log_line_put(&line, "::", 2);
+    log_line_put(&line, slot->file, strlen(slot->file));
+    log_line_put(&line, "::", 2);
+    log_line_put(&line, slot->func, strlen(slot->func));
+    log_line_put(&line, "::", 2);
+    log_line_uint(&line, (uint64_t)slot->line, 10, false);
+    log_line_put(&line, "::", 2);
+    if (slot->literal) {
+        log_line_put(&line, slot->data, slot->len);
+    } else if (!log_recorder_format(&line, slot->fmt, slot->data, slot->len)) {
+        log_line_put(&line, "<bad arguments>", 15);
+    }
+    buf[line.len++] = '\n';
+    return line.len;
+}
+
+/* Writes the records not dumped before, ring by ring. The rings are read without
+ * locks, records that change while they are copied are skipped.
+ */
+static void log_recorder_walk(logman_src* obj, logman_writer writer)
+{
+    char buf[RECORDER_LINE_SIZE];
+    uint32_t gen = __atomic_load_n(&log_recorder_gen, __ATOMIC_RELAXED);
+    size_t index = 0;
+    for (logman_ring* ring = __atomic_load_n(&log_rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next) {
+        if (__atomic_load_n(&ring->generation, __ATOMIC_ACQUIRE) != gen) {
+            continue;
+        }
+        size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        size_t start = __atomic_load_n(&ring->dumped, __ATOMIC_RELAXED);
+        if (head - start > ring->mask + 1) {
+            start = head - ring->mask - 1;
+        }
+        if (start >= head) {
+            continue;
+        }
+
+        logman_line header = { buf, 0, RECORDER_LINE_SIZE };
+        log_line_put(&header, "LOGMAN_RECENT::thread ", 22);
+        log_line_uint(&header, index++, 10, false);
+        log_line_char(&header, '\n');
+        writer(obj, buf, header.len, LOGLEVEL_DEBUG);
+
+        for (size_t pos = start; pos < head; pos++) {
+            const logman_recorder_slot* slot = &ring->slots[pos & ring->mask];
+            logman_recorder_slot copy;
+            size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+            memcpy(&copy, slot, sizeof(copy));
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (seq != 2 * pos + 2 || __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) {
+                continue;
+            }
+            writer(obj, buf, log_recorder_line(buf, &copy), copy.level);
+        }
+        __atomic_store_n(&ring->dumped, head, __ATOMIC_RELAXED);
+    }
+}
+
+void log_recorder_dump(logman_src* obj, logman_writer writer)
+{
+    if (log_recorder_size == 0) {
+        return;
+    }
+    pthread_mutex_lock(&log_dump_lock);
+    log_recorder_walk(obj, writer);
+    pthread_mutex_unlock(&log_dump_lock);
+}
+
+static void log_recorder_write_fd(logman_src* obj, const char* buf, size_t len, logman_level level)
+{
+    (void)obj;
+    (void)level;
+    while (len > 0) {
+        ssize_t written = write(log_recorder_fd, buf, len);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        buf += written;
+        len -= (size_t)written;
+    }
+}
+
+static void log_recorder_signal(int sig)
+{
+    int saved_errno = errno;
+    if (!log_recorder_crashed) {
+        log_recorder_crashed = 1;
+        // the crashed thread may hold the buffer lock, what is buffered goes out as it is
+        logman_filebuf* fb = log_recorder_pending;
+        if (fb != NULL && fb->data != NULL && fb->used <= fb->size) {
+            if (fb->align != 0) {
+                // plain writes from the end of the data on, the file keeps no padding
+                fcntl(fb->fd, F_SETFL, fcntl(fb->fd, F_GETFL) & ~O_DIRECT);
+                ftruncate(fb->fd, fb->base);
+                lseek(fb->fd, fb->base, SEEK_SET);
+            }
+            log_recorder_write_fd(NULL, fb->data, fb->used, LOGLEVEL_ERROR);
+            fb->used = 0;
+        }
+        log_recorder_walk(NULL, log_recorder_write_fd);
+    }
+    errno = saved_errno;
+
+    // the previous handler or the default action runs once this one returns
+    sigaction(sig, (sig == SIGSEGV) ? &log_recorder_old_segv : &log_recorder_old_abrt, NULL);
+    raise(sig);
+}
+
+logman_error log_recorder_init(size_t size, bool signals, bool tsc, int fd, logman_filebuf* pending)
+{
+    size_t rounded = 1;
+    while (rounded < size) {
+        rounded <<= 1;
+    }
+    log_recorder_size = rounded;
+    log_recorder_fd = fd;
+    log_recorder_pending = pending;
+    log_recorder_crashed = 0;
+    __atomic_add_fetch(&log_recorder_gen, 1, __ATOMIC_RELAXED);
+
+    if (signals) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = log_recorder_signal;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = SA_RESTART;
+        if (sigaction(SIGSEGV, &sa, &log_recorder_old_segv) != 0 ||
+            sigaction(SIGABRT, &sa, &log_recorder_old_abrt) != 0) {
+            return LOGERR_LOGRECORDERINIT;
+        }
+        log_recorder_signals = true;
+    }
+    // the recorder keeps its calibration for the dumps past a log_reconfigure()
+    if (tsc != log_recorder_tsc) {
+        if (tsc && log_clock_start() != LOGERR_NOERR) {
+            return LOGERR_LOGCLOCKINIT;
+        }
+        if (!tsc) {
+            log_clock_stop();
+        }
+        log_recorder_tsc = tsc;
+    }
+    return LOGERR_NOERR;
+}
+
+// the output of the crash dump moves along with the main output
+void log_recorder_output(int fd, logman_filebuf* pending)
+{
+    __atomic_store_n(&log_recorder_pending, pending, __ATOMIC_RELAXED);
+    __atomic_store_n(&log_recorder_fd, fd, __ATOMIC_RELAXED);
+}
+
+void log_recorder_destruct(void)
+{
+    if (log_recorder_signals) {
+        sigaction(SIGSEGV, &log_recorder_old_segv, NULL);
+        sigaction(SIGABRT, &log_recorder_old_abrt, NULL);
+        log_recorder_signals = false;
+    }
+    // threads still holding a ring of this generation take a new one on their next record
+    __atomic_add_fetch(&log_recorder_gen, 1, __ATOMIC_RELAXED);
+    log_recorder_size = 0;
+    log_recorder_fd = -1;
+    log_recorder_pending = NULL;
+    if (log_recorder_tsc) {
+        log_clock_stop();
+        log_recorder_tsc = false;
+    }
+}
@@ -0,0 +1,321 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "logman_int.h"
+
+// syslog severities of the logman levels
+static const int log_syslog_severity[LOGLEVEL_COUNT] = { 7, 6, 4, 3 };
+
+static uint64_t log_socket_clock(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// unix:<path> or udp:<host>:<port>, the host may be a bracketed IPv6 address
+static bool log_socket_resolve(logman_socket* sock, const char* address)
+{
+    if (strncmp(address, "unix:", 5) == 0) {
+        struct sockaddr_un* un = (struct sockaddr_un*)&sock->addr;
+        size_t len = strlen(&address[5]);
+        if (len == 0 || len >= sizeof(un->sun_path)) {
+            return false;
+        }
+        un->sun_family = AF_UNIX;
+        memcpy(un->sun_path, &address[5], len + 1);
+        sock->addr_len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + len + 1);
+        return true;
+    }
+    if (strncmp(address, "udp:", 4) != 0) {
+        return false;
+    }
+
+    const char* port = strrchr(&address[4], ':');
+    if (port == NULL || port == &address[4]) {
+        return false;
+    }
+    const char* host = &address[4];
+    size_t host_len = (size_t)(port - host);
+    if (host[0] == '[' && host[host_len - 1] == ']') {
+        host++;
+        host_len -= 2;
+    }
+    char* name = strndup(host, host_len);
+    if (name == NULL) {
+        return false;
+    }
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_NUMERICSERV;
+    struct addrinfo* res = NULL;
+    int rc = getaddrinfo(name, port + 1, &hints, &res);
+    free(name);
+    if (rc != 0 || res == NULL) {
+        return false;
+    }
+    bool ok = res->ai_addrlen <= sizeof(sock->addr);
+    if (ok) {
+        memcpy(&sock->addr, res->ai_addr, res->ai_addrlen);
+        sock->addr_len = res->ai_addrlen;
+    }
+    freeaddrinfo(res);
+    return ok;
+}
+
+static bool log_socket_connect(logman_socket* sock)
+{
+    uint64_t now = log_socket_clock(CLOCK_MONOTONIC);
+    if (now < sock->retry_ns) {
+        return false;
+    }
+    sock->retry_ns = now + (uint64_t)SOCKET_RECONNECT_MS * 1000000;
+
+    int fd = socket(sock->addr.ss_family, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return false;
+    }
+    if (connect(fd, (struct sockaddr*)&sock->addr, sock->addr_len) != 0) {
+        close(fd);
+        return false;
+    }
+    sock->fd = fd;
+    sock->lost = false;
+    return true;
+}
+
+// the first failure after the collector went away is reported, the outage is counted as drops
+static bool log_socket_lose(logman_socket* sock)
+{
+    if (sock->fd >= 0) {
+        close(sock->fd);
+        sock->fd = -1;
+        sock->retry_ns = log_socket_clock(CLOCK_MONOTONIC) + (uint64_t)SOCKET_RECONNECT_MS * 1000000;
+    }
+    bool reported = sock->lost;
+    sock->lost = true;
+    return reported;
+}
+
+static bool log_socket_send_locked(logman_socket* sock)
+{
+    if (sock->count == 0) {
+        return true;
+    }
+    logman_stats* stats = log_stats();
+    bool ok = true;
+    size_t sent = 0;
+    if (sock->fd < 0 && !log_socket_connect(sock)) {
+        ok = log_socket_lose(sock);
+    } else {
+        while (sent < sock->count) {
+            int n = sendmmsg(sock->fd, &sock->msgs[sent], (unsigned int)(sock->count - sent), MSG_DONTWAIT);
+            log_stat_add(&stats->write_calls, 1);
+            if (n > 0) {
+                sent += (size_t)n;
+                continue;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+                if (sock->policy == LOGSOCKET_DROP) {
+                    break;
+                }
+                struct pollfd pfd = { .fd = sock->fd, .events = POLLOUT, .revents = 0 };
+                poll(&pfd, 1, SOCKET_POLL_MS);
+                continue;
+            }
+            log_stat_add(&stats->write_errors, 1);
+            if (errno == EMSGSIZE) {
+                // the record does not fit a datagram, the rest of the batch goes on
+                ok = false;
+                sent++;
+                continue;
+            }
+            ok = log_socket_lose(sock);
+            break;
+        }
+    }
+    log_stat_add(&stats->dropped, sock->count - sent);
+    sock->count = 0;
+    sock->used = 0;
+    return ok;
+}
+
+static void* log_socket_flusher(void* arg)
+{
+    logman_socket* sock = (logman_socket*)arg;
+
+    pthread_mutex_lock(&sock->lock);
+    while (!sock->stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += sock->interval_ms / 1000;
+        deadline.tv_nsec += (long)(sock->interval_ms % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&sock->cond, &sock->lock, &deadline);
+        log_socket_send_locked(sock);
+    }
+    pthread_mutex_unlock(&sock->lock);
+    return NULL;
+}
+
+// " HOSTNAME APP-NAME PROCID MSGID STRUCTURED-DATA " after the timestamp
+static void log_socket_syslog_tail(logman_socket* sock)
+{
+    char host[256];
+    if (gethostname(host, sizeof(host)) != 0 || host[0] == '\0') {
+        strcpy(host, "-");
+    }
+    host[sizeof(host) - 1] = '\0';
+    int len = snprintf(sock->syslog_tail, sizeof(sock->syslog_tail), " %s %.48s %d - - ", host,
+        program_invocation_short_name[0] != '\0' ? program_invocation_short_name : "-", (int)getpid());
+    sock->syslog_tail_len = (len < 0 || (size_t)len >= sizeof(sock->syslog_tail)) ? 0 : (size_t)len;
+}
+
+logman_socket* log_socket_open(const char* address, size_t batch, logman_socket_policy policy, bool syslog,
+    unsigned int interval_ms, bool flush_on_error)
+{
+    if (address == NULL) {
+        return NULL;
+    }
+    logman_socket* sock = (logman_socket*)calloc(1, sizeof(logman_socket));
+    if (sock == NULL) {
+        return NULL;
+    }
+    sock->fd = -1;
+    sock->batch = (batch == 0) ? SOCKET_BATCH_DEFAULT : batch;
+    sock->size = SOCKET_BUFFER_SIZE;
+    sock->data = (char*)malloc(sock->size);
+    sock->msgs = (struct mmsghdr*)calloc(sock->batch, sizeof(struct mmsghdr));
+    sock->iov = (struct iovec*)calloc(2 * sock->batch, sizeof(struct iovec));
+    if (sock->data == NULL || sock->msgs == NULL || sock->iov == NULL || !log_socket_resolve(sock, address)) {
+        free(sock->data);
+        free(sock->msgs);
+        free(sock->iov);
+        free(sock);
+        return NULL;
+    }
+    for (size_t i = 0; i < sock->batch; i++) {
+        sock->msgs[i].msg_hdr.msg_iov = &sock->iov[2 * i];
+        sock->msgs[i].msg_hdr.msg_iovlen = 2;
+    }
+    sock->policy = policy;
+    sock->flush_on_error = flush_on_error;
+    sock->syslog = syslog;
+    if (syslog) {
+        log_socket_syslog_tail(sock);
+    }
+    // a collector that is not up yet is picked up by a later batch
+    log_socket_connect(sock);
+
+    pthread_mutex_init(&sock->lock, NULL);
+    pthread_cond_init(&sock->cond, NULL);
+    sock->interval_ms = (interval_ms == 0) ? SOCKET_FLUSH_MS_DEFAULT : interval_ms;
+    if (pthread_create(&sock->flusher, NULL, log_socket_flusher, sock) != 0) {
+        log_socket_destruct(sock);
+        return NULL;
+    }
+    sock->flusher_running = true;
+    return sock;
+}
+
+// <PRI>1 TIMESTAMP, the rest of the header is the same for every record
+static size_t log_socket_syslog_head(logman_socket* sock, char* buf, logman_level level)
+{
+    size_t len = 0;
+    buf[len++] = '<';
+    len += log_utoa(&buf[len], (uint64_t)(SOCKET_SYSLOG_FACILITY * 8 + log_syslog_severity[level]));
+    memcpy(&buf[len], ">1 ", 3);
+    len += 3;
+    len += log_time_render_utc(&buf[len], log_socket_clock(CLOCK_REALTIME));
+    memcpy(&buf[len], sock->syslog_tail, sock->syslog_tail_len);
+    return len + sock->syslog_tail_len;
+}
+
+bool log_socket_write(logman_socket* sock, const char* buf, size_t len, logman_level level)
+{
+    // a datagram carries one record, syslog messages go without the line end
+    if (sock->syslog && len > 0 && buf[len - 1] == '\n') {
+        len--;
+    }
+    size_t head_max = sock->syslog ? SOCKET_SYSLOG_HEAD_MAX + sock->syslog_tail_len : 0;
+
+    bool ok = true;
+    pthread_mutex_lock(&sock->lock);
+    if (sock->count == sock->batch || sock->used + head_max + len > sock->size) {
+        ok = log_socket_send_locked(sock);
+    }
+    struct iovec* iov = sock->msgs[sock->count].msg_hdr.msg_iov;
+    char* head = &sock->data[sock->used];
+    iov[0].iov_base = head;
+    iov[0].iov_len = sock->syslog ? log_socket_syslog_head(sock, head, level) : 0;
+    sock->used += iov[0].iov_len;
+    sock->count++;
+    if (head_max + len > sock->size) {
+        // too large to stage, it goes out on its own right away
+        iov[1].iov_base = (void*)buf;
+        iov[1].iov_len = len;
+        ok = log_socket_send_locked(sock) && ok;
+    } else {
+        memcpy(&sock->data[sock->used], buf, len);
+        iov[1].iov_base = &sock->data[sock->used];
+        iov[1].iov_len = len;
+        sock->used += len;
+        if (sock->count == sock->batch || (sock->flush_on_error && level >= LOGLEVEL_ERROR)) {
+            ok = log_socket_send_locked(sock) && ok;
+        }
+    }
+    pthread_mutex_unlock(&sock->lock);
+    return ok;
+}
+
+bool log_socket_flush(logman_socket* sock)
+{
+    pthread_mutex_lock(&sock->lock);
+    bool ok = log_socket_send_locked(sock);
+    pthread_mutex_unlock(&sock->lock);
+    return ok;
+}
+
+bool log_socket_destruct(logman_socket* sock)
+{
+    if (sock == NULL) {
+        return true;
+    }
+    if (sock->flusher_running) {
+        pthread_mutex_lock(&sock->lock);
+        sock->stop = true;
+        pthread_cond_signal(&sock->cond);
+        pthread_mutex_unlock(&sock->lock);
+        pthread_join(sock->flusher, NULL);
+    }
+    bool ok = log_socket_send_locked(sock);
+    if (sock->fd >= 0) {
+        close(sock->fd);
+    }
+    pthread_cond_destroy(&sock->cond);
+    pthread_mutex_destroy(&sock->lock);
+    free(sock->data);
+    free(sock->msgs);
+    free(sock->iov);
+    free(sock);
+    return ok;
+}
@@ -0,0 +1,98 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "logman_int.h"
+
+#define STATS_FIELDS (sizeof(logman_stats) / sizeof(unsigned long long))
+
+__thread logman_stats_block* log_stats_local;
+
+static pthread_key_t log_stats_key;
+static pthread_once_t log_stats_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t log_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+// blocks of the running threads
+static logman_stats_block* log_stats_list;
+// counts of the exited threads and of those that could not allocate their block
+static logman_stats_block log_stats_retired;
+// sum at the last log_init(), subtracted on read
+static logman_stats log_stats_base;
+
+static void log_stats_sum(const logman_stats* stats, unsigned long long* sum)
+{
+    const unsigned long long* counters = (const unsigned long long*)stats;
+    for (size_t i = 0; i < STATS_FIELDS; i++) {
+        sum[i] += __atomic_load_n(&counters[i], __ATOMIC_RELAXED);
+    }
+}
+
+static void log_stats_free(void* arg)
+{
+    logman_stats_block* block = (logman_stats_block*)arg;
+    pthread_mutex_lock(&log_stats_lock);
+    log_stats_sum(&block->stats, (unsigned long long*)&log_stats_retired.stats);
+    logman_stats_block** link = &log_stats_list;
+    while (*link != block) {
+        link = &(*link)->next;
+    }
+    *link = block->next;
+    pthread_mutex_unlock(&log_stats_lock);
+    free(block);
+    log_stats_local = NULL;
+}
+
+static void log_stats_key_create(void)
+{
+    pthread_key_create(&log_stats_key, log_stats_free);
+}
+
+logman_stats* log_stats_register(void)
+{
+    pthread_once(&log_stats_once, log_stats_key_create);
+    logman_stats_block* block = NULL;
+    if (posix_memalign((void**)&block, CACHE_LINE_SIZE, sizeof(logman_stats_block)) != 0) {
+        // shared by such threads, their updates may race
+        return &log_stats_retired.stats;
+    }
+    memset(block, 0, sizeof(logman_stats_block));
+
+    pthread_mutex_lock(&log_stats_lock);
+    block->next = log_stats_list;
+    log_stats_list = block;
+    pthread_mutex_unlock(&log_stats_lock);
+    pthread_setspecific(log_stats_key, block);
+    log_stats_local = block;
+    return &block->stats;
+}
+
+static void log_stats_total(unsigned long long* sum)
+{
+    memset(sum, 0, sizeof(logman_stats));
+    pthread_mutex_lock(&log_stats_lock);
+    log_stats_sum(&log_stats_retired.stats, sum);
+    for (logman_stats_block* block = log_stats_list; block != NULL; block = block->next) {
+        log_stats_sum(&block->stats, sum);
+    }
+    pthread_mutex_unlock(&log_stats_lock);
+}
+
+void log_stats_reset(void)
+{
+    log_stats_total((unsigned long long*)&log_stats_base);
+}
+
+void log_get_stats(logman_stats* stats)
+{
+    unsigned long long* sum = (unsigned long long*)stats;
+    const unsigned long long* base = (const unsigned long long*)&log_stats_base;
+    log_stats_total(sum);
+    for (size_t i = 0; i < STATS_FIELDS; i++) {
+        sum[i] -= base[i];
+    }
+}
+
+void log_stats_latency(logman_stats* stats, unsigned long long ns)
+{
+    int bucket = (ns < 2) ? 0 : 63 - __builtin_clzll(ns);
+    bucket = (bucket >= LOGMAN_LATENCY_BUCKETS) ? LOGMAN_LATENCY_BUCKETS - 1 : bucket;
+    log_stat_add(&stats->latency[bucket], 1);
+}
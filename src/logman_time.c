@@ -0,0 +1,449 @@
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+    #include <cpuid.h>
+#endif
+
+#include "logman_int.h"
+
+#if defined(CLOCK_REALTIME_COARSE)
+    #define LOG_CLOCK_COARSE CLOCK_REALTIME_COARSE
+#else
+    #define LOG_CLOCK_COARSE CLOCK_REALTIME
+#endif
+
+static const char log_digits2[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+void log_utoa_fixed(char* dst, uint32_t value, int width)
+{
+    while (width >= 2) {
+        width -= 2;
+        memcpy(&dst[width], &log_digits2[(value % 100) * 2], 2);
+        value /= 100;
+    }
+    if (width != 0) {
+        dst[0] = (char)('0' + value % 10);
+    }
+}
+
+size_t log_utoa(char* dst, uint64_t value)
+{
+    char tmp[20];
+    size_t len = 0;
+    while (value >= 100) {
+        len += 2;
+        memcpy(&tmp[sizeof(tmp) - len], &log_digits2[(value % 100) * 2], 2);
+        value /= 100;
+    }
+    if (value >= 10) {
+        len += 2;
+        memcpy(&tmp[sizeof(tmp) - len], &log_digits2[value * 2], 2);
+    } else {
+        tmp[sizeof(tmp) - ++len] = (char)('0' + value);
+    }
+    memcpy(dst, &tmp[sizeof(tmp) - len], len);
+    return len;
+}
+
+static size_t log_time_render_prefix(char* buf, time_t sec, logman_time_format format)
+{
+    struct tm tm;
+    if (format == LOGTIME_ISO8601_UTC) {
+        // yyyy-mm-ddThh:mm:ss
+        gmtime_r(&sec, &tm);
+        log_utoa_fixed(&buf[0], tm.tm_year + 1900, 4);
+        buf[4] = '-';
+        log_utoa_fixed(&buf[5], tm.tm_mon + 1, 2);
+        buf[7] = '-';
+        log_utoa_fixed(&buf[8], tm.tm_mday, 2);
+        buf[10] = 'T';
+    } else {
+        // dd.mm.yyyy hh:mm:ss
+        localtime_r(&sec, &tm);
+        log_utoa_fixed(&buf[0], tm.tm_mday, 2);
+        buf[2] = '.';
+        log_utoa_fixed(&buf[3], tm.tm_mon + 1, 2);
+        buf[5] = '.';
+        log_utoa_fixed(&buf[6], tm.tm_year + 1900, 4);
+        buf[10] = ' ';
+    }
+    log_utoa_fixed(&buf[11], tm.tm_hour, 2);
+    buf[13] = ':';
+    log_utoa_fixed(&buf[14], tm.tm_min, 2);
+    buf[16] = ':';
+    log_utoa_fixed(&buf[17], tm.tm_sec, 2);
+    return DATE_PREFIX_LEN;
+}
+
+size_t log_time_render(logman_time_cache* cache, char* buf, const struct timespec* ts,
+    logman_time_format format, logman_time_precision precision)
+{
+    if (ts->tv_sec != cache->sec || format != cache->format) {
+        log_time_render_prefix(buf, ts->tv_sec, format);
+        cache->sec = ts->tv_sec;
+        cache->format = format;
+    }
+
+    size_t len = DATE_PREFIX_LEN;
+    switch (precision) {
+        case LOGPREC_MSEC:
+            buf[len++] = '.';
+            log_utoa_fixed(&buf[len], (uint32_t)(ts->tv_nsec / 1000000), 3);
+            len += 3;
+            break;
+        case LOGPREC_USEC:
+            buf[len++] = '.';
+            log_utoa_fixed(&buf[len], (uint32_t)(ts->tv_nsec / 1000), 6);
+            len += 6;
+            break;
+        case LOGPREC_NSEC:
+            buf[len++] = '.';
+            log_utoa_fixed(&buf[len], (uint32_t)ts->tv_nsec, 9);
+            len += 9;
+            break;
+        default:
+            break;
+    }
+    if (format == LOGTIME_ISO8601_UTC) {
+        buf[len++] = 'Z';
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+void log_time_now(struct timespec* ts, logman_time_precision precision, bool tsc)
+{
+    if (tsc) {
+        uint64_t ns = log_clock_ns(log_clock_read());
+        ts->tv_sec = (time_t)(ns / 1000000000ull);
+        ts->tv_nsec = (long)(ns % 1000000000ull);
+        return;
+    }
+    // the coarse clock is a plain vDSO read but only ticks every few milliseconds
+    clock_gettime(precision == LOGPREC_SEC ? LOG_CLOCK_COARSE : CLOCK_REALTIME, ts);
+}
+
+/* yyyy-mm-ddThh:mm:ss.uuuuuuZ computed without the C library, so a signal handler
+ * can use it. Days to civil date after H. Hinnant's algorithm.
+ */
+size_t log_time_render_utc(char* buf, uint64_t ns)
+{
+    uint64_t sec = ns / 1000000000ull;
+    uint32_t rem = (uint32_t)(sec % 86400);
+    uint64_t z = sec / 86400 + 719468;
+    uint64_t era = z / 146097;
+    uint32_t doe = (uint32_t)(z - era * 146097);
+    uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    uint32_t mp = (5 * doy + 2) / 153;
+    uint32_t day = doy - (153 * mp + 2) / 5 + 1;
+    uint32_t month = (mp < 10) ? mp + 3 : mp - 9;
+    uint32_t year = (uint32_t)(yoe + era * 400) + (month <= 2 ? 1 : 0);
+
+    log_utoa_fixed(&buf[0], year, 4);
+    buf[4] = '-';
+    log_utoa_fixed(&buf[5], month, 2);
+    buf[7] = '-';
+    log_utoa_fixed(&buf[8], day, 2);
+    buf[10] = 'T';
+    log_utoa_fixed(&buf[11], rem / 3600, 2);
+    buf[13] = ':';
+    log_utoa_fixed(&buf[14], rem / 60 % 60, 2);
+    buf[16] = ':';
+    log_utoa_fixed(&buf[17], rem % 60, 2);
+    buf[19] = '.';
+    log_utoa_fixed(&buf[20], (uint32_t)(ns % 1000000000ull / 1000), 6);
+    buf[26] = 'Z';
+    return 27;
+}
+
+/* Counter to wall clock: ns = anchor_ns + (counter - anchor) * mult / 2^32, published
+ * under a sequence count so the readers, signal handlers included, never block.
+ */
+typedef struct {
+    size_t seq;
+    uint64_t anchor;
+    uint64_t anchor_ns;
+    uint64_t mult;
+} logman_clock;
+
+bool __log_clock_tsc;
+static logman_clock log_clock;
+// start and stop are serialized apart from the lock of the resync thread they join
+static pthread_mutex_t log_clock_users_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t log_clock_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_clock_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t log_clock_thread;
+static size_t log_clock_users;
+static bool log_clock_stopping;
+// samples of the last CLOCK_RATE_WINDOW resyncs, the rate is measured from the oldest one
+static struct {
+    uint64_t counter;
+    uint64_t ns;
+} log_clock_window[CLOCK_RATE_WINDOW];
+static size_t log_clock_window_head;
+static size_t log_clock_window_count;
+
+static bool log_clock_invariant(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid_max(0x80000000, NULL) < 0x80000007 || !__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) {
+        return false;
+    }
+    return (edx & (1u << 8)) != 0;
+#elif defined(__aarch64__)
+    return true;
+#else
+    return false;
+#endif
+}
+
+unsigned long long __log_clock_fallback(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ull + (unsigned long long)ts.tv_nsec;
+}
+
+// the tick rate of the timers is measured from load time on, see log_clock_span_init()
+static uint64_t log_clock_span_base;
+static uint64_t log_clock_span_base_ns;
+
+__attribute__((constructor)) static void log_clock_detect(void)
+{
+    __log_clock_tsc = log_clock_invariant();
+    if (__log_clock_tsc) {
+        log_clock_span_base = log_clock_read();
+        log_clock_span_base_ns = __log_clock_fallback();
+    }
+}
+
+static uint64_t log_clock_realtime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+// the wall clock read between two counter reads is paired with their middle
+static void log_clock_sample(uint64_t* counter, uint64_t* ns)
+{
+    uint64_t before = log_clock_read();
+    *ns = log_clock_realtime();
+    uint64_t after = log_clock_read();
+    *counter = before + (after - before) / 2;
+}
+
+// nanoseconds per counter tick << 32 over CLOCK_CALIBRATE_NS, the end sample is the last one
+static uint64_t log_clock_calibrate(uint64_t* base, uint64_t* base_ns, uint64_t* counter, uint64_t* ns)
+{
+    log_clock_sample(base, base_ns);
+    struct timespec pause = { 0, CLOCK_CALIBRATE_NS };
+    nanosleep(&pause, NULL);
+    log_clock_sample(counter, ns);
+    if (*counter <= *base) {
+        return 1ull << 32;
+    }
+    return (uint64_t)(((unsigned __int128)(*ns - *base_ns) << 32) / (*counter - *base));
+}
+
+static void log_clock_publish(uint64_t anchor, uint64_t anchor_ns, uint64_t mult)
+{
+    __atomic_store_n(&log_clock.seq, log_clock.seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&log_clock.anchor, anchor, __ATOMIC_RELAXED);
+    __atomic_store_n(&log_clock.anchor_ns, anchor_ns, __ATOMIC_RELAXED);
+    __atomic_store_n(&log_clock.mult, mult, __ATOMIC_RELAXED);
+    __atomic_store_n(&log_clock.seq, log_clock.seq + 1, __ATOMIC_RELEASE);
+}
+
+uint64_t log_clock_ns(uint64_t counter)
+{
+    for (;;) {
+        size_t seq = __atomic_load_n(&log_clock.seq, __ATOMIC_ACQUIRE);
+        uint64_t anchor = __atomic_load_n(&log_clock.anchor, __ATOMIC_RELAXED);
+        uint64_t anchor_ns = __atomic_load_n(&log_clock.anchor_ns, __ATOMIC_RELAXED);
+        uint64_t mult = __atomic_load_n(&log_clock.mult, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if ((seq & 1) != 0 || __atomic_load_n(&log_clock.seq, __ATOMIC_RELAXED) != seq) {
+            continue;
+        }
+        // a counter read before a resync lies behind the anchor
+        if (counter >= anchor) {
+            return anchor_ns + (uint64_t)(((unsigned __int128)(counter - anchor) * mult) >> 32);
+        }
+        return anchor_ns - (uint64_t)(((unsigned __int128)(anchor - counter) * mult) >> 32);
+    }
+}
+
+static uint64_t log_clock_span_mult;
+static pthread_once_t log_clock_span_once = PTHREAD_ONCE_INIT;
+
+// nanoseconds per tick << 32 since load time, wait lets at least CLOCK_CALIBRATE_NS pass
+static uint64_t log_clock_span_rate(bool wait)
+{
+    uint64_t counter = log_clock_read();
+    uint64_t ns = __log_clock_fallback();
+    if (wait && ns - log_clock_span_base_ns < CLOCK_CALIBRATE_NS) {
+        struct timespec pause = { 0, (long)(CLOCK_CALIBRATE_NS - (ns - log_clock_span_base_ns)) };
+        nanosleep(&pause, NULL);
+        counter = log_clock_read();
+        ns = __log_clock_fallback();
+    }
+    if (counter <= log_clock_span_base) {
+        return 1ull << 32;
+    }
+    return (uint64_t)(((unsigned __int128)(ns - log_clock_span_base_ns) << 32) / (counter - log_clock_span_base));
+}
+
+static void log_clock_span_calibrate(void)
+{
+    __atomic_store_n(&log_clock_span_mult, log_clock_span_rate(true), __ATOMIC_RELAXED);
+}
+
+/* Called from log_init(): by then the process has usually run for longer than
+ * CLOCK_CALIBRATE_NS and nothing waits, timers never calibrate on their way out.
+ */
+void log_clock_span_init(void)
+{
+    if (__log_clock_tsc) {
+        pthread_once(&log_clock_span_once, log_clock_span_calibrate);
+    }
+}
+
+// durations take the rate of the running clock, or the one of log_clock_span_init()
+uint64_t log_clock_span_ns(uint64_t ticks)
+{
+    if (!__log_clock_tsc) {
+        return ticks;
+    }
+    uint64_t mult = __atomic_load_n(&log_clock.mult, __ATOMIC_RELAXED);
+    if (mult == 0) {
+        mult = __atomic_load_n(&log_clock_span_mult, __ATOMIC_RELAXED);
+    }
+    if (mult == 0) {
+        // a timer ended before any log_init(), the rate so far will do
+        mult = log_clock_span_rate(false);
+    }
+    return (uint64_t)(((unsigned __int128)ticks * mult) >> 32);
+}
+
+static void log_clock_window_add(uint64_t counter, uint64_t ns, bool reset)
+{
+    if (reset) {
+        log_clock_window_count = 0;
+    }
+    log_clock_window[log_clock_window_head % CLOCK_RATE_WINDOW].counter = counter;
+    log_clock_window[log_clock_window_head % CLOCK_RATE_WINDOW].ns = ns;
+    log_clock_window_head++;
+    if (log_clock_window_count < CLOCK_RATE_WINDOW) {
+        log_clock_window_count++;
+    }
+}
+
+/* Keeps the conversion continuous at the sample: the slope is steered to work off
+ * the offset to the wall clock within the next period, bounded to CLOCK_STEER_PPM.
+ * Larger offsets come from a stepped wall clock and are followed at once, the rate
+ * window starts over there so the step does not skew later slopes.
+ */
+static void log_clock_resync(void)
+{
+    uint64_t counter, ns;
+    log_clock_sample(&counter, &ns);
+    size_t oldest = (log_clock_window_head - log_clock_window_count) % CLOCK_RATE_WINDOW;
+    uint64_t base = log_clock_window[oldest].counter;
+    uint64_t base_ns = log_clock_window[oldest].ns;
+    if (counter <= base) {
+        return;
+    }
+    uint64_t now = log_clock_ns(counter);
+    int64_t offset = (int64_t)(ns - now);
+    if (offset > CLOCK_STEP_NS || offset < -CLOCK_STEP_NS) {
+        log_clock_publish(counter, ns, __atomic_load_n(&log_clock.mult, __ATOMIC_RELAXED));
+        log_clock_window_add(counter, ns, true);
+        return;
+    }
+    uint64_t rate = (uint64_t)(((unsigned __int128)(ns - base_ns) << 32) / (counter - base));
+    log_clock_window_add(counter, ns, false);
+
+    const int64_t period = (int64_t)CLOCK_RESYNC_MS * 1000000;
+    const int64_t bound = period / 1000000 * CLOCK_STEER_PPM;
+    offset = (offset > bound) ? bound : (offset < -bound) ? -bound : offset;
+    __int128 steer = (__int128)rate * offset / period;
+    log_clock_publish(counter, now, (uint64_t)((__int128)rate + steer));
+}
+
+static void* log_clock_worker(void* arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&log_clock_lock);
+    while (!log_clock_stopping) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += CLOCK_RESYNC_MS / 1000;
+        deadline.tv_nsec += (long)(CLOCK_RESYNC_MS % 1000) * 1000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&log_clock_cond, &log_clock_lock, &deadline);
+        if (!log_clock_stopping) {
+            log_clock_resync();
+        }
+    }
+    pthread_mutex_unlock(&log_clock_lock);
+    return NULL;
+}
+
+// the first user calibrates the counter and starts the resync thread, the others share it
+logman_error log_clock_start(void)
+{
+    pthread_mutex_lock(&log_clock_users_lock);
+    if (log_clock_users++ > 0) {
+        pthread_mutex_unlock(&log_clock_users_lock);
+        return LOGERR_NOERR;
+    }
+
+    uint64_t base, base_ns, counter, ns;
+    uint64_t mult = log_clock_calibrate(&base, &base_ns, &counter, &ns);
+    log_clock_publish(counter, ns, mult);
+    log_clock_window_add(base, base_ns, true);
+    log_clock_window_add(counter, ns, false);
+
+    log_clock_stopping = false;
+    if (pthread_create(&log_clock_thread, NULL, log_clock_worker, NULL) != 0) {
+        log_clock_users = 0;
+        pthread_mutex_unlock(&log_clock_users_lock);
+        return LOGERR_LOGCLOCKINIT;
+    }
+    pthread_mutex_unlock(&log_clock_users_lock);
+    return LOGERR_NOERR;
+}
+
+void log_clock_stop(void)
+{
+    pthread_mutex_lock(&log_clock_users_lock);
+    if (log_clock_users == 0 || --log_clock_users > 0) {
+        pthread_mutex_unlock(&log_clock_users_lock);
+        return;
+    }
+    pthread_mutex_lock(&log_clock_lock);
+    log_clock_stopping = true;
+    pthread_cond_signal(&log_clock_cond);
+    pthread_mutex_unlock(&log_clock_lock);
+    pthread_join(log_clock_thread, NULL);
+    pthread_mutex_unlock(&log_clock_users_lock);
+}
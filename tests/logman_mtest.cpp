@@ -1,8 +1,26 @@
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <atomic>
+#include <arpa/inet.h>
+#include <linux/membarrier.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
 
 extern "C" {
     #include "../src/logman_int.h"
 }
+#include "../include/logman/logman.hpp"
+
+extern "C" void test_sites_log(void);
+extern "C" void test_timers_log(void (*work)(void));
 
 const char *test_file = "log.txt";
 
@@ -53,6 +71,7 @@ TEST_F(LogmanTests, ErrorLogDebug)
 TEST_F(LogmanTests, InfoLogProduct)
 {
     logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
     settings.type = LOGTYPE_PRODUCT;
     settings.out_type = LOGOUT_FILE;
     settings.output.file_name = test_file;
@@ -74,6 +93,7 @@ TEST_F(LogmanTests, InfoLogProduct)
 TEST_F(LogmanTests, WarningLogProduct)
 {
     logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
     settings.type = LOGTYPE_PRODUCT;
     settings.out_type = LOGOUT_FILE;
     settings.output.file_name = test_file;
@@ -95,6 +115,7 @@ TEST_F(LogmanTests, WarningLogProduct)
 TEST_F(LogmanTests, ErrorLogProduct)
 {
     logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
     settings.type = LOGTYPE_PRODUCT;
     settings.out_type = LOGOUT_FILE;
     settings.output.file_name = test_file;
@@ -111,4 +132,1756 @@ TEST_F(LogmanTests, ErrorLogProduct)
     fclose(f);
     // cut off the date and callstack
     ASSERT_STREQ(&buf[19], "::ERROR::error message\n");
-}
\ No newline at end of file
+}
+
+TEST_F(LogmanTests, InfoLogProductMsec)
+{
+    logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
+    settings.type = LOGTYPE_PRODUCT;
+    settings.out_type = LOGOUT_FILE;
+    settings.output.file_name = test_file;
+    settings.time_precision = LOGPREC_MSEC;
+
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+    log_info("info message");
+    ASSERT_STREQ(log_get_internal_error(), "");
+    log_destruct();
+
+    FILE *f = fopen(test_file, "r");
+    char buf[128];
+    memset(buf, 0, 128);
+    fread(buf, sizeof(char), 128, f);
+    fclose(f);
+    ASSERT_EQ(buf[19], '.');
+    // cut off the date with milliseconds
+    ASSERT_STREQ(&buf[23], "::INFO::info message\n");
+}
+
+TEST_F(LogmanTests, DebugFilteredProduct)
+{
+    logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
+    settings.type = LOGTYPE_PRODUCT;
+    settings.out_type = LOGOUT_FILE;
+    settings.output.file_name = test_file;
+
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+    log_info("info message");
+    log_debug("debug message");
+    __log_log(LOGLEVEL_DEBUG, "file", "func", 1, "debug message");
+    ASSERT_STREQ(log_get_internal_error(), "");
+    log_destruct();
+
+    FILE *f = fopen(test_file, "r");
+    char buf[128];
+    memset(buf, 0, 128);
+    fread(buf, sizeof(char), 128, f);
+    fclose(f);
+    // the filtered records leave no trace, the previous one is not written again
+    ASSERT_STREQ(&buf[19], "::INFO::info message\n");
+}
+
+TEST_F(LogmanTests, RuntimeLevel)
+{
+    ASSERT_EQ(log_init_default(), LOGERR_NOERR);
+    int evaluated = 0;
+    log_set_level(LOGLEVEL_WARNING);
+    log_info("info message %d", ++evaluated);
+    ASSERT_EQ(evaluated, 0);
+    log_warning("warning message %d", ++evaluated);
+    ASSERT_EQ(evaluated, 1);
+}
+
+TEST_F(LogmanTests, CompileTimeLevel)
+{
+    ASSERT_EQ(log_init_default(), LOGERR_NOERR);
+    int evaluated = 0;
+#pragma push_macro("LOGMAN_MIN_LEVEL")
+#undef LOGMAN_MIN_LEVEL
+#define LOGMAN_MIN_LEVEL 2
+    log_debug("debug message %d", ++evaluated);
+    log_info("info message %d", ++evaluated);
+    ASSERT_EQ(evaluated, 0);
+    log_warning("warning message %d", ++evaluated);
+    ASSERT_EQ(evaluated, 1);
+#pragma pop_macro("LOGMAN_MIN_LEVEL")
+    log_info("info message %d", ++evaluated);
+    ASSERT_EQ(evaluated, 2);
+}
+
+TEST_F(LogmanTests, AsyncLogProduct)
+{
+    logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
+    settings.type = LOGTYPE_PRODUCT;
+    settings.out_type = LOGOUT_FILE;
+    settings.output.file_name = test_file;
+    settings.mode = LOGMODE_ASYNC;
+
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+    log_info("info message");
+    ASSERT_STREQ(log_get_internal_error(), "");
+    // destruct drains the queue before the file is closed
+    log_destruct();
+
+    FILE *f = fopen(test_file, "r");
+    char buf[128];
+    memset(buf, 0, 128);
+    fread(buf, sizeof(char), 128, f);
+    fclose(f);
+    // cut off the date
+    ASSERT_STREQ(&buf[19], "::INFO::info message\n");
+}
+
+TEST_F(LogmanTests, AsyncLogThreads)
+{
+    const int threads_num = 4;
+    const int records_num = 200;
+
+    logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
+    settings.type = LOGTYPE_PRODUCT;
+    settings.out_type = LOGOUT_FILE;
+    settings.output.file_name = test_file;
+    settings.mode = LOGMODE_ASYNC;
+    settings.async_queue_size = threads_num * records_num;
+
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < threads_num; i++) {
+        threads.emplace_back([]() {
+            for (int j = 0; j < records_num; j++) {
+                log_info("async record");
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    log_destruct();
+
+    int lines = 0;
+    char buf[128];
+    FILE *f = fopen(test_file, "r");
+    while (fgets(buf, sizeof(buf), f) != NULL) {
+        // cut off the date
+        ASSERT_STREQ(&buf[19], "::INFO::async record\n");
+        lines++;
+    }
+    fclose(f);
+    ASSERT_EQ(lines, threads_num * records_num);
+}
+
+TEST_F(LogmanTests, ThreadsNoInterleave)
+{
+    const int threads_num = 16;
+    const int records_num = 500;
+    const int payload_len = 300;
+
+    logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
+    settings.type = LOGTYPE_PRODUCT;
+    settings.out_type = LOGOUT_FILE;
+    settings.output.file_name = test_file;
+
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+    std::vector<std::thread> threads;
+    for (int i = 0; i < threads_num; i++) {
+        threads.emplace_back([i]() {
+            std::string payload(payload_len, 'a' + i);
+            for (int j = 0; j < records_num; j++) {
+                log_info("thread %02d record %04d %s", i, j, payload.c_str());
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    ASSERT_STREQ(log_get_internal_error(), "");
+    log_destruct();
+
+    std::vector<int> next_record(threads_num, 0);
+    char buf[1024];
+    FILE *f = fopen(test_file, "r");
+    while (fgets(buf, sizeof(buf), f) != NULL) {
+        int thread_id = -1;
+        int record_id = -1;
+        // cut off the date
+        ASSERT_EQ(sscanf(&buf[19], "::INFO::thread %02d record %04d ", &thread_id, &record_id), 2) << buf;
+        ASSERT_TRUE(thread_id >= 0 && thread_id < threads_num) << buf;
+        ASSERT_EQ(record_id, next_record[thread_id]) << buf;
+        next_record[thread_id]++;
+
+        std::string expect = std::string(payload_len, 'a' + thread_id) + "\n";
+        ASSERT_STREQ(&buf[19 + strlen("::INFO::thread 00 record 0000 ")], expect.c_str());
+    }
+    fclose(f);
+
+    for (int i = 0; i < threads_num; i++) {
+        ASSERT_EQ(next_record[i], records_num);
+    }
+}
+
+TEST_F(LogmanTests, BinaryLogDecode)
+{
+    const char *text_file = "log_decoded.txt";
+    logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
+    settings.type = LOGTYPE_DEBUG;
+    settings.out_type = LOGOUT_BINARY;
+    settings.output.file_name = test_file;
+
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+    for (int i = 0; i < 2; i++) {
+        __log_log(LOGLEVEL_INFO, "file", "func", 7, "value %d %s %.2f %c%%", i, "str", 1.5, 'x');
+    }
+    __log_log(LOGLEVEL_ERROR, "file", "func", 9, "%*s|%-4ld|%s", 6, "pad", 12L, (const char*)NULL);
+    ASSERT_STREQ(log_get_internal_error(), "");
+    log_destruct();
+
+    FILE *in = fopen(test_file, "rb");
+    FILE *out = fopen(text_file, "w");
+    ASSERT_EQ(log_binary_decode(in, out), LOGERR_NOERR);
+    fclose(in);
+    fclose(out);
+
+    const char *expect[] = {
+        "::INFO::file::func::7::value 0 str 1.50 x%\n",
+        "::INFO::file::func::7::value 1 str 1.50 x%\n",
+        "::ERROR::file::func::9::   pad|12  |(null)\n",
+    };
+    char buf[256];
+    int lines = 0;
+    FILE *f = fopen(text_file, "r");
+    while (fgets(buf, sizeof(buf), f) != NULL && lines < 3) {
+        // cut off the date
+        ASSERT_STREQ(&buf[19], expect[lines]);
+        lines++;
+    }
+    fclose(f);
+    ASSERT_EQ(lines, 3);
+    remove(text_file);
+}
+
+TEST_F(LogmanTests, BinaryLogDecodeLong)
+{
+    const char *text_file = "log_decoded.txt";
+    logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
+    settings.type = LOGTYPE_PRODUCT;
+    settings.out_type = LOGOUT_BINARY;
+    settings.output.file_name = test_file;
+
+    // neither the call site nor the arguments fit message_buf
+    std::string fmt = std::string(MESSAGE_BUF_SIZE, 'f') + " %s %d";
+    std::string arg(3 * MESSAGE_BUF_SIZE, 'a');
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+    __log_log(LOGLEVEL_INFO, "file", "func", 7, fmt.c_str(), arg.c_str(), 5);
+    logman_kv kv[] = { LOGKV_STR("arg", arg.c_str()) };
+    __log_log_kv(LOGLEVEL_INFO, "file", "func", 8, "done", kv, 1);
+    ASSERT_STREQ(log_get_internal_error(), "");
+    log_destruct();
+
+    FILE *in = fopen(test_file, "rb");
+    FILE *out = fopen(text_file, "w");
+    ASSERT_EQ(log_binary_decode(in, out), LOGERR_NOERR);
+    fclose(in);
+    fclose(out);
+
+    const std::string expect[] = {
+        "::INFO::" + std::string(MESSAGE_BUF_SIZE, 'f') + " " + arg + " 5\n",
+        "::INFO::done arg=" + arg + "\n",
+    };
+    std::vector<char> buf(8 * MESSAGE_BUF_SIZE);
+    int lines = 0;
+    FILE *f = fopen(text_file, "r");
+    while (fgets(buf.data(), (int)buf.size(), f) != NULL && lines < 2) {
+        // cut off the date
+        ASSERT_STREQ(&buf[19], expect[lines].c_str());
+        lines++;
+    }
+    fclose(f);
+    ASSERT_EQ(lines, 2);
+    remove(text_file);
+}
+
+TEST_F(LogmanTests, BinaryLogFormatBuffer)
+{
+    const char *text_file = "log_decoded.txt";
+    logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
+    settings.type = LOGTYPE_PRODUCT;
+    settings.out_type = LOGOUT_BINARY;
+    settings.output.file_name = test_file;
+
+    // formats that are not literals are stored as text, the buffer changes between calls
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+    char fmt[32];
+    for (int i = 0; i < 3; i++) {
+        snprintf(fmt, sizeof(fmt), "buffer %d %%d", i);
+        log_info(fmt, i * 10);
+    }
+    for (int i = 0; i < BINARY_SITES_MAX + 10; i++) {
+        std::string heap = "heap " + std::to_string(i) + " %d";
+        log_info(heap.c_str(), i);
+    }
+    ASSERT_STREQ(log_get_internal_error(), "");
+    log_destruct();
+
+    FILE *in = fopen(test_file, "rb");
+    FILE *out = fopen(text_file, "w");
+    ASSERT_EQ(log_binary_decode(in, out), LOGERR_NOERR);
+    fclose(in);
+    fclose(out);
+
+    char buf[256];
+    int lines = 0;
+    FILE *f = fopen(text_file, "r");
+    while (fgets(buf, sizeof(buf), f) != NULL) {
+        // cut off the date
+        std::string expect = (lines < 3) ?
+            "::INFO::buffer " + std::to_string(lines) + " " + std::to_string(lines * 10) + "\n" :
+            "::INFO::heap " + std::to_string(lines - 3) + " " + std::to_string(lines - 3) + "\n";
+        ASSERT_STREQ(&buf[19], expect.c_str());
+        lines++;
+    }
+    fclose(f);
+    EXPECT_EQ(lines, 3 + BINARY_SITES_MAX + 10);
+    remove(text_file);
+}
+
+TEST_F(LogmanTests, BinaryLogDecodeTruncated)
+{
+    const char *text_file = "log_decoded.txt";
+    logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
+    settings.type = LOGTYPE_PRODUCT;
+    settings.out_type = LOGOUT_BINARY;
+    settings.output.file_name = test_file;
+    // direct I/O would pad the file with zero bytes, binary output does not use it
+    settings.file_direct = true;
+
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+    for (int i = 0; i < 10; i++) {
+        log_info("record %d", i);
+    }
+    log_destruct();
+
+    // a writer killed in the middle of the last record
+    FILE *f = fopen(test_file, "rb");
+    std::string data;
+    char buf[256];
+    size_t n;
+    while ((n = fread(buf, sizeof(char), sizeof(buf), f)) > 0) {
+        data.append(buf, n);
+    }
+    fclose(f);
+    size_t record = BINARY_RECORD_HEAD_SIZE + sizeof(int);
+    ASSERT_GT(data.size(), BINARY_HEADER_SIZE + BINARY_SITE_HEAD_SIZE + 10 * record);
+    data.resize(data.size() - record + 5);
+    f = fopen(test_file, "wb");
+    fwrite(data.data(), sizeof(char), data.size(), f);
+    fclose(f);
+
+    FILE *in = fopen(test_file, "rb");
+    FILE *out = fopen(text_file, "w");
+    ASSERT_EQ(log_binary_decode(in, out), LOGERR_NOERR);
+    fclose(in);
+    fclose(out);
+
+    int lines = 0;
+    f = fopen(text_file, "r");
+    while (fgets(buf, sizeof(buf), f) != NULL) {
+        // cut off the date
+        ASSERT_STREQ(&buf[19], ("::INFO::record " + std::to_string(lines) + "\n").c_str());
+        lines++;
+    }
+    fclose(f);
+    EXPECT_EQ(lines, 9);
+    remove(text_file);
+}
+
+TEST_F(LogmanTests, BinaryLogAsync)
+{
+    const char *text_file = "log_decoded.txt";
+    logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
+    settings.type = LOGTYPE_DEBUG;
+    settings.out_type = LOGOUT_BINARY;
+    settings.output.file_name = test_file;
+    settings.mode = LOGMODE_ASYNC;
+    settings.async_queue_size = 4;
+
+    // a full queue drops records, never the call sites they refer to
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+    std::atomic<bool> stop(false);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&stop] {
+            while (!stop.load()) {
+                __log_log(LOGLEVEL_INFO, "file", "func", 1000, "site %d", 1000);
+            }
+        });
+    }
+    for (int round = 0; round < 2; round++) {
+        for (int i = 0; i < 200; i++) {
+            __log_log(LOGLEVEL_INFO, "file", "func", i, "site %d", i);
+        }
+        log_flush();
+    }
+    stop = true;
+    for (auto& t : threads) {
+        t.join();
+    }
+    log_destruct();
+
+    FILE *in = fopen(test_file, "rb");
+    FILE *out = fopen(text_file, "w");
+    ASSERT_EQ(log_binary_decode(in, out), LOGERR_NOERR);
+    fclose(in);
+    fclose(out);
+
+    char buf[256];
+    int lines = 0;
+    FILE *f = fopen(text_file, "r");
+    while (fgets(buf, sizeof(buf), f) != NULL) {
+        int line = -1;
+        int value = -2;
+        // cut off the date
+        ASSERT_EQ(sscanf(&buf[19], "::INFO::file::func::%d::site %d", &line, &value), 2) << buf;
+        ASSERT_EQ(line, value);
+        lines++;
+    }
+    fclose(f);
+    EXPECT_GT(lines, 0);
+    remove(text_file);
+}
+
+TEST_F(LogmanTests, BinaryLogDecodeUnknownSite)
+{
+    const char *text_file = "log_decoded.txt";
+    logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
+    settings.type = LOGTYPE_PRODUCT;
+    settings.out_type = LOGOUT_BINARY;
+    settings.output.file_name = test_file;
+
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+    for (int i = 0; i < 3; i++) {
+        log_info("record %d", i);
+    }
+    log_destruct();
+
+    // the middle record refers to a site the file does not define
+    FILE *f = fopen(test_file, "r+b");
+    size_t record = BINARY_RECORD_HEAD_SIZE + sizeof(int);
+    uint32_t id = 99;
+    fseek(f, -(long)(2 * record) + 1, SEEK_END);
+    fwrite(&id, sizeof(id), 1, f);
+    fclose(f);
+
+    FILE *in = fopen(test_file, "rb");
+    FILE *out = fopen(text_file, "w");
+    ASSERT_EQ(log_binary_decode(in, out), LOGERR_NOERR);
+    fclose(in);
+    fclose(out);
+
+    const char *expect[] = {
+        "::INFO::record 0\n",
+        "::INFO::record 2\n",
+    };
+    char buf[256];
+    int lines = 0;
+    f = fopen(text_file, "r");
+    while (fgets(buf, sizeof(buf), f) != NULL && lines < 2) {
+        ASSERT_STREQ(&buf[19], expect[lines]);
+        lines++;
+    }
+    fclose(f);
+    ASSERT_EQ(lines, 2);
+    remove(text_file);
+}
+
+TEST_F(LogmanTests, FlushLog)
+{
+    logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
+    settings.type = LOGTYPE_PRODUCT;
+    settings.out_type = LOGOUT_FILE;
+    settings.output.file_name = test_file;
+    settings.mode = LOGMODE_ASYNC;
+
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+    log_info("info message");
+    ASSERT_EQ(log_flush(), LOGERR_NOERR);
+
+    // the record is in the file while the logger is still running
+    FILE *f = fopen(test_file, "r");
+    char buf[128];
+    memset(buf, 0, 128);
+    fread(buf, sizeof(char), 128, f);
+    fclose(f);
+    ASSERT_STREQ(&buf[19], "::INFO::info message\n");
+}
+
+TEST_F(LogmanTests, MmapLogProduct)
+{
+    logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
+    settings.type = LOGTYPE_PRODUCT;
+    settings.out_type = LOGOUT_MMAP;
+    settings.output.file_name = test_file;
+
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+    log_warning("warning message");
+    ASSERT_STREQ(log_get_internal_error(), "");
+    log_destruct();
+
+    FILE *f = fopen(test_file, "r");
+    char buf[128];
+    memset(buf, 0, 128);
+    fread(buf, sizeof(char), 128, f);
+    fclose(f);
+    // cut off the date
+    ASSERT_STREQ(&buf[19], "::WARNING::warning message\n");
+}
+TEST_F(LogmanTests, AppendRotateLog)
+{
+    logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
+    settings.type = LOGTYPE_PRODUCT;
+    settings.out_type = LOGOUT_FILE;
+    settings.output.file_name = test_file;
+    settings.file_append = true;
+
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+    log_info("first");
+    log_destruct();
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+    log_info("second");
+    log_destruct();
+
+    FILE *f = fopen(test_file, "r");
+    char buf[128];
+    memset(buf, 0, 128);
+    fread(buf, sizeof(char), 128, f);
+    fclose(f);
+    // the second run keeps the records of the first one
+    ASSERT_EQ(std::string(&buf[19], 14), "::INFO::first\n");
+    ASSERT_STREQ(&buf[19 + 14 + 19], "::INFO::second\n");
+
+    // any record goes over the limit, the next one starts a new file once it is ready
+    settings.file_append = false;
+    settings.rotate_size = 1;
+    settings.rotate_keep = 1;
+    std::string rotated = std::string(test_file) + ".1";
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+    // the caller never waits for the next file, keep logging until the worker has caught up
+    for (int i = 0; i < 100 && access(rotated.c_str(), F_OK) != 0; i++) {
+        log_info("rotated");
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    log_destruct();
+
+    f = fopen(rotated.c_str(), "r");
+    ASSERT_TRUE(f != NULL);
+    memset(buf, 0, 128);
+    fread(buf, sizeof(char), 128, f);
+    fclose(f);
+    remove(rotated.c_str());
+    ASSERT_EQ(std::string(&buf[19], 16), "::INFO::rotated\n");
+}
+
+TEST_F(LogmanTests, SinksLevelAndFormat)
+{
+    const char *sink_file = "sink.txt";
+    logman_sink_settings sink;
+    memset(&sink, 0, sizeof(logman_sink_settings));
+    sink.out_type = LOGOUT_FILE;
+    sink.output.file_name = sink_file;
+    sink.min_level = LOGLEVEL_WARNING;
+    sink.format = LOGFORMAT_DEBUG;
+
+    for (logman_mode mode : { LOGMODE_SYNC, LOGMODE_ASYNC }) {
+        logman_settings settings;
+        memset(&settings, 0, sizeof(logman_settings));
+        settings.type = LOGTYPE_PRODUCT;
+        settings.out_type = LOGOUT_FILE;
+        settings.output.file_name = test_file;
+        settings.mode = mode;
+        settings.sinks = &sink;
+        settings.sinks_count = 1;
+
+        ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+        log_info("info message");
+        int line = __LINE__ + 1;
+        log_warning("warning %d", 2);
+        ASSERT_STREQ(log_get_internal_error(), "");
+        log_destruct();
+
+        char buf[256];
+        memset(buf, 0, sizeof(buf));
+        FILE *f = fopen(test_file, "r");
+        fread(buf, sizeof(char), sizeof(buf), f);
+        fclose(f);
+        ASSERT_EQ(std::string(&buf[19], 21), "::INFO::info message\n");
+        ASSERT_STREQ(&buf[19 + 21 + 19], "::WARNING::warning 2\n");
+
+        // only the warning, with the call site
+        char expect[128];
+        snprintf(expect, sizeof(expect), "::WARNING::logman_mtest.cpp::TestBody::%d::warning 2\n", line);
+        memset(buf, 0, sizeof(buf));
+        f = fopen(sink_file, "r");
+        fread(buf, sizeof(char), sizeof(buf), f);
+        fclose(f);
+        ASSERT_STREQ(&buf[19], expect);
+        remove(sink_file);
+    }
+}
+
+TEST_F(LogmanTests, SinksLimit)
+{
+    logman_sink_settings sinks[SINKS_MAX + 1];
+    memset(sinks, 0, sizeof(sinks));
+    for (logman_sink_settings& sink : sinks) {
+        sink.out_type = LOGOUT_STREAM;
+        sink.output.out_stream = stderr;
+    }
+
+    logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
+    settings.type = LOGTYPE_PRODUCT;
+    settings.out_type = LOGOUT_STREAM;
+    settings.output.out_stream = stderr;
+    settings.sinks = sinks;
+    settings.sinks_count = SINKS_MAX + 1;
+    ASSERT_EQ(log_init(&settings), LOGERR_LOGSINKLIMIT);
+}
+
+TEST_F(LogmanTests, LargeMessage)
+{
+    std::string large(5000, 'x');
+    for (logman_mode mode : { LOGMODE_SYNC, LOGMODE_ASYNC }) {
+        logman_settings settings;
+        memset(&settings, 0, sizeof(logman_settings));
+        settings.type = LOGTYPE_PRODUCT;
+        settings.out_type = LOGOUT_FILE;
+        settings.output.file_name = test_file;
+        settings.mode = mode;
+
+        ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+        log_info("%s", large.c_str());
+        ASSERT_STREQ(log_get_internal_error(), "");
+        log_destruct();
+
+        std::vector<char> buf(8192, '\0');
+        FILE *f = fopen(test_file, "r");
+        size_t len = fread(buf.data(), sizeof(char), buf.size(), f);
+        fclose(f);
+        ASSERT_EQ(std::string(&buf[19], len - 19), "::INFO::" + large + "\n");
+    }
+}
+
+TEST_F(LogmanTests, StructuredLog)
+{
+    const char *sink_file = "sink.txt";
+    logman_sink_settings sink;
+    memset(&sink, 0, sizeof(logman_sink_settings));
+    sink.out_type = LOGOUT_FILE;
+    sink.output.file_name = sink_file;
+    sink.format = LOGFORMAT_LOGFMT;
+
+    logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
+    settings.type = LOGTYPE_PRODUCT;
+    settings.out_type = LOGOUT_FILE;
+    settings.output.file_name = test_file;
+    settings.format = LOGFORMAT_JSON;
+    settings.time_format = LOGTIME_ISO8601_UTC;
+    settings.sinks = &sink;
+    settings.sinks_count = 1;
+
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+    int line = __LINE__ + 1;
+    log_info_kv("request done", LOGKV_INT("user", 42), LOGKV_STR("path", "/a b"));
+    log_info("printf %d", 7);
+    log_debug_kv("filtered");
+    ASSERT_STREQ(log_get_internal_error(), "");
+    log_destruct();
+
+    char expect[512];
+    char buf[512];
+    memset(buf, 0, sizeof(buf));
+    FILE *f = fopen(test_file, "r");
+    fread(buf, sizeof(char), sizeof(buf), f);
+    fclose(f);
+    // {"time":"yyyy-mm-ddThh:mm:ssZ",
+    snprintf(expect, sizeof(expect), "\"level\":\"INFO\",\"file\":\"logman_mtest.cpp\",\"func\":\"TestBody\","
+        "\"line\":%d,\"msg\":\"request done\",\"user\":42,\"path\":\"/a b\"}\n", line);
+    std::string json(buf);
+    ASSERT_EQ(json.substr(0, 9), "{\"time\":\"");
+    ASSERT_EQ(json.substr(31, strlen(expect)), expect);
+    ASSERT_NE(json.find("\"line\":" + std::to_string(line + 1) + ",\"msg\":\"printf 7\"}\n"), std::string::npos);
+
+    memset(buf, 0, sizeof(buf));
+    f = fopen(sink_file, "r");
+    fread(buf, sizeof(char), sizeof(buf), f);
+    fclose(f);
+    remove(sink_file);
+    snprintf(expect, sizeof(expect), " level=INFO file=logman_mtest.cpp func=TestBody line=%d msg=\"request done\" "
+        "user=42 path=\"/a b\"\n", line);
+    std::string logfmt(buf);
+    ASSERT_EQ(logfmt.substr(0, 5), "time=");
+    ASSERT_EQ(logfmt.substr(25, strlen(expect)), expect);
+}
+
+TEST_F(LogmanTests, StructuredLogText)
+{
+    logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
+    settings.type = LOGTYPE_PRODUCT;
+    settings.out_type = LOGOUT_FILE;
+    settings.output.file_name = test_file;
+
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+    log_warning_kv("disk low", LOGKV_DOUBLE("free_gb", 1.5), LOGKV_BOOL("critical", false));
+    ASSERT_STREQ(log_get_internal_error(), "");
+    log_destruct();
+
+    char buf[128];
+    memset(buf, 0, 128);
+    FILE *f = fopen(test_file, "r");
+    fread(buf, sizeof(char), 128, f);
+    fclose(f);
+    ASSERT_STREQ(&buf[19], "::WARNING::disk low free_gb=1.5 critical=false\n");
+}
+
+TEST_F(LogmanTests, StructuredLogBinary)
+{
+    const char *text_file = "log_decoded.txt";
+    logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
+    settings.type = LOGTYPE_DEBUG;
+    settings.out_type = LOGOUT_BINARY;
+    settings.output.file_name = test_file;
+
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+    __log_log_kv(LOGLEVEL_INFO, "file", "func", 7, "done", NULL, 0);
+    logman_kv kv[] = { LOGKV_INT("user", 1), LOGKV_STR("name", "a b") };
+    __log_log_kv(LOGLEVEL_INFO, "file", "func", 8, "done", kv, 2);
+    ASSERT_STREQ(log_get_internal_error(), "");
+    log_destruct();
+
+    FILE *in = fopen(test_file, "rb");
+    FILE *out = fopen(text_file, "w");
+    ASSERT_EQ(log_binary_decode(in, out), LOGERR_NOERR);
+    fclose(in);
+    fclose(out);
+
+    const char *expect[] = {
+        "::INFO::file::func::7::done\n",
+        "::INFO::file::func::8::done user=1 name=\"a b\"\n",
+    };
+    char buf[256];
+    int lines = 0;
+    FILE *f = fopen(text_file, "r");
+    while (fgets(buf, sizeof(buf), f) != NULL && lines < 2) {
+        ASSERT_STREQ(&buf[19], expect[lines]);
+        lines++;
+    }
+    fclose(f);
+    ASSERT_EQ(lines, 2);
+    remove(text_file);
+}
+
+static_assert(logman::detail::parse("{} took {}us").args == 2);
+static_assert(logman::detail::parse("{{}} {}").count == 4);
+static_assert(!logman::detail::parse("{ }").valid);
+static_assert(logman::detail::count_args("a {{ {} }} {}") == 2);
+static_assert(logman::detail::count_args("{") == -1);
+
+struct point {
+    int x;
+    int y;
+};
+
+template <>
+struct logman::formatter<point> {
+    static void format(logman::buffer& out, const point& p)
+    {
+        out.push_back('(');
+        logman::formatter<int>::format(out, p.x);
+        out.push_back(',');
+        logman::formatter<int>::format(out, p.y);
+        out.push_back(')');
+    }
+};
+
+TEST_F(LogmanTests, CppFrontEnd)
+{
+    logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
+    settings.type = LOGTYPE_PRODUCT;
+    settings.out_type = LOGOUT_FILE;
+    settings.output.file_name = test_file;
+
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+    std::string name = "query";
+    LOGMAN_INFO("{} took {}us", name, 42u);
+    logman::warning(LOGMAN_FMT("{{{}}} {} {} {}"), -7, 2.5, true, point{ 1, 2 });
+    logman::error("{} {}", "literal", static_cast<const char*>(nullptr));
+    logman::info(logman::runtime("{} missing"));
+    LOGMAN_DEBUG("{}", [] { ADD_FAILURE(); return 0; }());
+    ASSERT_STREQ(log_get_internal_error(), "");
+    log_destruct();
+
+    const char *expect[] = {
+        "::INFO::query took 42us\n",
+        "::WARNING::{-7} 2.5 true (1,2)\n",
+        "::ERROR::literal (null)\n",
+        "::INFO::{} missing\n",
+    };
+    char buf[256];
+    int lines = 0;
+    FILE *f = fopen(test_file, "r");
+    while (fgets(buf, sizeof(buf), f) != NULL && lines < 4) {
+        ASSERT_STREQ(&buf[19], expect[lines]);
+        lines++;
+    }
+    fclose(f);
+    ASSERT_EQ(lines, 4);
+}
+
+TEST_F(LogmanTests, CallSites)
+{
+    logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
+    settings.type = LOGTYPE_DEBUG;
+    settings.out_type = LOGOUT_FILE;
+    settings.output.file_name = test_file;
+
+    size_t count = log_sites(NULL, 0);
+    std::vector<const logman_site*> sites(count);
+    ASSERT_EQ(log_sites(sites.data(), sites.size()), count);
+    std::vector<const logman_site*> found;
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(sites[i]->func, "test_sites_log") == 0) {
+            found.push_back(sites[i]);
+        }
+    }
+    ASSERT_EQ(found.size(), 2u);
+    EXPECT_STREQ(found[0]->file, "logman_sites.c");
+    EXPECT_EQ(found[1]->line, found[0]->line + 1);
+    EXPECT_EQ(found[0]->level, LOGLEVEL_INFO);
+    EXPECT_EQ(found[1]->level, LOGLEVEL_WARNING);
+    EXPECT_TRUE(found[0]->tail == NULL);
+
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+    test_sites_log();
+    test_sites_log();
+    ASSERT_STREQ(log_get_internal_error(), "");
+    log_destruct();
+    ASSERT_TRUE(found[0]->tail != NULL);
+    EXPECT_STREQ(found[0]->tail, "logman_sites.c::test_sites_log::6::");
+
+    const char *expect[] = {
+        "::INFO::logman_sites.c::test_sites_log::6::site 1\n",
+        "::WARNING::logman_sites.c::test_sites_log::7::site n=2\n",
+    };
+    char buf[256];
+    int lines = 0;
+    FILE *f = fopen(test_file, "r");
+    while (fgets(buf, sizeof(buf), f) != NULL) {
+        ASSERT_STREQ(&buf[19], expect[lines % 2]);
+        lines++;
+    }
+    fclose(f);
+    ASSERT_EQ(lines, 4);
+}
+
+template <typename T>
+static void test_cpp_sites_log(T value)
+{
+    log_info("template site %d", (int)value);
+}
+
+inline void test_cpp_sites_log()
+{
+    log_warning("inline site");
+    test_cpp_sites_log(1);
+    test_cpp_sites_log(2.0);
+}
+
+static std::vector<const logman_site*> cpp_sites_found()
+{
+    std::vector<const logman_site*> sites(log_sites(NULL, 0));
+    sites.resize(log_sites(sites.data(), sites.size()));
+    std::vector<const logman_site*> found;
+    for (const logman_site* site : sites) {
+        if (strcmp(site->func, "test_cpp_sites_log") == 0) {
+            found.push_back(site);
+        }
+    }
+    return found;
+}
+
+TEST_F(LogmanTests, CallSitesCpp)
+{
+    logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
+    settings.type = LOGTYPE_DEBUG;
+    settings.out_type = LOGOUT_FILE;
+    settings.output.file_name = test_file;
+
+    // C++ sites are listed once they have logged, inline and template ones too
+    EXPECT_TRUE(cpp_sites_found().empty());
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+    test_cpp_sites_log();
+    test_cpp_sites_log();
+    ASSERT_STREQ(log_get_internal_error(), "");
+    log_destruct();
+
+    std::vector<const logman_site*> found = cpp_sites_found();
+    ASSERT_EQ(found.size(), 3u);
+    EXPECT_STREQ(found[0]->file, "logman_mtest.cpp");
+    EXPECT_EQ(found[0]->level, LOGLEVEL_WARNING);
+    EXPECT_EQ(found[1]->level, LOGLEVEL_INFO);
+    EXPECT_EQ(found[2]->line, found[1]->line);
+    EXPECT_NE(found[2], found[1]);
+}
+
+TEST_F(LogmanTests, RateLimitedLog)
+{
+    logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
+    settings.type = LOGTYPE_PRODUCT;
+    settings.out_type = LOGOUT_FILE;
+    settings.output.file_name = test_file;
+
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+    for (int i = 0; i < 7; i++) {
+        log_every_n(LOGLEVEL_ERROR, 3, "every %d", i);
+        log_first_n(LOGLEVEL_INFO, 2, "first %d", i);
+        log_every_ms(LOGLEVEL_WARNING, 60000, "interval %d", i);
+        log_rate(LOGLEVEL_INFO, 0.001, 1, "rate %d", i);
+        log_every_n(LOGLEVEL_DEBUG, 1, "filtered %d", i);
+    }
+    ASSERT_STREQ(log_get_internal_error(), "");
+    log_destruct();
+
+    const char *expect[] = {
+        "::ERROR::every 0\n",
+        "::INFO::first 0\n",
+        "::WARNING::interval 0\n",
+        "::INFO::rate 0\n",
+        "::INFO::first 1\n",
+        "::ERROR::every 3 [suppressed 2]\n",
+        "::ERROR::every 6 [suppressed 2]\n",
+    };
+    char buf[256];
+    int lines = 0;
+    FILE *f = fopen(test_file, "r");
+    while (fgets(buf, sizeof(buf), f) != NULL && lines < 7) {
+        ASSERT_STREQ(&buf[19], expect[lines]);
+        lines++;
+    }
+    ASSERT_EQ(fgets(buf, sizeof(buf), f), nullptr);
+    fclose(f);
+    ASSERT_EQ(lines, 7);
+}
+
+TEST_F(LogmanTests, Stats)
+{
+    const char *sink_file = "log_sink.txt";
+    logman_sink_settings sink;
+    memset(&sink, 0, sizeof(sink));
+    sink.out_type = LOGOUT_FILE;
+    sink.output.file_name = sink_file;
+    sink.min_level = LOGLEVEL_ERROR;
+
+    logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
+    settings.type = LOGTYPE_PRODUCT;
+    settings.out_type = LOGOUT_FILE;
+    settings.output.file_name = test_file;
+    settings.max_message_size = 1024;
+    settings.stats_latency = true;
+    settings.sinks = &sink;
+    settings.sinks_count = 1;
+
+    // the counters start over with every log_init()
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+    log_info("before init");
+    log_destruct();
+
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+    std::string large(2048, 'x');
+    log_debug("filtered");
+    log_info("info");
+    log_warning("%s", large.c_str());
+    std::thread([] { log_error("error"); }).join();
+    log_destruct();
+
+    logman_stats stats;
+    log_get_stats(&stats);
+    EXPECT_EQ(stats.records[LOGLEVEL_DEBUG], 0u);
+    EXPECT_EQ(stats.records[LOGLEVEL_INFO], 1u);
+    EXPECT_EQ(stats.records[LOGLEVEL_WARNING], 1u);
+    EXPECT_EQ(stats.records[LOGLEVEL_ERROR], 1u);
+    EXPECT_EQ(stats.truncated, 1u);
+    EXPECT_EQ(stats.dropped, 0u);
+    EXPECT_EQ(stats.write_errors, 0u);
+    EXPECT_GE(stats.write_calls, 2u);
+
+    struct stat st;
+    ASSERT_EQ(stat(test_file, &st), 0);
+    EXPECT_EQ(stats.bytes, (unsigned long long)st.st_size);
+    ASSERT_EQ(stat(sink_file, &st), 0);
+    EXPECT_EQ(stats.sink_bytes[0], (unsigned long long)st.st_size);
+    EXPECT_EQ(stats.sink_bytes[1], 0u);
+
+    unsigned long long timed = 0;
+    for (int i = 0; i < LOGMAN_LATENCY_BUCKETS; i++) {
+        timed += stats.latency[i];
+    }
+    EXPECT_EQ(timed, 3u);
+    remove(sink_file);
+}
+
+static std::string read_log_file(void)
+{
+    std::string out;
+    char buf[512];
+    FILE *f = fopen(test_file, "r");
+    while (f != NULL && fgets(buf, sizeof(buf), f) != NULL) {
+        out += buf;
+    }
+    if (f != NULL) {
+        fclose(f);
+    }
+    return out;
+}
+
+TEST_F(LogmanTests, FlightRecorder)
+{
+    logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
+    settings.type = LOGTYPE_PRODUCT;
+    settings.out_type = LOGOUT_FILE;
+    settings.output.file_name = test_file;
+    settings.recorder_size = 4;
+
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+    for (int i = 0; i < 6; i++) {
+        log_debug("step %d of %s", i, "six");
+    }
+    log_info("info");
+    log_flush();
+    // records below the output level stay in the recorder
+    std::string out = read_log_file();
+    EXPECT_EQ(out.find("step"), std::string::npos);
+    EXPECT_NE(out.find("::INFO::info\n"), std::string::npos);
+
+    log_error("failed");
+    log_flush();
+    out = read_log_file();
+    size_t dump = out.find("LOGMAN_RECENT::thread 0\n");
+    ASSERT_NE(dump, std::string::npos);
+    EXPECT_EQ(out.find("step 2 of six"), std::string::npos);
+    size_t step = out.find("::DEBUG::");
+    ASSERT_NE(step, std::string::npos);
+    EXPECT_NE(out.find("::TestBody::", step), std::string::npos);
+    EXPECT_NE(out.find("::step 3 of six\n", step), std::string::npos);
+    EXPECT_NE(out.find("::step 5 of six\n", step), std::string::npos);
+    EXPECT_LT(out.find("::info\n", step), out.find("::ERROR::failed\n"));
+
+    // a dump writes only what was recorded after the previous one
+    log_debug("after");
+    std::thread([] { log_debug("other thread"); }).join();
+    log_dump_recent();
+    log_flush();
+    out = read_log_file();
+    EXPECT_EQ(out.find("step 5 of six", out.find("::ERROR::failed\n")), std::string::npos);
+    EXPECT_NE(out.find("::after\n"), std::string::npos);
+    EXPECT_NE(out.find("::other thread\n"), std::string::npos);
+
+    // a format buffer is recorded as text, it may change or go away before the dump
+    {
+        std::string fmt = "buffer %d";
+        log_debug(fmt.c_str(), 7);
+        fmt = "changed %d";
+    }
+    log_dump_recent();
+    log_flush();
+    out = read_log_file();
+    EXPECT_NE(out.find("::buffer 7\n"), std::string::npos);
+    ASSERT_STREQ(log_get_internal_error(), "");
+}
+
+TEST_F(LogmanTests, Instances)
+{
+    const char *net_file = "log_net.txt";
+    const char *store_file = "log_store.txt";
+    logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
+    settings.type = LOGTYPE_PRODUCT;
+    settings.out_type = LOGOUT_FILE;
+
+    settings.output.file_name = test_file;
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+    settings.output.file_name = net_file;
+    logman_t *net = logman_create(&settings);
+    ASSERT_NE(net, nullptr);
+    settings.type = LOGTYPE_DEBUG;
+    settings.output.file_name = store_file;
+    logman_t *store = logman_create(&settings);
+    ASSERT_NE(store, nullptr);
+
+    log_info("default %d", 1);
+    logman_log(net, LOGLEVEL_DEBUG, "filtered");
+    logman_log(net, LOGLEVEL_INFO, "net %d", 2);
+    logman_log_kv(net, LOGLEVEL_WARNING, "net kv", LOGKV_INT("id", 3));
+    int store_line = __LINE__ + 1;
+    std::thread([store] { logman_log(store, LOGLEVEL_DEBUG, "store %s", "debug"); }).join();
+    logman_set_level(store, LOGLEVEL_ERROR);
+    logman_log(store, LOGLEVEL_WARNING, "filtered");
+    ASSERT_STREQ(logman_get_internal_error(net), "");
+    ASSERT_EQ(logman_flush(net), LOGERR_NOERR);
+    logman_destroy(net);
+    logman_destroy(store);
+    log_destruct();
+
+    auto read = [](const char *name) {
+        std::string out;
+        char buf[256];
+        FILE *f = fopen(name, "r");
+        while (f != NULL && fgets(buf, sizeof(buf), f) != NULL) {
+            out += &buf[DATE_PREFIX_LEN];
+        }
+        if (f != NULL) {
+            fclose(f);
+        }
+        return out;
+    };
+    EXPECT_EQ(read(test_file), "::INFO::default 1\n");
+    EXPECT_EQ(read(net_file), "::INFO::net 2\n::WARNING::net kv id=3\n");
+    EXPECT_EQ(read(store_file), "::DEBUG::logman_mtest.cpp::operator()::" +
+        std::to_string(store_line) + "::store debug\n");
+
+    // a failed setup leaves no instance behind
+    settings.out_type = LOGOUT_UNKNOWN;
+    EXPECT_EQ(logman_create(&settings), nullptr);
+    remove(net_file);
+    remove(store_file);
+}
+
+TEST_F(LogmanTests, FileDirect)
+{
+    logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
+    settings.type = LOGTYPE_PRODUCT;
+    settings.out_type = LOGOUT_FILE;
+    settings.output.file_name = test_file;
+    settings.file_buffer_size = 5000;
+    settings.file_direct = true;
+
+    logman_error init = log_init(&settings);
+    if (init == LOGERR_LOGFILECREATE) {
+        GTEST_SKIP() << "no O_DIRECT support for " << test_file;
+    }
+    ASSERT_EQ(init, LOGERR_NOERR);
+    std::string expect;
+    for (int i = 0; i < 300; i++) {
+        log_info("record %d", i);
+        expect += "::INFO::record " + std::to_string(i) + "\n";
+        if (i % 100 == 0) {
+            ASSERT_EQ(log_flush(), LOGERR_NOERR);
+        }
+    }
+    ASSERT_STREQ(log_get_internal_error(), "");
+    log_destruct();
+
+    // the records of an existing file stay, the padding of its last block does not
+    settings.file_append = true;
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+    log_warning("appended");
+    expect += "::WARNING::appended\n";
+    log_destruct();
+
+    std::string out;
+    char buf[256];
+    FILE *f = fopen(test_file, "r");
+    ASSERT_NE(f, nullptr);
+    while (fgets(buf, sizeof(buf), f) != NULL) {
+        out += &buf[DATE_PREFIX_LEN];
+    }
+    fclose(f);
+    EXPECT_EQ(out, expect);
+}
+
+TEST_F(LogmanTests, ReaderFence)
+{
+    long cmds = syscall(SYS_membarrier, MEMBARRIER_CMD_QUERY, 0);
+    if (cmds < 0 || (cmds & MEMBARRIER_CMD_PRIVATE_EXPEDITED) == 0) {
+        GTEST_SKIP() << "no expedited membarrier()";
+    }
+    // records skip the full fence without any log_reconfigure()
+    ASSERT_EQ(log_init_default(), LOGERR_NOERR);
+    EXPECT_FALSE(__atomic_load_n(&log_rcu_fence, __ATOMIC_RELAXED));
+}
+
+TEST_F(LogmanTests, Reconfigure)
+{
+    logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
+    settings.type = LOGTYPE_PRODUCT;
+    settings.out_type = LOGOUT_FILE;
+    settings.output.file_name = test_file;
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+    char* err_message = log_get_internal_error();
+
+    // no record is lost or cut while the settings change under the writers, the full async queue aside
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([t] {
+            for (int i = 0; i < 2000; i++) {
+                log_info("thread %d record %d", t, i);
+            }
+        });
+    }
+    for (int i = 0; i < 20; i++) {
+        settings.type = (i % 2 == 0) ? LOGTYPE_DEBUG : LOGTYPE_PRODUCT;
+        settings.mode = (i % 4 < 2) ? LOGMODE_ASYNC : LOGMODE_SYNC;
+        ASSERT_EQ(log_reconfigure(&settings), LOGERR_NOERR);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(__log_min_level, LOGLEVEL_INFO);
+    log_debug("filtered");
+
+    settings.out_type = LOGOUT_BINARY;
+    EXPECT_EQ(log_reconfigure(&settings), LOGERR_LOGRECONFIGURE);
+    EXPECT_EQ(log_get_internal_error(), err_message);
+    EXPECT_STREQ(err_message, "LOGMAN_ERROR::Binary and mmap outputs cannot be reconfigured\n");
+    logman_stats stats;
+    log_get_stats(&stats);
+    log_destruct();
+
+    std::string out = read_log_file();
+    size_t lines = 0;
+    for (size_t pos = 0; (pos = out.find("::INFO::", pos)) != std::string::npos; pos++) {
+        lines++;
+    }
+    EXPECT_EQ(lines + stats.dropped, 8000u);
+    EXPECT_EQ((size_t)std::count(out.begin(), out.end(), '\n'), lines);
+}
+
+TEST_F(LogmanTests, ReconfigureSignal)
+{
+    logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
+    settings.type = LOGTYPE_PRODUCT;
+    settings.out_type = LOGOUT_FILE;
+    settings.output.file_name = test_file;
+    settings.reconfigure_signal = true;
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+
+    auto wait_level = [](int level) {
+        for (int i = 0; i < 1000 && __atomic_load_n(&__log_min_level, __ATOMIC_RELAXED) != level; i++) {
+            usleep(1000);
+        }
+        return __atomic_load_n(&__log_min_level, __ATOMIC_RELAXED);
+    };
+    log_debug("hidden 1");
+    raise(SIGUSR1);
+    ASSERT_EQ(wait_level(LOGLEVEL_DEBUG), LOGLEVEL_DEBUG);
+    log_debug("shown");
+    raise(SIGUSR1);
+    ASSERT_EQ(wait_level(LOGLEVEL_INFO), LOGLEVEL_INFO);
+    log_debug("hidden 2");
+    log_destruct();
+
+    std::string out = read_log_file();
+    EXPECT_NE(out.find("::DEBUG::logman_mtest.cpp::TestBody::"), std::string::npos);
+    EXPECT_NE(out.find("::shown\n"), std::string::npos);
+    EXPECT_EQ(out.find("hidden"), std::string::npos);
+}
+
+static std::string decompress_log_file(const char* file_name, logman_error* err)
+{
+    FILE* in = fopen(file_name, "rb");
+    char* data = NULL;
+    size_t size = 0;
+    FILE* out = open_memstream(&data, &size);
+    *err = (in != NULL) ? log_compress_decode(in, out) : LOGERR_LOGFILECREATE;
+    fclose(out);
+    if (in != NULL) {
+        fclose(in);
+    }
+    std::string text(data, size);
+    free(data);
+    return text;
+}
+
+TEST_F(LogmanTests, FileCompress)
+{
+    for (logman_compress codec : { LOGCOMPRESS_LZ4, LOGCOMPRESS_ZSTD }) {
+        logman_settings settings;
+        memset(&settings, 0, sizeof(logman_settings));
+        settings.type = LOGTYPE_PRODUCT;
+        settings.out_type = LOGOUT_FILE;
+        settings.output.file_name = test_file;
+        settings.file_buffer_size = 8192;
+        settings.file_compress = codec;
+        if (!log_compress_available(codec)) {
+            EXPECT_EQ(log_init(&settings), LOGERR_LOGCOMPRESS);
+            log_destruct();
+            continue;
+        }
+
+        ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+        std::string expect;
+        for (int i = 0; i < 3000; i++) {
+            log_info("request %d done", i);
+            expect += "::INFO::request " + std::to_string(i) + " done\n";
+            if (i == 1000) {
+                ASSERT_EQ(log_flush(), LOGERR_NOERR);
+            }
+        }
+        ASSERT_STREQ(log_get_internal_error(), "");
+        log_destruct();
+
+        struct stat st;
+        ASSERT_EQ(stat(test_file, &st), 0);
+        EXPECT_LT((size_t)st.st_size, expect.size() / 4);
+        logman_error err;
+        std::string text = decompress_log_file(test_file, &err);
+        ASSERT_EQ(err, LOGERR_NOERR);
+        std::string out;
+        for (size_t pos = 0; pos < text.size(); ) {
+            size_t end = text.find('\n', pos);
+            out += text.substr(pos + DATE_PREFIX_LEN, end + 1 - pos - DATE_PREFIX_LEN);
+            pos = end + 1;
+        }
+        EXPECT_EQ(out, expect);
+
+        // a frame cut by a crash costs that frame only
+        ASSERT_EQ(truncate(test_file, st.st_size - 3), 0);
+        std::string cut = decompress_log_file(test_file, &err);
+        EXPECT_EQ(err, LOGERR_LOGBADFORMAT);
+        EXPECT_GT(cut.size(), text.size() / 2);
+        EXPECT_EQ(text.compare(0, cut.size(), cut), 0);
+        remove(test_file);
+    }
+}
+
+static std::string query_log_file(time_t from, time_t to, logman_level min_level)
+{
+    logman_query query = { from, to, min_level };
+    char* data = NULL;
+    size_t size = 0;
+    FILE* out = open_memstream(&data, &size);
+    EXPECT_EQ(log_index_query(test_file, &query, out), LOGERR_NOERR);
+    fclose(out);
+    std::string text(data, size);
+    free(data);
+    return text;
+}
+
+static size_t count_lines(const std::string& text, const char* part)
+{
+    size_t count = 0;
+    for (size_t pos = 0; (pos = text.find(part, pos)) != std::string::npos; pos++) {
+        count++;
+    }
+    return count;
+}
+
+TEST_F(LogmanTests, FileIndex)
+{
+    std::string index_file = std::string(test_file) + ".idx";
+    for (logman_format format : { LOGFORMAT_PRODUCT, LOGFORMAT_JSON }) {
+        logman_settings settings;
+        memset(&settings, 0, sizeof(logman_settings));
+        settings.type = LOGTYPE_PRODUCT;
+        settings.out_type = LOGOUT_FILE;
+        settings.output.file_name = test_file;
+        settings.format = format;
+        settings.time_format = (format == LOGFORMAT_JSON) ? LOGTIME_ISO8601_UTC : LOGTIME_LOCAL;
+        settings.file_index = true;
+        settings.index_block_size = 1024;
+        ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+
+        time_t start = time(NULL);
+        for (int i = 0; i < 2000; i++) {
+            if (i % 500 == 7) {
+                log_error("failure %d\nsecond line", i);
+            } else if (i % 100 == 3) {
+                log_warning("slow %d", i);
+            } else {
+                log_info("request %d", i);
+            }
+        }
+        log_destruct();
+        time_t end = time(NULL);
+
+        struct stat st;
+        ASSERT_EQ(stat(index_file.c_str(), &st), 0);
+        EXPECT_GT(((size_t)st.st_size - INDEX_MAGIC_LEN) / sizeof(logman_index_entry), 10u);
+        EXPECT_EQ(((size_t)st.st_size - INDEX_MAGIC_LEN) % sizeof(logman_index_entry), 0u);
+
+        std::string all = query_log_file(0, 0, LOGLEVEL_DEBUG);
+        EXPECT_EQ(all, read_log_file());
+        std::string errors = query_log_file(start, end, LOGLEVEL_ERROR);
+        EXPECT_EQ(count_lines(errors, "ERROR"), 4u);
+        EXPECT_EQ(count_lines(errors, "failure 1007"), 1u);
+        if (format == LOGFORMAT_PRODUCT) {
+            // the rest of a record belongs to it
+            EXPECT_EQ(count_lines(errors, "\nsecond line\n"), 4u);
+        }
+        EXPECT_EQ(count_lines(query_log_file(0, 0, LOGLEVEL_WARNING), "WARNING"), 20u);
+        EXPECT_EQ(query_log_file(end + 10, 0, LOGLEVEL_DEBUG), "");
+        EXPECT_EQ(query_log_file(0, start - 10, LOGLEVEL_DEBUG), "");
+
+        // without the index the whole file is scanned
+        remove(index_file.c_str());
+        EXPECT_EQ(count_lines(query_log_file(start, end, LOGLEVEL_ERROR), "ERROR"), 4u);
+    }
+
+    logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
+    settings.type = LOGTYPE_PRODUCT;
+    settings.out_type = LOGOUT_FILE;
+    settings.output.file_name = test_file;
+    settings.file_index = true;
+    settings.rotate_size = 4096;
+    EXPECT_EQ(log_init(&settings), LOGERR_LOGINDEX);
+}
+
+TEST_F(LogmanTests, TimeTsc)
+{
+    logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
+    settings.type = LOGTYPE_PRODUCT;
+    settings.out_type = LOGOUT_FILE;
+    settings.output.file_name = test_file;
+    settings.time_precision = LOGPREC_NSEC;
+    settings.time_format = LOGTIME_ISO8601_UTC;
+    settings.time_tsc = true;
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+
+    time_t start = time(NULL);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([t] {
+            for (int i = 0; i < 2000; i++) {
+                log_info("thread %d record %d", t, i);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    ASSERT_STREQ(log_get_internal_error(), "");
+    log_destruct();
+    time_t end = time(NULL);
+
+    // the ISO dates of one thread compare as strings, they never go back
+    std::string out = read_log_file();
+    std::string last[4];
+    size_t lines = 0;
+    for (size_t pos = 0; pos < out.size(); lines++) {
+        size_t eol = out.find('\n', pos);
+        std::string line = out.substr(pos, eol - pos);
+        pos = eol + 1;
+        int t = line[line.find("thread ") + 7] - '0';
+        ASSERT_TRUE(t >= 0 && t < 4);
+        std::string date = line.substr(0, line.find("::"));
+        EXPECT_EQ(date.size(), 30u);
+        EXPECT_LE(last[t], date);
+        last[t] = date;
+
+        time_t sec = 0;
+        ASSERT_EQ(log_query_parse_time(date.c_str(), date.size(), &sec), 30u);
+        EXPECT_GE(sec, start);
+        EXPECT_LE(sec, end);
+    }
+    EXPECT_EQ(lines, 8000u);
+}
+
+static const char* test_socket = "log.sock";
+
+static int bind_unix_listener(void)
+{
+    unlink(test_socket);
+    int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, test_socket);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// datagrams that arrive until the socket stays quiet for 200 ms
+static std::vector<std::string> receive_datagrams(int fd)
+{
+    std::vector<std::string> out;
+    char buf[70000];
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    while (poll(&pfd, 1, 200) > 0) {
+        ssize_t len = recv(fd, buf, sizeof(buf), 0);
+        if (len < 0) {
+            break;
+        }
+        out.emplace_back(buf, (size_t)len);
+    }
+    return out;
+}
+
+TEST_F(LogmanTests, SocketUnix)
+{
+    std::string address = std::string("unix:") + test_socket;
+    int fd = bind_unix_listener();
+    ASSERT_GE(fd, 0);
+
+    logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
+    settings.type = LOGTYPE_PRODUCT;
+    settings.out_type = LOGOUT_SOCKET;
+    settings.output.address = address.c_str();
+    settings.socket_batch = 16;
+    settings.socket_policy = LOGSOCKET_BLOCK;
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+    // the queue of a unix datagram socket is short, the writer waits for the collector
+    std::vector<std::string> got;
+    std::thread collector([&] { got = receive_datagrams(fd); });
+    for (int i = 0; i < 100; i++) {
+        log_info("record %d", i);
+    }
+    EXPECT_EQ(log_flush(), LOGERR_NOERR);
+    collector.join();
+    ASSERT_EQ(got.size(), 100u);
+    EXPECT_EQ(got[42].substr(19), "::INFO::record 42\n");
+
+    // the collector restarts, what is logged while it is away is dropped
+    close(fd);
+    log_info("lost");
+    EXPECT_EQ(log_flush(), LOGERR_LOGWRITE);
+    fd = bind_unix_listener();
+    ASSERT_GE(fd, 0);
+    log_info("lost too");
+    log_flush();
+    usleep((SOCKET_RECONNECT_MS + 50) * 1000);
+    log_info("back");
+    EXPECT_EQ(log_flush(), LOGERR_NOERR);
+    got = receive_datagrams(fd);
+    ASSERT_EQ(got.size(), 1u);
+    EXPECT_EQ(got[0].substr(19), "::INFO::back\n");
+    logman_stats stats;
+    log_get_stats(&stats);
+    EXPECT_EQ(stats.dropped, 2u);
+    log_destruct();
+    close(fd);
+    unlink(test_socket);
+}
+
+TEST_F(LogmanTests, SocketDropPolicy)
+{
+    std::string address = std::string("unix:") + test_socket;
+    int fd = bind_unix_listener();
+    ASSERT_GE(fd, 0);
+
+    logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
+    settings.type = LOGTYPE_PRODUCT;
+    settings.out_type = LOGOUT_SOCKET;
+    settings.output.address = address.c_str();
+    settings.socket_policy = LOGSOCKET_DROP;
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+    // nobody reads, the queue of the listener fills up
+    for (int i = 0; i < 5000; i++) {
+        log_info("record %d", i);
+    }
+    log_flush();
+    logman_stats stats;
+    log_get_stats(&stats);
+    std::vector<std::string> got = receive_datagrams(fd);
+    EXPECT_GT(stats.dropped, 0u);
+    EXPECT_EQ(got.size() + stats.dropped, 5000u);
+    log_destruct();
+    close(fd);
+    unlink(test_socket);
+}
+
+TEST_F(LogmanTests, SocketUdpSyslog)
+{
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(bind(fd, (struct sockaddr*)&addr, sizeof(addr)), 0);
+    socklen_t addr_len = sizeof(addr);
+    ASSERT_EQ(getsockname(fd, (struct sockaddr*)&addr, &addr_len), 0);
+    std::string address = "udp:127.0.0.1:" + std::to_string(ntohs(addr.sin_port));
+
+    logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
+    settings.type = LOGTYPE_PRODUCT;
+    settings.out_type = LOGOUT_SOCKET;
+    settings.output.address = address.c_str();
+    settings.format = LOGFORMAT_JSON;
+    settings.socket_syslog = true;
+    settings.flush_on_error = true;
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+    for (int i = 0; i < 63; i++) {
+        log_info("started");
+    }
+    log_error("failed");
+    std::vector<std::string> got = receive_datagrams(fd);
+    ASSERT_EQ(got.size(), 64u);
+    logman_stats stats;
+    log_get_stats(&stats);
+    // a sendmmsg() call per batch, the periodic flush may cut one in two
+    EXPECT_LE(stats.write_calls, 2u);
+    got.erase(got.begin() + 1, got.end() - 1);
+    // <PRI>1 TIMESTAMP HOSTNAME APP-NAME PROCID MSGID STRUCTURED-DATA MSG, facility user
+    EXPECT_EQ(got[0].substr(0, 7), "<14>1 2");
+    EXPECT_EQ(got[1].substr(0, 7), "<11>1 2");
+    EXPECT_EQ(got[1][32], 'Z');
+    std::string tail = " " + std::to_string(getpid()) + " - - {";
+    EXPECT_NE(got[1].find(tail), std::string::npos);
+    EXPECT_NE(got[1].find("\"msg\":\"failed\""), std::string::npos);
+    EXPECT_NE(got[1].back(), '\n');
+    log_destruct();
+    close(fd);
+
+    settings.output.address = "tcp:127.0.0.1:514";
+    EXPECT_EQ(log_init(&settings), LOGERR_LOGSOCKET);
+}
+
+static void sleep_2ms(void)
+{
+    usleep(2000);
+}
+
+static void no_work(void)
+{
+}
+
+static unsigned long long duration_of(const std::string& out, const std::string& name)
+{
+    size_t pos = out.find(name + " duration_ns=");
+    if (pos == std::string::npos) {
+        return 0;
+    }
+    return std::stoull(out.substr(pos + name.size() + 13));
+}
+
+TEST_F(LogmanTests, ScopeTimers)
+{
+    const char* trace_file = "trace.json";
+    logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
+    settings.type = LOGTYPE_DEBUG;
+    settings.out_type = LOGOUT_FILE;
+    settings.output.file_name = test_file;
+    settings.timer_threshold_us = 1000;
+    settings.trace_file = trace_file;
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+
+    test_timers_log(sleep_2ms);
+    test_timers_log(no_work);
+    int line = __LINE__ + 2;
+    {
+        logman::scope_timer timer("cpp");
+        usleep(2000);
+    }
+    {
+        LOGMAN_SCOPE_TIMER("short");
+    }
+    // timers started below the threshold level do nothing
+    log_set_level(LOGLEVEL_WARNING);
+    test_timers_log(sleep_2ms);
+    log_set_level(LOGLEVEL_DEBUG);
+    ASSERT_STREQ(log_get_internal_error(), "");
+    log_destruct();
+
+    std::string out = read_log_file();
+    EXPECT_EQ(count_lines(out, "duration_ns="), 3u);
+    size_t inner = out.find("::INFO::logman_sites.c::test_timers_log::15::inner duration_ns=");
+    size_t outer = out.find("::INFO::logman_sites.c::test_timers_log::13::outer duration_ns=");
+    ASSERT_NE(inner, std::string::npos);
+    ASSERT_NE(outer, std::string::npos);
+    EXPECT_LT(inner, outer);
+    std::string cpp_site = "::INFO::logman_mtest.cpp::TestBody::" + std::to_string(line) + "::cpp duration_ns=";
+    EXPECT_NE(out.find(cpp_site), std::string::npos);
+    EXPECT_GE(duration_of(out, "inner"), 2000000u);
+    EXPECT_GE(duration_of(out, "outer"), duration_of(out, "inner"));
+    EXPECT_LT(duration_of(out, "outer"), 1000000000u);
+
+    // the threshold does not apply to the trace, the level does
+    FILE* f = fopen(trace_file, "r");
+    ASSERT_TRUE(f != NULL);
+    std::string trace;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        trace.append(buf, n);
+    }
+    fclose(f);
+    remove(trace_file);
+    EXPECT_EQ(trace.substr(0, 2), "[\n");
+    EXPECT_EQ(count_lines(trace, "\"ph\":\"X\""), 6u);
+    EXPECT_EQ(count_lines(trace, "{\"name\":\"short\",\"cat\":\"logman\",\"ph\":\"X\",\"ts\":"), 1u);
+    EXPECT_EQ(count_lines(trace, "\"args\":{\"file\":\"logman_sites.c\",\"func\":\"test_timers_log\",\"line\":15}},\n"),
+        2u);
+    EXPECT_EQ(trace.substr(trace.size() - 4), "}}]\n");
+}
+
+TEST_F(LogmanTests, ReconfigureTrace)
+{
+    const char* trace_file = "trace.json";
+    logman_settings settings;
+    memset(&settings, 0, sizeof(logman_settings));
+    settings.type = LOGTYPE_DEBUG;
+    settings.out_type = LOGOUT_FILE;
+    settings.output.file_name = test_file;
+    settings.trace_file = trace_file;
+    ASSERT_EQ(log_init(&settings), LOGERR_NOERR);
+
+    // the same trace file is continued across the switches, under another spelling too
+    test_timers_log(no_work);
+    settings.mode = LOGMODE_ASYNC;
+    ASSERT_EQ(log_reconfigure(&settings), LOGERR_NOERR);
+    test_timers_log(no_work);
+    settings.trace_file = "./trace.json";
+    ASSERT_EQ(log_reconfigure(&settings), LOGERR_NOERR);
+    test_timers_log(no_work);
+    ASSERT_STREQ(log_get_internal_error(), "");
+    log_destruct();
+
+    FILE* f = fopen(trace_file, "r");
+    ASSERT_TRUE(f != NULL);
+    std::string trace;
+    char buf[4096];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        trace.append(buf, n);
+    }
+    fclose(f);
+    remove(trace_file);
+    // a single array holds the events of every instance
+    EXPECT_EQ(trace.substr(0, 2), "[\n");
+    EXPECT_EQ(std::count(trace.begin(), trace.end(), '['), 1);
+    EXPECT_EQ(std::count(trace.begin(), trace.end(), ']'), 1);
+    EXPECT_EQ(count_lines(trace, "\"ph\":\"X\""), 6u);
+    EXPECT_EQ(count_lines(trace, "\"ph\":\"M\""), 1u);
+    EXPECT_EQ(trace.substr(trace.size() - 4), "}}]\n");
+}
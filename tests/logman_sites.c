@@ -0,0 +1,19 @@
+#include "../include/logman/logman.h"
+
+/* Log statements of a C translation unit, only those are collected in the logman_sites section */
+void test_sites_log(void)
+{
+    log_info("site %d", 1);
+    log_warning_kv("site", LOGKV_INT("n", 2));
+}
+
+/* Span around a block with a scope timer, the timer ends with the block */
+void test_timers_log(void (*work)(void))
+{
+    log_span_begin(outer, "outer");
+    {
+        log_scope_timer("inner");
+        work();
+    }
+    log_span_end(outer);
+}
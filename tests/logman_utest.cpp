@@ -1,31 +1,44 @@
+#include <fcntl.h>
 #include <gtest/gtest.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
 
 extern "C" {
     #include "../src/logman_int.h"
 
     extern logman_src log_obj;
-    extern logman_error log_buffers_init(void);
-    extern void log_write_std(char *buf);
-    extern void log_write_file(char *buf);
+    extern logman_error log_buffers_init(logman_src* obj);
+    extern void log_write_std(logman_src* obj, const char *buf, size_t len, logman_level level);
+    extern void log_write_file(logman_src* obj, const char *buf, size_t len, logman_level level);
     extern void log_error_callback_default(void);
-    extern void log_form_debug_message(logman_level level, const char* file, const char* func, const int line, 
+    extern logman_tls* log_tls_get(void);
+    extern void log_tls_destruct(void);
+    extern size_t log_form_debug_message(logman_src* obj, logman_tls* tls, logman_level level, logman_site* site,
         const char* message, va_list va);
-    extern void log_date_update(void);
+    extern void log_date_update(logman_src* obj, logman_tls* tls);
     extern void log_error_callback_default(void);
-    extern void log_write_int_err(const char* message, ...);
-    extern logman_error log_set_out_file(const char* file_name);
-    extern void log_form_product_message(logman_level level, const char* file, const char* func, const int line, 
+    extern void log_write_int_err(logman_src* obj, const char* message, ...);
+    extern logman_error log_set_out_file(logman_src* obj, const char* file_name);
+    extern size_t log_form_product_message(logman_src* obj, logman_tls* tls, logman_level level, logman_site* site,
         const char* message, va_list va);
+    extern void log_write_async(logman_src* obj, const char *buf, size_t len, logman_level level);
+    extern uint32_t log_xxh32(const uint8_t* p, size_t len, uint32_t seed);
+    extern size_t log_lz4_block(const uint8_t* src, size_t len, uint8_t* dst, uint32_t* table);
+    extern size_t log_lz4_unblock(const uint8_t* src, size_t len, uint8_t* dst, size_t cap);
 }
 
 const char* test_log_file = "log.txt";
+logman_site test_site = { "file", "func", 3, LOGLEVEL_INFO, false, 0, NULL, false };
 
 class TestLogmanFix : public ::testing::Test
 {
 protected:
     void SetUp()
     {
-        log_buffers_init();
+        log_buffers_init(&log_obj);
         log_obj.error_callback = log_error_callback_default;
     }
     void TearDown()
@@ -36,18 +49,18 @@ protected:
 
 TEST_F(TestLogmanFix, InternalBuffersInit) 
 {
-    ASSERT_EQ(log_buffers_init(), LOGERR_NOERR);
-    EXPECT_TRUE(log_obj.date_buf != NULL);
-    EXPECT_TRUE(log_obj.message_buf != NULL);
+    ASSERT_EQ(log_buffers_init(&log_obj), LOGERR_NOERR);
     EXPECT_TRUE(log_obj.err_message != NULL);
+    EXPECT_TRUE(log_tls_get() != NULL);
 }
 
 TEST_F(TestLogmanFix, InternalBuffersDestruct) 
 {
     log_destruct();
-    EXPECT_TRUE(log_obj.date_buf == NULL);
-    EXPECT_TRUE(log_obj.message_buf == NULL);
     EXPECT_TRUE(log_obj.err_message == NULL);
+    // the calling thread gets fresh buffers on the next record
+    EXPECT_TRUE(log_tls_get() != NULL);
+    log_tls_destruct();
 }
 
 TEST_F(TestLogmanFix, GetInternalError) 
@@ -59,14 +72,14 @@ TEST_F(TestLogmanFix, GetInternalError)
 TEST_F(TestLogmanFix, WriteInternalError) 
 {
     const char expect[] = "there is an internal error 15";
-    log_write_int_err("there is an internal error %d", 15);
+    log_write_int_err(&log_obj, "there is an internal error %d", 15);
     EXPECT_STREQ(log_obj.err_message, expect);
 }
 
 TEST(TestLogman, UpdateDateInitErr)
 {
     log_obj.err_message = new(char[128]);
-    log_date_update();
+    log_date_update(&log_obj, NULL);
     EXPECT_STREQ(log_get_internal_error(), "LOGMAN_ERROR::Date buffer uninitialized\n");
     delete(log_obj.err_message);
 }
@@ -78,21 +91,75 @@ TEST_F(TestLogmanFix, UpdateLogDate)
     char* expect = new(char[32]);
     std::snprintf(expect, 32, "%.2i.%.2i.%i %.2i:%.2i:%.2i",
                              tm.tm_mday, tm.tm_mon + 1, tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec);
-    log_date_update();
-    EXPECT_STREQ(expect, log_obj.date_buf);
+    log_date_update(&log_obj, log_tls_get());
+    EXPECT_STREQ(expect, log_tls_get()->date_buf);
+}
+
+TEST(TestLogman, UtoaFixed)
+{
+    char buf[16] = { 0 };
+    log_utoa_fixed(buf, 7, 3);
+    EXPECT_STREQ(buf, "007");
+    log_utoa_fixed(buf, 123456789, 9);
+    EXPECT_STREQ(buf, "123456789");
+    log_utoa_fixed(buf, 2024, 4);
+    EXPECT_STREQ(buf, "202456789");
+}
+
+TEST(TestLogman, RenderTimePrecision)
+{
+    logman_time_cache cache;
+    memset(&cache, 0, sizeof(cache));
+    char buf[DATE_BUF_SIZE];
+    struct timespec ts = { .tv_sec = time(NULL), .tv_nsec = 12345678 };
+
+    struct tm tm;
+    localtime_r(&ts.tv_sec, &tm);
+    char expect[DATE_BUF_SIZE];
+    ASSERT_EQ(std::snprintf(expect, DATE_BUF_SIZE, "%.2i.%.2i.%i %.2i:%.2i:%.2i",
+                             tm.tm_mday, tm.tm_mon + 1, tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec), 19);
+
+    EXPECT_EQ(log_time_render(&cache, buf, &ts, LOGTIME_LOCAL, LOGPREC_SEC), 19);
+    EXPECT_STREQ(buf, expect);
+    EXPECT_EQ(log_time_render(&cache, buf, &ts, LOGTIME_LOCAL, LOGPREC_MSEC), 23);
+    EXPECT_STREQ(buf, (std::string(expect) + ".012").c_str());
+    EXPECT_EQ(log_time_render(&cache, buf, &ts, LOGTIME_LOCAL, LOGPREC_USEC), 26);
+    EXPECT_STREQ(buf, (std::string(expect) + ".012345").c_str());
+    EXPECT_EQ(log_time_render(&cache, buf, &ts, LOGTIME_LOCAL, LOGPREC_NSEC), 29);
+    EXPECT_STREQ(buf, (std::string(expect) + ".012345678").c_str());
+}
+
+TEST(TestLogman, RenderTimeIso)
+{
+    logman_time_cache cache;
+    memset(&cache, 0, sizeof(cache));
+    char buf[DATE_BUF_SIZE];
+    // 18.10.2026 14:02:05 UTC
+    struct timespec ts = { .tv_sec = 1792332125, .tv_nsec = 5000000 };
+
+    EXPECT_EQ(log_time_render(&cache, buf, &ts, LOGTIME_ISO8601_UTC, LOGPREC_MSEC), 24);
+    EXPECT_STREQ(buf, "2026-10-18T14:02:05.005Z");
+    EXPECT_EQ(cache.sec, ts.tv_sec);
+
+    // the cached prefix is kept while the second does not change
+    ts.tv_nsec = 999000000;
+    EXPECT_EQ(log_time_render(&cache, buf, &ts, LOGTIME_ISO8601_UTC, LOGPREC_SEC), 20);
+    EXPECT_STREQ(buf, "2026-10-18T14:02:05Z");
+    ts.tv_sec += 1;
+    log_time_render(&cache, buf, &ts, LOGTIME_ISO8601_UTC, LOGPREC_SEC);
+    EXPECT_STREQ(buf, "2026-10-18T14:02:06Z");
 }
 
 TEST_F(TestLogmanFix, WriteFile)
 {
     const char test_string[] = "hello world!\n";
     char read_buf[32] = {0};
-    FILE* f = fopen(test_log_file, "w");
-    log_obj.out_stream = f;
-    snprintf(log_obj.message_buf, 32, test_string);
-    log_write_file(log_obj.message_buf);
-    fclose(f);
+    ASSERT_EQ(log_set_out_file(&log_obj, test_log_file), LOGERR_NOERR);
+    log_obj.out_type = LOGOUT_FILE;
+    log_write_file(&log_obj, test_string, strlen(test_string), LOGLEVEL_INFO);
+    log_destruct();
 
-    f = fopen(test_log_file, "r");
+    FILE* f = fopen(test_log_file, "r");
     fread((void*)read_buf, sizeof(char), 32, f);
     fclose(f);
     printf("%s\n", read_buf);
@@ -105,9 +172,9 @@ TEST_F(TestLogmanFix, SetOutFile)
     FILE* file = fopen(test_log_file, "r");
     ASSERT_TRUE(file == NULL);
 
-    EXPECT_EQ(log_set_out_file(test_log_file), LOGERR_NOERR);
+    EXPECT_EQ(log_set_out_file(&log_obj, test_log_file), LOGERR_NOERR);
     EXPECT_EQ(log_obj.writer, log_write_file);
-    fclose(log_obj.out_stream);
+    log_destruct();
 
     file = fopen(test_log_file, "r");
     ASSERT_TRUE(file != NULL);
@@ -118,43 +185,99 @@ TEST_F(TestLogmanFix, SetOutFile)
 TEST_F(TestLogmanFix, FormDebugMessage)
 {
     char expect[256];
-    log_date_update();
-    snprintf(expect, 256, "%s::%s::%s::%s::%i::%s\n", log_obj.date_buf, 
+    logman_tls* tls = log_tls_get();
+    log_date_update(&log_obj, tls);
+    snprintf(expect, 256, "%s::%s::%s::%s::%i::%s\n", tls->date_buf, 
         "INFO", "file", "func", 3, "message");
 
     va_list va;
-    log_form_debug_message(LOGLEVEL_INFO, "file", "func", 3, "message", va);
-    EXPECT_STREQ(expect, log_obj.message_buf);
+    EXPECT_EQ(log_form_debug_message(&log_obj, tls, LOGLEVEL_INFO, &test_site, "message", va), strlen(expect));
+    EXPECT_STREQ(expect, tls->message_buf);
+}
+
+TEST_F(TestLogmanFix, FormDebugMessageSite)
+{
+    logman_site site = { "file", "func", 3, LOGLEVEL_INFO, true, 0, NULL, false };
+    logman_tls* tls = log_tls_get();
+
+    va_list va;
+    size_t len = log_form_debug_message(&log_obj, tls, LOGLEVEL_INFO, &site, "message", va);
+    ASSERT_TRUE(site.tail != NULL);
+    EXPECT_STREQ(site.tail, "file::func::3::");
+    EXPECT_EQ(site.tail_len, strlen(site.tail));
+
+    // later records copy the rendered part
+    std::string first(tls->message_buf, len);
+    char* tail = site.tail;
+    EXPECT_EQ(log_form_debug_message(&log_obj, tls, LOGLEVEL_INFO, &site, "message", va), len);
+    EXPECT_EQ(site.tail, tail);
+    EXPECT_EQ(std::string(tls->message_buf, len).substr(DATE_PREFIX_LEN), first.substr(DATE_PREFIX_LEN));
+    free(site.tail);
+
+    // sites on the stack are rendered every time
+    log_form_debug_message(&log_obj, tls, LOGLEVEL_INFO, &test_site, "message", va);
+    EXPECT_TRUE(test_site.tail == NULL);
+}
+
+TEST_F(TestLogmanFix, FormDebugMessageLarge)
+{
+    char large[2049] = { 0 };
+    memset(large, 1, 2048);
+
+    va_list va;
+    logman_tls* tls = log_tls_get();
+    size_t len = log_form_debug_message(&log_obj, tls, LOGLEVEL_INFO, &test_site, large, va);
+    EXPECT_STREQ("", log_obj.err_message);
+    // the whole message is in the spill buffer, message_buf is left for short records
+    EXPECT_EQ(tls->record, tls->spill);
+    EXPECT_GE(tls->spill_size, len + 1);
+    EXPECT_EQ(len, strlen(tls->record));
+    EXPECT_EQ(tls->record[len - 2], 1);
+    EXPECT_EQ(tls->record[len - 1], '\n');
+    EXPECT_EQ(std::string(&tls->record[len - 2049], 2048), std::string(large));
+
+    char* spill = tls->spill;
+    log_form_debug_message(&log_obj, tls, LOGLEVEL_INFO, &test_site, "message", va);
+    EXPECT_EQ(tls->record, tls->message_buf);
+    log_form_debug_message(&log_obj, tls, LOGLEVEL_INFO, &test_site, large, va);
+    EXPECT_EQ(tls->spill, spill);
 }
 
 TEST_F(TestLogmanFix, FormDebugMessageErr)
 {
     char overflow[2049] = { 0 };
-    memset(overflow, 1, 2049);
+    memset(overflow, 1, 2048);
 
     va_list va;
-    log_form_debug_message(LOGLEVEL_INFO, "file", "func", 3, overflow, va);
+    logman_tls* tls = log_tls_get();
+    log_obj.max_message_size = 1024;
+    EXPECT_EQ(log_form_debug_message(&log_obj, tls, LOGLEVEL_INFO, &test_site, overflow, va), 1024 - 1);
     EXPECT_STREQ("LOGMAN_ERROR::Message buffer overflow\n", log_obj.err_message);
+    // the record is cut at the limit, but still terminated inside the buffer
+    EXPECT_EQ(tls->record[1024 - 2], '\n');
+    EXPECT_EQ(tls->record[1024 - 1], '\0');
 }
 
 TEST_F(TestLogmanFix, FormProductMessage)
 {
     char expect[256];
-    log_date_update();
-    snprintf(expect, 256, "%s::%s::%s\n", log_obj.date_buf, "INFO", "message");
+    logman_tls* tls = log_tls_get();
+    log_date_update(&log_obj, tls);
+    snprintf(expect, 256, "%s::%s::%s\n", tls->date_buf, "INFO", "message");
 
     va_list va;
-    log_form_product_message(LOGLEVEL_INFO, "file", "func", 3, "message", va);
-    EXPECT_STREQ(expect, log_obj.message_buf);
+    log_form_product_message(&log_obj, tls, LOGLEVEL_INFO, &test_site, "message", va);
+    EXPECT_STREQ(expect, tls->message_buf);
 }
 
 TEST_F(TestLogmanFix, FormProductMessageErr)
 {
     char overflow[2049] = { 0 };
-    memset(overflow, 1, 2049);
+    memset(overflow, 1, 2048);
 
     va_list va;
-    log_form_product_message(LOGLEVEL_INFO, "file", "func", 3, overflow, va);
+    log_obj.max_message_size = 1024;
+    log_form_product_message(&log_obj, log_tls_get(), LOGLEVEL_INFO, &test_site, overflow, va);
     EXPECT_STREQ("LOGMAN_ERROR::Message buffer overflow\n", log_obj.err_message);
 }
 
@@ -234,16 +357,16 @@ TEST(TestLogman, InitLogman)
 TEST_F(TestLogmanFix, Log)
 {
     log_obj.message_former = log_form_debug_message; 
-    log_obj.writer = log_write_file;
-    log_obj.out_stream = fopen(test_log_file, "w");
+    ASSERT_EQ(log_set_out_file(&log_obj, test_log_file), LOGERR_NOERR);
 
     char expect[256];
-    log_date_update();
-    int len = snprintf(expect, 256, "%s::%s::%s::%s::%i::%s\n", log_obj.date_buf, 
+    log_date_update(&log_obj, log_tls_get());
+    int len = snprintf(expect, 256, "%s::%s::%s::%s::%i::%s\n", log_tls_get()->date_buf, 
         "INFO", "file", "func", 2, "message");
     
     __log_log(LOGLEVEL_INFO, "file", "func", 2, "message");
-    fclose(log_obj.out_stream);
+    EXPECT_EQ(log_flush(), LOGERR_NOERR);
+    log_destruct();
 
     char buf[256];
     memset(buf, 0, 256);
@@ -255,10 +378,619 @@ TEST_F(TestLogmanFix, Log)
     remove(test_log_file);
 }
 
+TEST(TestLogman, ThreadBuffers)
+{
+    logman_tls* main_tls = log_tls_get();
+    logman_tls* thread_tls = NULL;
+    std::thread t([&thread_tls]() { thread_tls = log_tls_get(); });
+    t.join();
+
+    EXPECT_TRUE(main_tls != NULL);
+    EXPECT_TRUE(thread_tls != NULL);
+    EXPECT_NE(main_tls, thread_tls);
+    EXPECT_EQ(main_tls, log_tls_get());
+    log_tls_destruct();
+}
+
 TEST(TestLogman, LogErr)
 {
     log_obj.err_message = new(char[256]);
     __log_log(LOGLEVEL_INFO, "file", "func", 2, "message");
     EXPECT_STREQ(log_get_internal_error(), "LOGMAN_ERROR::Message buffer uninitialized\n");
     delete(log_obj.err_message);
-}
\ No newline at end of file
+}
+
+static std::string async_sink_out;
+static void async_test_sink(logman_src* obj, const char *buf, size_t len, logman_level level)
+{
+    (void)obj;
+    (void)level;
+    async_sink_out.append(buf, len);
+}
+
+TEST(TestLogman, AsyncQueueOrder)
+{
+    logman_async async;
+    async_sink_out.clear();
+    ASSERT_EQ(log_async_init(&async, 3, async_test_sink), LOGERR_NOERR);
+    EXPECT_EQ(async.mask, 3);
+
+    EXPECT_TRUE(log_async_push(&async, "first\n", 6, LOGLEVEL_INFO));
+    EXPECT_TRUE(log_async_push(&async, "second\n", 7, LOGLEVEL_INFO));
+    EXPECT_EQ(log_async_drain(&async, 1), 1);
+    EXPECT_EQ(async_sink_out, "first\n");
+    EXPECT_EQ(log_async_drain(&async, ASYNC_BATCH_SIZE), 1);
+    EXPECT_EQ(async_sink_out, "first\nsecond\n");
+    EXPECT_EQ(log_async_drain(&async, ASYNC_BATCH_SIZE), 0);
+    log_async_destruct(&async);
+}
+
+TEST(TestLogman, AsyncQueueLarge)
+{
+    logman_async async;
+    async_sink_out.clear();
+    ASSERT_EQ(log_async_init(&async, 2, async_test_sink), LOGERR_NOERR);
+
+    std::string large(3 * MESSAGE_BUF_SIZE, 'x');
+    EXPECT_TRUE(log_async_push(&async, large.c_str(), large.size(), LOGLEVEL_INFO));
+    EXPECT_TRUE(log_async_push(&async, "small", 5, LOGLEVEL_INFO));
+    EXPECT_EQ(log_async_drain(&async, ASYNC_BATCH_SIZE), 2);
+    EXPECT_EQ(async_sink_out, large + "small");
+
+    // the buffer of the drained record is handed back and taken by the next one of its size
+    char* pooled = async.pool[1][0];
+    ASSERT_NE(pooled, nullptr);
+    EXPECT_TRUE(log_async_push(&async, large.c_str(), large.size() - 1, LOGLEVEL_INFO));
+    EXPECT_EQ(async.pool[1][0], nullptr);
+    EXPECT_EQ(async.slots[0].large, pooled);
+    EXPECT_EQ(log_async_drain(&async, ASYNC_BATCH_SIZE), 1);
+    EXPECT_EQ(async.pool[1][0], pooled);
+    log_async_destruct(&async);
+}
+
+TEST(TestLogman, AsyncQueueOverflow)
+{
+    logman_async async;
+    async_sink_out.clear();
+    ASSERT_EQ(log_async_init(&async, 2, async_test_sink), LOGERR_NOERR);
+
+    EXPECT_TRUE(log_async_push(&async, "1", 1, LOGLEVEL_INFO));
+    EXPECT_TRUE(log_async_push(&async, "2", 1, LOGLEVEL_INFO));
+    EXPECT_FALSE(log_async_push(&async, "3", 1, LOGLEVEL_INFO));
+    EXPECT_EQ(async.dropped, 1);
+
+    // destruct drains the records left in the queue
+    log_async_destruct(&async);
+    EXPECT_EQ(async_sink_out, "12");
+}
+
+TEST_F(TestLogmanFix, WriteAsyncOverflow)
+{
+    ASSERT_EQ(log_async_init(&log_obj.async, 2, async_test_sink), LOGERR_NOERR);
+    log_write_async(&log_obj, "1", 1, LOGLEVEL_INFO);
+    log_write_async(&log_obj, "2", 1, LOGLEVEL_INFO);
+    EXPECT_STREQ(log_obj.err_message, "");
+    log_write_async(&log_obj, "3", 1, LOGLEVEL_INFO);
+    EXPECT_STREQ(log_obj.err_message, "LOGMAN_ERROR::Async queue overflow, record dropped\n");
+}
+
+TEST(TestLogman, ParseFormatSpec)
+{
+    logman_fmt_spec spec;
+    EXPECT_EQ(log_fmt_parse_spec("%d::", &spec), 2);
+    EXPECT_EQ(spec.type, LOGARG_INT);
+    EXPECT_EQ(log_fmt_parse_spec("%-*.*lu", &spec), 7);
+    EXPECT_EQ(spec.type, LOGARG_LONG);
+    EXPECT_TRUE(spec.width_arg);
+    EXPECT_TRUE(spec.prec_arg);
+    EXPECT_EQ(log_fmt_parse_spec("%.5s", &spec), 4);
+    EXPECT_EQ(spec.type, LOGARG_STRING);
+    EXPECT_EQ(spec.prec, 5);
+    EXPECT_EQ(log_fmt_parse_spec("%hhx", &spec), 4);
+    EXPECT_EQ(spec.type, LOGARG_INT);
+    EXPECT_EQ(log_fmt_parse_spec("%lld", &spec), 4);
+    EXPECT_EQ(spec.type, LOGARG_LLONG);
+    EXPECT_EQ(log_fmt_parse_spec("%zu", &spec), 3);
+    EXPECT_EQ(spec.type, LOGARG_SIZE);
+    EXPECT_EQ(log_fmt_parse_spec("%Lf", &spec), 3);
+    EXPECT_EQ(spec.type, LOGARG_LDOUBLE);
+    EXPECT_EQ(log_fmt_parse_spec("%10.3e", &spec), 6);
+    EXPECT_EQ(spec.type, LOGARG_DOUBLE);
+    EXPECT_EQ(log_fmt_parse_spec("%p", &spec), 2);
+    EXPECT_EQ(spec.type, LOGARG_PTR);
+    EXPECT_EQ(log_fmt_parse_spec("%%", &spec), 2);
+    EXPECT_EQ(spec.type, LOGARG_NONE);
+    EXPECT_EQ(log_fmt_parse_spec("%", &spec), 1);
+    EXPECT_EQ(spec.type, LOGARG_NONE);
+}
+
+static size_t binary_encode(char* buf, size_t size, const char* fmt, ...)
+{
+    va_list va;
+    va_start(va, fmt);
+    size_t len = log_binary_encode(buf, size, 7, LOGLEVEL_WARNING, 42, fmt, va, NULL);
+    va_end(va);
+    return len;
+}
+
+static size_t binary_encode_need(char* buf, size_t size, size_t* need, const char* fmt, ...)
+{
+    va_list va;
+    va_start(va, fmt);
+    size_t len = log_binary_encode(buf, size, 7, LOGLEVEL_WARNING, 42, fmt, va, need);
+    va_end(va);
+    return len;
+}
+
+TEST(TestLogman, BinaryEncode)
+{
+    char buf[MESSAGE_BUF_SIZE];
+    size_t len = binary_encode(buf, sizeof(buf), "%d %s %5.1f%%", 3, "abc", 2.5);
+    ASSERT_EQ(len, BINARY_RECORD_HEAD_SIZE + sizeof(int) + sizeof(uint32_t) + 3 + sizeof(double));
+    EXPECT_EQ(buf[0], BINARY_TAG_RECORD);
+    EXPECT_EQ(buf[5], LOGLEVEL_WARNING);
+
+    int int_arg;
+    uint32_t str_len;
+    memcpy(&int_arg, &buf[BINARY_RECORD_HEAD_SIZE], sizeof(int_arg));
+    memcpy(&str_len, &buf[BINARY_RECORD_HEAD_SIZE + sizeof(int)], sizeof(str_len));
+    EXPECT_EQ(int_arg, 3);
+    EXPECT_EQ(str_len, 3);
+
+    // strings are cut to fit the record, fixed size arguments are not
+    EXPECT_EQ(binary_encode(buf, BINARY_RECORD_HEAD_SIZE + 6, "%s", "abcdef"), BINARY_RECORD_HEAD_SIZE + 6);
+    EXPECT_EQ(binary_encode(buf, BINARY_RECORD_HEAD_SIZE + 4, "%d %f", 1, 1.0), 0);
+    // the length of the whole record is reported either way
+    size_t need = 0;
+    EXPECT_EQ(binary_encode_need(buf, BINARY_RECORD_HEAD_SIZE + 6, &need, "%s %d", "abcdef", 1), 0);
+    EXPECT_EQ(need, BINARY_RECORD_HEAD_SIZE + sizeof(uint32_t) + 6 + sizeof(int));
+}
+
+static std::string read_test_file(void)
+{
+    char buf[256] = { 0 };
+    FILE *f = fopen(test_log_file, "r");
+    size_t len = fread(buf, sizeof(char), sizeof(buf) - 1, f);
+    fclose(f);
+    return std::string(buf, len);
+}
+
+TEST(TestLogman, FileBufferSize)
+{
+    logman_filebuf fb;
+    int fd = open(test_log_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ASSERT_EQ(log_filebuf_init(&fb, fd, 8, 0, false), LOGERR_NOERR);
+
+    EXPECT_TRUE(log_filebuf_write(&fb, "1234", 4, LOGLEVEL_INFO));
+    EXPECT_EQ(read_test_file(), "");
+    EXPECT_TRUE(log_filebuf_write(&fb, "5678", 4, LOGLEVEL_INFO));
+    EXPECT_EQ(read_test_file(), "12345678");
+    // a record larger than the buffer goes out with the buffered bytes
+    EXPECT_TRUE(log_filebuf_write(&fb, "ab", 2, LOGLEVEL_INFO));
+    EXPECT_TRUE(log_filebuf_write(&fb, "cdefghijk", 9, LOGLEVEL_INFO));
+    EXPECT_EQ(read_test_file(), "12345678abcdefghijk");
+
+    EXPECT_TRUE(log_filebuf_write(&fb, "l", 1, LOGLEVEL_INFO));
+    EXPECT_TRUE(log_filebuf_destruct(&fb));
+    EXPECT_EQ(read_test_file(), "12345678abcdefghijkl");
+    remove(test_log_file);
+}
+
+TEST(TestLogman, FileBufferFlushOnError)
+{
+    logman_filebuf fb;
+    int fd = open(test_log_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ASSERT_EQ(log_filebuf_init(&fb, fd, 1024, 0, true), LOGERR_NOERR);
+
+    EXPECT_TRUE(log_filebuf_write(&fb, "warning\n", 8, LOGLEVEL_WARNING));
+    EXPECT_EQ(read_test_file(), "");
+    EXPECT_TRUE(log_filebuf_write(&fb, "error\n", 6, LOGLEVEL_ERROR));
+    EXPECT_EQ(read_test_file(), "warning\nerror\n");
+
+    EXPECT_TRUE(log_filebuf_destruct(&fb));
+    remove(test_log_file);
+}
+
+TEST(TestLogman, FileBufferInterval)
+{
+    logman_filebuf fb;
+    int fd = open(test_log_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ASSERT_EQ(log_filebuf_init(&fb, fd, 1024, 10, false), LOGERR_NOERR);
+
+    EXPECT_TRUE(log_filebuf_write(&fb, "info\n", 5, LOGLEVEL_INFO));
+    for (int i = 0; i < 100 && read_test_file().empty(); i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    EXPECT_EQ(read_test_file(), "info\n");
+
+    EXPECT_TRUE(log_filebuf_destruct(&fb));
+    remove(test_log_file);
+}
+
+static std::string read_file(const std::string& name)
+{
+    std::string data;
+    FILE *f = fopen(name.c_str(), "r");
+    if (f == NULL) {
+        return data;
+    }
+    char buf[256];
+    size_t len;
+    while ((len = fread(buf, sizeof(char), sizeof(buf), f)) != 0) {
+        data.append(buf, len);
+    }
+    fclose(f);
+    return data;
+}
+
+TEST(TestLogman, FileBufferRotateSize)
+{
+    logman_filebuf fb;
+    int fd = open(test_log_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ASSERT_EQ(log_filebuf_init(&fb, fd, 4, 0, false), LOGERR_NOERR);
+    ASSERT_EQ(log_filebuf_rotate(&fb, test_log_file, 8, 0, 2), LOGERR_NOERR);
+
+    const char* records[] = { "aaaa", "bbbb", "cccc", "dddd", "eeee", "ffff", "gggg", "hhhh" };
+    for (const char* record : records) {
+        // the writer never waits for the worker, wait for the next file here to get exact cuts
+        for (int i = 0; i < 100 && __atomic_load_n(&fb.rotate.next_fd, __ATOMIC_ACQUIRE) < 0; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        EXPECT_TRUE(log_filebuf_write(&fb, record, 4, LOGLEVEL_INFO));
+    }
+    EXPECT_TRUE(log_filebuf_destruct(&fb));
+
+    std::string name(test_log_file);
+    EXPECT_EQ(read_file(name), "");
+    EXPECT_EQ(read_file(name + ".1"), "gggghhhh");
+    EXPECT_EQ(read_file(name + ".2"), "eeeeffff");
+    // only rotate_keep files are retained
+    EXPECT_EQ(access((name + ".3").c_str(), F_OK), -1);
+    EXPECT_EQ(access((name + ".next").c_str(), F_OK), -1);
+
+    remove(test_log_file);
+    remove((name + ".1").c_str());
+    remove((name + ".2").c_str());
+}
+
+TEST(TestLogman, MmapChunks)
+{
+    logman_mmap mm;
+    ASSERT_EQ(log_mmap_init(&mm, test_log_file, 1), LOGERR_NOERR);
+    size_t chunk = mm.chunk_size;
+
+    // records cross the chunk border
+    std::string expect;
+    std::string record(chunk / 3 + 1, 'x');
+    for (int i = 0; i < 7; i++) {
+        record[0] = '0' + i;
+        EXPECT_TRUE(log_mmap_write(&mm, record.c_str(), record.size()));
+        expect += record;
+    }
+    EXPECT_EQ(mm.mapped, 3u);
+    EXPECT_TRUE(log_mmap_destruct(&mm));
+
+    FILE *f = fopen(test_log_file, "r");
+    std::string buf(expect.size() + 1, '\0');
+    // the file is cut to the written length
+    EXPECT_EQ(fread(&buf[0], sizeof(char), buf.size(), f), expect.size());
+    fclose(f);
+    buf.resize(expect.size());
+    EXPECT_EQ(buf, expect);
+    remove(test_log_file);
+}
+
+TEST(TestLogman, MmapChunksThreaded)
+{
+    logman_mmap mm;
+    ASSERT_EQ(log_mmap_init(&mm, test_log_file, 1), LOGERR_NOERR);
+    const int threads = 4;
+    const int records = 2000;
+
+    std::vector<std::thread> writers;
+    for (int t = 0; t < threads; t++) {
+        writers.emplace_back([&mm, t]() {
+            for (int i = 0; i < records; i++) {
+                std::string record = "thread " + std::to_string(t) + " record " + std::to_string(i) + "\n";
+                EXPECT_TRUE(log_mmap_write(&mm, record.c_str(), record.size()));
+            }
+        });
+    }
+    for (auto& writer : writers) {
+        writer.join();
+    }
+    EXPECT_TRUE(log_mmap_destruct(&mm));
+
+    // every record lands whole, in order within its thread
+    std::string data = read_file(test_log_file);
+    std::vector<int> next(threads, 0);
+    int lines = 0;
+    for (size_t pos = 0, end; pos < data.size(); pos = end + 1) {
+        end = data.find('\n', pos);
+        ASSERT_NE(end, std::string::npos);
+        std::string line = data.substr(pos, end - pos);
+        int t, i;
+        ASSERT_EQ(sscanf(line.c_str(), "thread %d record %d", &t, &i), 2) << line;
+        ASSERT_TRUE(t >= 0 && t < threads);
+        EXPECT_EQ(i, next[t]++);
+        lines++;
+    }
+    EXPECT_EQ(lines, threads * records);
+    remove(test_log_file);
+}
+
+TEST(TestLogman, MmapChunkFailure)
+{
+    logman_mmap mm;
+    ASSERT_EQ(log_mmap_init(&mm, test_log_file, 1), LOGERR_NOERR);
+    size_t chunk = mm.chunk_size;
+
+    // the third chunk cannot be preallocated past the file size limit
+    struct rlimit old_limit;
+    getrlimit(RLIMIT_FSIZE, &old_limit);
+    struct rlimit limit = { 2 * chunk, old_limit.rlim_max };
+    setrlimit(RLIMIT_FSIZE, &limit);
+    sighandler_t old_handler = signal(SIGXFSZ, SIG_IGN);
+
+    std::string record(chunk / 2, 'x');
+    for (int i = 0; i < 4; i++) {
+        EXPECT_TRUE(log_mmap_write(&mm, record.c_str(), record.size()));
+    }
+    EXPECT_FALSE(log_mmap_write(&mm, record.c_str(), record.size()));
+    // later writes fail at once instead of remapping a dead chunk
+    EXPECT_FALSE(log_mmap_write(&mm, record.c_str(), record.size()));
+    EXPECT_TRUE(log_mmap_destruct(&mm));
+
+    setrlimit(RLIMIT_FSIZE, &old_limit);
+    signal(SIGXFSZ, old_handler);
+
+    // the file ends at the last written byte
+    struct stat st;
+    ASSERT_EQ(stat(test_log_file, &st), 0);
+    EXPECT_EQ((size_t)st.st_size, 2 * chunk);
+    remove(test_log_file);
+}
+static std::string encode_json(size_t cap, const char* msg, const logman_kv* kv, size_t count)
+{
+    std::vector<char> buf(cap + KV_CLOSE_SIZE);
+    logman_enc enc = { buf.data(), 0, cap, false };
+    logman_site site = { "f.c", "fn", 7, LOGLEVEL_INFO, false, 0, NULL, false };
+    logman_record rec = { LOGLEVEL_INFO, &site, msg, NULL, kv, count };
+    log_enc_json(&enc, "date", &rec, msg, strlen(msg));
+    return std::string(buf.data(), enc.len);
+}
+
+TEST(TestLogman, EncodeJson)
+{
+    std::string quoted = "a\"b\\c\n\x01" + std::string(40, 'x');
+    logman_kv kv[] = {
+        LOGKV_INT("int", -42),
+        LOGKV_UINT("uint", 18446744073709551615ull),
+        LOGKV_DOUBLE("double", -2.5),
+        LOGKV_BOOL("bool", true),
+        LOGKV_STR("str", quoted.c_str()),
+    };
+    EXPECT_EQ(encode_json(1024, "msg", kv, 5),
+        "{\"time\":\"date\",\"level\":\"INFO\",\"file\":\"f.c\",\"func\":\"fn\",\"line\":7,\"msg\":\"msg\","
+        "\"int\":-42,\"uint\":18446744073709551615,\"double\":-2.5,\"bool\":true,"
+        "\"str\":\"a\\\"b\\\\c\\n\\u0001" + std::string(40, 'x') + "\"}\n");
+
+    // a string value is cut, the record stays valid JSON
+    std::string cut = encode_json(110, "msg", kv, 5);
+    EXPECT_EQ(cut, "{\"time\":\"date\",\"level\":\"INFO\",\"file\":\"f.c\",\"func\":\"fn\",\"line\":7,\"msg\":\"msg\","
+        "\"int\":-42}\n");
+    std::string long_msg(300, 'm');
+    cut = encode_json(100, long_msg.c_str(), NULL, 0);
+    EXPECT_EQ(cut.substr(cut.size() - 5), "mm\"}\n");
+    EXPECT_EQ(cut.size(), 100 + 2);
+}
+
+TEST(TestLogman, EncodeFields)
+{
+    char buf[256];
+    logman_kv kv[] = {
+        LOGKV_STR("plain", "value"),
+        LOGKV_STR("spaced", "two words"),
+        LOGKV_STR("empty", ""),
+        LOGKV_DOUBLE("pi", 3.14159),
+        LOGKV_DOUBLE("big", 1e20),
+        LOGKV_DOUBLE("zero", 0.0),
+        LOGKV_INT("neg", -7),
+    };
+    logman_enc enc = { buf, 0, sizeof(buf) - KV_CLOSE_SIZE, false };
+    log_enc_fields(&enc, kv, 7);
+    EXPECT_EQ(std::string(buf, enc.len),
+        " plain=value spaced=\"two words\" empty=\"\" pi=3.14159 big=1e+20 zero=0 neg=-7");
+    EXPECT_FALSE(enc.full);
+
+    // fields that do not fit are left out as a whole
+    enc = { buf, 0, 20, false };
+    log_enc_fields(&enc, kv, 7);
+    EXPECT_EQ(std::string(buf, enc.len), " plain=value");
+    EXPECT_TRUE(enc.full);
+}
+
+TEST(TestLogman, Utoa)
+{
+    char buf[32];
+    EXPECT_EQ(std::string(buf, log_utoa(buf, 0)), "0");
+    EXPECT_EQ(std::string(buf, log_utoa(buf, 9)), "9");
+    EXPECT_EQ(std::string(buf, log_utoa(buf, 10)), "10");
+    EXPECT_EQ(std::string(buf, log_utoa(buf, 12345)), "12345");
+    EXPECT_EQ(std::string(buf, log_utoa(buf, 18446744073709551615ull)), "18446744073709551615");
+}
+
+TEST(TestLogman, LimitCounters)
+{
+    logman_limit limit;
+    memset(&limit, 0, sizeof(limit));
+    int passed = 0;
+    for (int i = 0; i < 5; i++) {
+        passed += __log_limit_first_n(&limit, 2) ? 1 : 0;
+    }
+    EXPECT_EQ(passed, 2);
+    EXPECT_EQ(limit.count, 2u);
+
+    memset(&limit, 0, sizeof(limit));
+    passed = 0;
+    for (int i = 0; i < 7; i++) {
+        passed += __log_limit_every_n(&limit, 3) ? 1 : 0;
+    }
+    EXPECT_EQ(passed, 3);
+    EXPECT_EQ(limit.suppressed, 4u);
+}
+
+TEST(TestLogman, LimitTime)
+{
+    logman_limit limit;
+    memset(&limit, 0, sizeof(limit));
+    EXPECT_TRUE(__log_limit_interval(&limit, 60000000000ull));
+    EXPECT_FALSE(__log_limit_interval(&limit, 60000000000ull));
+    EXPECT_EQ(limit.suppressed, 1u);
+    limit.next = 0;
+    EXPECT_TRUE(__log_limit_interval(&limit, 60000000000ull));
+
+    // a full bucket lets burst records through, then one per refill
+    memset(&limit, 0, sizeof(limit));
+    int passed = 0;
+    for (int i = 0; i < 10; i++) {
+        passed += __log_limit_bucket(&limit, 1.0, 3) ? 1 : 0;
+    }
+    EXPECT_EQ(passed, 3);
+    EXPECT_EQ(limit.suppressed, 7u);
+    limit.next -= 1000000000ull;
+    EXPECT_TRUE(__log_limit_bucket(&limit, 1.0, 3));
+    EXPECT_FALSE(__log_limit_bucket(&limit, 1.0, 3));
+    EXPECT_FALSE(__log_limit_bucket(&limit, 0.0, 3));
+}
+
+static std::string recorder_render(const char* fmt, ...)
+{
+    char args[RECORDER_DATA_SIZE];
+    va_list va;
+    va_start(va, fmt);
+    size_t len = log_binary_encode(args, sizeof(args), 0, LOGLEVEL_DEBUG, 0, fmt, va, NULL);
+    va_end(va);
+    char buf[RECORDER_LINE_SIZE];
+    return std::string(buf, log_recorder_render(buf, sizeof(buf), fmt, args, len));
+}
+
+TEST(TestLogman, RecorderRender)
+{
+    EXPECT_EQ(recorder_render("plain 100%%"), "plain 100%");
+    EXPECT_EQ(recorder_render("%d %i %u", -42, 7, 3000000000u), "-42 7 3000000000");
+    EXPECT_EQ(recorder_render("%ld %lld %zu", -1L, -9000000000LL, (size_t)12), "-1 -9000000000 12");
+    EXPECT_EQ(recorder_render("%x %X %o %c", 255, 255, 8, 'z'), "ff FF 10 z");
+    EXPECT_EQ(recorder_render("%p", (void*)0x1234), "0x1234");
+    EXPECT_EQ(recorder_render("%s/%.3s", "full", "cut here"), "full/cut");
+    EXPECT_EQ(recorder_render("%f %.2f %.0f", 1.5, -3.14159, 2.75), "1.500000 -3.14 3");
+    // width is taken from the arguments but not applied
+    EXPECT_EQ(recorder_render("[%5d] [%*d]", 1, 4, 2), "[1] [2]");
+
+    char buf[32];
+    EXPECT_EQ(log_time_render_utc(buf, 0), 27u);
+    EXPECT_EQ(std::string(buf, 27), "1970-01-01T00:00:00.000000Z");
+    EXPECT_EQ(std::string(buf, log_time_render_utc(buf, 1700000000123456789ull)), "2023-11-14T22:13:20.123456Z");
+}
+
+static std::string lz4_roundtrip(const std::string& in)
+{
+    std::vector<uint8_t> packed(LOG_LZ4_BOUND(in.size()));
+    std::vector<uint32_t> table(4096);
+    size_t n = log_lz4_block((const uint8_t*)in.data(), in.size(), packed.data(), table.data());
+    EXPECT_LE(n, packed.size());
+    std::string out(in.size(), '\0');
+    size_t m = log_lz4_unblock(packed.data(), n, (uint8_t*)&out[0], out.size());
+    EXPECT_NE(m, SIZE_MAX);
+    out.resize(m == SIZE_MAX ? 0 : m);
+    return out;
+}
+
+TEST(TestLogman, CompressLz4Block)
+{
+    EXPECT_EQ(log_xxh32((const uint8_t*)"", 0, 0), 0x02CC5D05u);
+    EXPECT_EQ(log_xxh32((const uint8_t*)"abc", 3, 0), 0x32D153FFu);
+    const char* longer = "Nobody inspects the spammish repetition";
+    EXPECT_EQ(log_xxh32((const uint8_t*)longer, strlen(longer), 0), 0xE2293B2Fu);
+
+    std::string text;
+    for (int i = 0; i < 5000; i++) {
+        text += "18.10.2026 04:02:03::INFO::request " + std::to_string(i * 7919 % 1000) + " done\n";
+    }
+    EXPECT_EQ(lz4_roundtrip(text), text);
+    // long matches overlapping their own output
+    EXPECT_EQ(lz4_roundtrip(std::string(100000, 'a')), std::string(100000, 'a'));
+    std::string noise;
+    unsigned int seed = 1;
+    for (int i = 0; i < 70000; i++) {
+        seed = seed * 1103515245u + 12345u;
+        noise += (char)(seed >> 16);
+    }
+    EXPECT_EQ(lz4_roundtrip(noise), noise);
+    for (size_t len = 0; len < 40; len++) {
+        EXPECT_EQ(lz4_roundtrip(text.substr(0, len)), text.substr(0, len));
+    }
+
+    uint8_t bad[] = { 0x1f, 'a', 0x05, 0x00 };
+    uint8_t out[64];
+    EXPECT_EQ(log_lz4_unblock(bad, sizeof(bad), out, sizeof(out)), SIZE_MAX);
+}
+
+TEST(TestLogman, QueryParseTime)
+{
+    time_t t = 0;
+    EXPECT_EQ(log_query_parse_time("2023-11-14T22:13:20Z", 20, &t), 20u);
+    EXPECT_EQ(t, 1700000000);
+    EXPECT_EQ(log_query_parse_time("2023-11-14T22:13:20.123456Z::INFO::", 35, &t), 27u);
+    EXPECT_EQ(t, 1700000000);
+
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_year = 2026 - 1900;
+    tm.tm_mon = 9;
+    tm.tm_mday = 18;
+    tm.tm_hour = 4;
+    tm.tm_min = 2;
+    tm.tm_sec = 3;
+    tm.tm_isdst = -1;
+    EXPECT_EQ(log_query_parse_time("18.10.2026 04:02:03.250::INFO::", 31, &t), 23u);
+    EXPECT_EQ(t, mktime(&tm));
+
+    EXPECT_EQ(log_query_parse_time("18.10.2026 04:02", 16, &t), 0u);
+    EXPECT_EQ(log_query_parse_time("18/10/2026 04:02:03", 19, &t), 0u);
+    EXPECT_EQ(log_query_parse_time("2023-11-14 22:13:20", 19, &t), 0u);
+}
+
+TEST(TestLogman, ClockConversion)
+{
+    ASSERT_EQ(log_clock_start(), LOGERR_NOERR);
+    uint64_t prev = 0;
+    for (int i = 0; i < 100000; i++) {
+        uint64_t ns = log_clock_ns(log_clock_read());
+        ASSERT_GE(ns, prev);
+        prev = ns;
+    }
+
+    struct timespec wall, ts;
+    clock_gettime(CLOCK_REALTIME, &wall);
+    log_time_now(&ts, LOGPREC_NSEC, true);
+    long long diff = ((long long)ts.tv_sec - wall.tv_sec) * 1000000000ll + (ts.tv_nsec - wall.tv_nsec);
+    EXPECT_LT(diff < 0 ? -diff : diff, CLOCK_STEP_NS);
+    log_clock_stop();
+}
+
+TEST(TestLogman, ClockSpan)
+{
+    // calibrated once up front, spans are converted without waiting
+    log_clock_span_init();
+    uint64_t start = log_clock_read();
+    struct timespec pause = { 0, 20 * 1000 * 1000 };
+    nanosleep(&pause, NULL);
+    uint64_t span = log_clock_span_ns(log_clock_read() - start);
+    EXPECT_GE(span, 19u * 1000 * 1000);
+    EXPECT_LT(span, 200u * 1000 * 1000);
+
+    uint64_t before = __log_clock_fallback();
+    log_clock_span_ns(1000);
+    EXPECT_LT(__log_clock_fallback() - before, (uint64_t)CLOCK_CALIBRATE_NS);
+}
@@ -0,0 +1,41 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "logman_int.h"
+
+int main(int argc, char** argv)
+{
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "usage: %s <binary or compressed log> [text log]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    FILE* in = fopen(argv[1], "rb");
+    if (in == NULL) {
+        fprintf(stderr, "logman-decode: unable to open %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    FILE* out = (argc == 3) ? fopen(argv[2], "w") : stdout;
+    if (out == NULL) {
+        fprintf(stderr, "logman-decode: unable to create %s\n", argv[2]);
+        fclose(in);
+        return EXIT_FAILURE;
+    }
+
+    // compressed text logs are recognized by the magic of their first frame
+    char magic[4];
+    size_t magic_len = fread(magic, 1, sizeof(magic), in);
+    bool compressed = log_compress_magic(magic, magic_len);
+    rewind(in);
+    logman_error err = compressed ? log_compress_decode(in, out) : log_binary_decode(in, out);
+    fclose(in);
+    if (out != stdout) {
+        fclose(out);
+    }
+    if (err != LOGERR_NOERR) {
+        fprintf(stderr, "logman-decode: %s is not a valid logman binary or compressed log\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,63 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "logman_int.h"
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-f from] [-t to] [-l level] <log file>\n"
+                    "  from, to  \"dd.mm.yyyy hh:mm:ss\" (local time) or yyyy-mm-ddThh:mm:ssZ, both included\n"
+                    "  level     DEBUG, INFO, WARNING or ERROR, records of this level and above\n", name);
+}
+
+static bool parse_time(const char* text, time_t* t)
+{
+    size_t len = strlen(text);
+    return log_query_parse_time(text, len, t) == len;
+}
+
+int main(int argc, char** argv)
+{
+    logman_query query;
+    memset(&query, 0, sizeof(query));
+    int opt;
+    while ((opt = getopt(argc, argv, "f:t:l:")) != -1) {
+        bool ok = true;
+        switch (opt) {
+            case 'f':
+                ok = parse_time(optarg, &query.from);
+                break;
+            case 't':
+                ok = parse_time(optarg, &query.to);
+                break;
+            case 'l':
+                ok = false;
+                for (int i = 0; i < LOGLEVEL_COUNT; i++) {
+                    if (strcmp(optarg, level_tag[i]) == 0) {
+                        query.min_level = (logman_level)i;
+                        ok = true;
+                    }
+                }
+                break;
+            default:
+                ok = false;
+                break;
+        }
+        if (!ok) {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (log_index_query(argv[optind], &query, stdout) != LOGERR_NOERR) {
+        fprintf(stderr, "logman-query: unable to read %s\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}